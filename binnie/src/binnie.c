@@ -45,6 +45,7 @@
 #include "binnie.h"
 #include "binnie_log.h"
 #include "binnie_files.h"
+#include "binnie_checksum.h"
 #include "binnie_process.h"
 
 /* copyright notice for --version output (%s is symbol and %d is year) */
@@ -87,6 +88,12 @@ unsigned int max_buffer_bases;
 /* suffix to add to original input file to get an output name if remap_out_file was not specified */
  const char *remap_out_suffix = "_remap.bam";
 
+/* filename of read checksum sidecar output (or NULL for none) */
+ char *checksum_out_file;
+
+/* whether read checksums cover the sequence as well as read identity */
+ bool checksum_seq;
+
 
 void print_usage() 
 {
@@ -104,6 +111,10 @@ void print_help()
   fprintf(stderr, gettext("  -m, --max_buffer_bases       Size of output buffer (in bases) [default: %d]\n"), BINNIE_DEFAULT_BUFFER_BASES);
   fprintf(stderr, gettext("  -i, --ignore_rg              Ignore read group (RG) when matching reads between original and bridge\n"));
   fprintf(stderr, gettext("  -a, --allow_sorted_unmapped  Allow reads with flag 0x4 set to be sorted according to their refid and pos\n"));
+  fprintf(stderr, gettext("  -c, --checksum_out           Filename of read checksums (original and per bin counts, sums and xors of RG+QNAME+segment hashes)\n"));
+  fprintf(stderr, gettext("  -C, --checksum_seq           Include read sequences in the checksums\n"));
+  fprintf(stderr, gettext("  -U, --io_uring=N             Write output bins asynchronously (io_uring) with up to N 1MiB blocks in flight per bin\n"));
+  fprintf(stderr, gettext("  -D, --direct_io              With --io_uring, bypass the page cache (O_DIRECT) where the file system allows it\n"));
   fprintf(stderr, gettext("  -h, --help                   Print short help message and exit\n"));
   fprintf(stderr, gettext("  -v, --verbose[=level]        Increase/Set level of verbosity (-vvv sets level 3 as does --verbose=3)\n"));
 #ifdef DEBUG
@@ -123,6 +134,7 @@ void print_help()
  */
 int main(int argc, char **argv) 
 {
+  binnie_checksum_t *checksums = NULL;
 
   /* setup progname */
   set_program_name (argv[0]);
@@ -139,6 +151,10 @@ int main(int argc, char **argv)
   unchanged_out_file = NULL;
   bridged_out_file = NULL;
   remap_out_file = NULL;
+  checksum_out_file = NULL;
+  checksum_seq = false;
+  io_uring_depth = 0;
+  direct_io = false;
   
   DLOG("main: started");
 
@@ -162,6 +178,10 @@ int main(int argc, char **argv)
 	  {"max_buffer_bases",  	required_argument,	0,	'm'},
 	  {"ignore_rg",         	no_argument,            0,      'i'},
 	  {"allow_sorted_unmapped",    	no_argument,            0,      'a'},
+	  {"checksum_out",		required_argument,	0,	'c'},
+	  {"checksum_seq",		no_argument,		0,	'C'},
+	  {"io_uring",			required_argument,	0,	'U'},
+	  {"direct_io",			no_argument,		0,	'D'},
 	  {"help",			no_argument,		0,	'h'},
  	  {"verbose",	        	optional_argument,	0,	 0 },
  	  {"verbose",           	no_argument,		0,	'v'},
@@ -173,7 +193,7 @@ int main(int argc, char **argv)
 	};
       option_index = 0;
       
-      c = getopt_long(argc, argv, "u:b:r:s:m:iahvdV", binnie_options, &option_index);
+      c = getopt_long(argc, argv, "u:b:r:s:m:iac:CU:DhvdV", binnie_options, &option_index);
 
       if (c < 0)
 	break;
@@ -209,6 +229,22 @@ int main(int argc, char **argv)
 	case 'a':
 	  allow_sorted_unmapped = true;
 	  break;
+	case 'c':
+	  checksum_out_file = xstrdup(optarg);
+	  break;
+	case 'C':
+	  checksum_seq = true;
+	  break;
+	case 'U':
+	  io_uring_depth = atoi(optarg);
+	  if (io_uring_depth < 1 || io_uring_depth > 256)
+	    {
+	      errx(BINNIE_EXIT_ERR_ARGS, gettext("--io_uring must be between 1 and 256"));
+	    }
+	  break;
+	case 'D':
+	  direct_io = true;
+	  break;
 	case 'h':
 	  print_help();
 	  exit(BINNIE_EXIT_SUCCESS);
@@ -257,6 +293,16 @@ int main(int argc, char **argv)
       blog(1, gettext("allowing reads with 0x4 flag set to be sorted according to their refid and pos"));
     }
 
+  if (direct_io && io_uring_depth == 0)
+    {
+      errx(BINNIE_EXIT_ERR_ARGS, gettext("--direct_io needs --io_uring"));
+    }
+
+  if (io_uring_depth > 0)
+    {
+      blog(1, gettext("writing output bins asynchronously with %d blocks in flight%s"), io_uring_depth, direct_io ? gettext(", bypassing the page cache") : "");
+    }
+
   if (buffer_size > 0)
     {
       blog(1, gettext("buffer size set to %d reads"), buffer_size);
@@ -347,7 +393,17 @@ int main(int argc, char **argv)
 
   /* process data */
   blog(1, gettext("beginning binnie processing"));
-  binnie_process(buffer_size, max_buffer_bases, original_in_fp, bridge_in_fp, unchanged_out_fp, bridged_out_fp, remap_out_fp);
+  if (checksum_out_file != NULL)
+    {
+      checksums = xcalloc(BINNIE_CHECKSUM_COUNT, sizeof(binnie_checksum_t));
+    }
+  binnie_process(buffer_size, max_buffer_bases, original_in_fp, bridge_in_fp, unchanged_out_fp, bridged_out_fp, remap_out_fp, checksums, checksum_seq);
+
+  if (checksum_out_file != NULL)
+    {
+      blog(2, gettext("writing read checksums to %s"), checksum_out_file);
+      binnie_checksum_write(checksum_out_file, checksums, checksum_seq);
+    }
 
 
   /* clean up */
@@ -366,6 +422,8 @@ int main(int argc, char **argv)
   free(unchanged_out_file);
   free(bridged_out_file);
   free(remap_out_file);
+  free(checksum_out_file);
+  free(checksums);
 
 
   blog(1, gettext("finished!"));
@@ -42,6 +42,15 @@ bool ignore_rg;
 bool allow_sorted_unmapped;
 
 
+/* 
+ * if greater than 0, write output files through an asynchronous (io_uring) 
+ * writer with up to this many 1MiB blocks in flight, bypassing the page 
+ * cache if direct_io is set
+ */
+int io_uring_depth;
+bool direct_io;
+
+
 /* option defaults */
 #define BINNIE_DEFAULT_BUFFER_SIZE  100000
 #define BINNIE_DEFAULT_BUFFER_BASES 1000
@@ -0,0 +1,199 @@
+/*
+ * binnie_checksum.c - order-independent read conservation checksums
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+
+/* internationalisation */
+#include "gettext.h"
+
+/* binnie includes */
+#include "binnie.h"
+#include "binnie_log.h"
+#include "binnie_checksum.h"
+
+/* htslib for sam/bam processing */
+#include <htslib/sam.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+/* complement of each 4-bit BAM base code */
+static const uint8_t nt16_complement[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+
+static const char *checksum_label[BINNIE_CHECKSUM_COUNT] = { "original", "unchanged", "bridged", "remap" };
+
+static uint64_t fnv_bytes (uint64_t h, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= p[i];
+      h *= FNV_PRIME;
+    }
+  return h;
+}
+
+
+/*
+ * binnie_checksum_add
+ * -------------------
+ *
+ * Adds one read to a checksum set.  Each read is hashed on its read group,
+ * QNAME and segment (the READ1/READ2 flags), and optionally its sequence
+ * in the orientation it was sequenced in, and the hashes are combined by
+ * addition and exclusive-or so the result does not depend on read order.
+ * Sets can then be compared across files sorted or binned differently (the
+ * sums and counts of binnie's three output bins add up to the original's).
+ * Secondary and supplementary alignments are not counted so each read is
+ * only seen once.  Brunel's --checksum computes exactly the same hash.
+ *
+ * INPUT: checksum set, read, and whether to include the sequence
+ *
+ */
+void binnie_checksum_add (binnie_checksum_t *ck, const bam1_t *b, bool with_seq)
+{
+  uint64_t h;
+  uint8_t *rg;
+  uint8_t segment;
+  uint8_t zero;
+  int32_t i;
+
+  if (b->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY))
+    return;
+
+  zero = 0;
+  h = FNV_OFFSET;
+  rg = bam_aux_get(b, "RG");
+  if (rg > 0)
+    {
+      const char *rg_id = bam_aux2Z(rg);
+      h = fnv_bytes(h, rg_id, strlen(rg_id));
+    }
+  h = fnv_bytes(h, &zero, 1);
+  h = fnv_bytes(h, bam_get_qname(b), strlen(bam_get_qname(b)));
+  h = fnv_bytes(h, &zero, 1);
+  segment = (b->core.flag & (BAM_FREAD1 | BAM_FREAD2)) >> 6;
+  h = fnv_bytes(h, &segment, 1);
+
+  if (with_seq)
+    {
+      const uint8_t *seq = bam_get_seq(b);
+      int32_t len = b->core.l_qseq;
+      for (i = 0; i < len; i++)
+	{
+	  uint8_t base;
+	  if (bam_is_rev(b))
+	    base = nt16_complement[bam_seqi(seq, len - 1 - i)];
+	  else
+	    base = bam_seqi(seq, i);
+	  h = fnv_bytes(h, &base, 1);
+	}
+    }
+
+  /* finalise (splitmix64) so that sums of similar names spread well */
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+
+  ck->count++;
+  ck->sum += h;
+  ck->xor ^= h;
+}
+
+
+/*
+ * binnie_checksum_equal
+ * ---------------------
+ *
+ * INPUT: two checksum sets
+ * OUTPUT: true if they cover the same reads
+ *
+ */
+bool binnie_checksum_equal (const binnie_checksum_t *ck1, const binnie_checksum_t *ck2)
+{
+  return ck1->count == ck2->count && ck1->sum == ck2->sum && ck1->xor == ck2->xor;
+}
+
+
+/*
+ * binnie_checksum_write
+ * ---------------------
+ *
+ * Writes the original, unchanged, bridged and remap checksum sets, and the
+ * three bins combined, to a tab-separated sidecar file.
+ *
+ * INPUT: filename, array of BINNIE_CHECKSUM_COUNT checksum sets, and 
+ *        whether they include the sequence
+ *
+ */
+void binnie_checksum_write (const char *filename, const binnie_checksum_t *cks, bool with_seq)
+{
+  FILE *fp;
+  binnie_checksum_t bins;
+  int i;
+
+  DLOG("binnie_checksum_write: filename=[%s]", filename);
+
+  fp = fopen(filename, "w");
+  if (fp == NULL)
+    {
+      err(BINNIE_EXIT_ERR_OUT_FILES, gettext("binnie_checksum_write: could not open checksum file [%s]"), filename);
+    }
+
+  memset(&bins, 0, sizeof(bins));
+  fprintf(fp, "#set\tcount\tsum\txor\t(RG+QNAME+segment%s)\n", with_seq ? "+SEQ" : "");
+  for (i = 0; i < BINNIE_CHECKSUM_COUNT; i++)
+    {
+      fprintf(fp, "%s\t%llu\t%016llx\t%016llx\n", checksum_label[i], (unsigned long long) cks[i].count, 
+	      (unsigned long long) cks[i].sum, (unsigned long long) cks[i].xor);
+      if (i != BINNIE_CHECKSUM_ORIGINAL)
+	{
+	  bins.count += cks[i].count;
+	  bins.sum += cks[i].sum;
+	  bins.xor ^= cks[i].xor;
+	}
+    }
+  fprintf(fp, "bins\t%llu\t%016llx\t%016llx\n", (unsigned long long) bins.count, 
+	  (unsigned long long) bins.sum, (unsigned long long) bins.xor);
+
+  if (ferror(fp) || fclose(fp) != 0)
+    {
+      err(BINNIE_EXIT_ERR_WRITE, gettext("binnie_checksum_write: could not write checksum file [%s]"), filename);
+    }
+
+  if (!binnie_checksum_equal(&cks[BINNIE_CHECKSUM_ORIGINAL], &bins))
+    {
+      blog(0, gettext("WARNING: reads written to the bins (%llu) do not match the original reads (%llu)"), 
+	   (unsigned long long) bins.count, (unsigned long long) cks[BINNIE_CHECKSUM_ORIGINAL].count);
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * binnie_checksum.h - order-independent read conservation checksums
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BINNIE_CHECKSUM_H
+#define BINNIE_CHECKSUM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <htslib/sam.h>
+
+/* checksum sets written by binnie, in file order */
+#define BINNIE_CHECKSUM_ORIGINAL  0
+#define BINNIE_CHECKSUM_UNCHANGED 1
+#define BINNIE_CHECKSUM_BRIDGED   2
+#define BINNIE_CHECKSUM_REMAP     3
+#define BINNIE_CHECKSUM_COUNT     4
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t xor;
+} binnie_checksum_t;
+
+void binnie_checksum_add (binnie_checksum_t *ck, const bam1_t *b, bool with_seq);
+
+bool binnie_checksum_equal (const binnie_checksum_t *ck1, const binnie_checksum_t *ck2);
+
+void binnie_checksum_write (const char *filename, const binnie_checksum_t *cks, bool with_seq);
+
+#endif
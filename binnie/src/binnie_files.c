@@ -36,9 +36,21 @@
 
 #include <htslib/sam.h>
 
+#include "binnie.h"
+#include "bb_asyncout.h"
 #include "binnie_files.h"
 #include "binnie_log.h"
 
+/* asynchronous writers behind output files opened with io_uring_depth > 0 */
+struct binnie_async_file
+{
+  samFile *fp;
+  async_out_t *out;
+};
+static struct binnie_async_file *async_files;
+static size_t async_files_n;
+static size_t async_files_alloc;
+
 /*
  * binnie_open_out
  *
@@ -51,6 +63,9 @@ samFile *binnie_open_out(const char *filename)
 {
   samFile *fp;
   int filename_len;
+  const char *mode;
+  const char *path;
+  async_out_t *out;
 
   DLOG("binnie_open_out: filename=[%s]", filename);
 
@@ -67,19 +82,11 @@ samFile *binnie_open_out(const char *filename)
   filename_len = strlen(filename);
   if ( !strcasecmp(".bam", filename + filename_len - 4) )
     {
-      fp = sam_open(filename, "wb", 0);
-      if (!fp) 
-	{
-	  error(0, errno, "binnie_open_out: error opening [%s] as bam", filename);
-	}
+      mode = "wb";
     }
   else if ( !strcasecmp(".sam", filename + filename_len - 4) )
     {
-      fp = sam_open(filename, "w", 0);
-      if (fp == NULL) 
-	{
-	  error(0, errno, "binnie_open_out: error opening [%s] as sam", filename);
-	}
+      mode = "w";
     }
   else
     {
@@ -87,7 +94,45 @@ samFile *binnie_open_out(const char *filename)
       return fp;
     }
 
-  blog(3, "binnie_open_out: opened fp->fn=[%s]", fp->fn);
+  /*
+   * with io_uring_depth set, htslib writes into the pipe of an 
+   * asynchronous writer rather than to the file itself
+   */
+  out = 0;
+  path = filename;
+  if (io_uring_depth > 0)
+    {
+      out = async_out_open(filename, io_uring_depth, direct_io);
+      if (!out)
+	{
+	  return fp;
+	}
+      path = async_out_path(out);
+      blog(3, "binnie_open_out: [%s] writing through %s%s", filename,
+	   async_out_uring(out) ? "io_uring" : "pwrite",
+	   async_out_direct(out) ? " with direct I/O" : "");
+    }
+
+  fp = sam_open(path, mode, 0);
+  if (!fp) 
+    {
+      error(0, errno, "binnie_open_out: error opening [%s] as %s", filename, mode[1] == 'b' ? "bam" : "sam");
+      async_out_close(out);
+      return fp;
+    }
+
+  if (out)
+    {
+      if (async_files_n == async_files_alloc)
+	{
+	  async_files = x2nrealloc(async_files, &async_files_alloc, sizeof(struct binnie_async_file));
+	}
+      async_files[async_files_n].fp = fp;
+      async_files[async_files_n].out = out;
+      async_files_n++;
+    }
+
+  blog(3, "binnie_open_out: opened fp->fn=[%s] for [%s]", fp->fn, filename);
 
   DLOG("binnie_open_out: returning fp=[%u] for filename=[%s]", fp, filename);
   return fp;
@@ -152,12 +197,28 @@ samFile* binnie_open_in(const char *filename)
 /*
  * binnie_close
  *
- * Closes the file pointed to by FP.
+ * Closes the file pointed to by FP, waiting for its asynchronous writer 
+ * (if it has one) to finish.  Exits if the writer could not write the 
+ * whole file.
  *
  */
 void binnie_close(samFile *fp)
 {
+  size_t i;
+
   DLOG("binnie_close: fp=[%p]", fp);
   sam_close(fp);
+  for (i = 0; i < async_files_n; i++)
+    {
+      if (async_files[i].fp == fp)
+	{
+	  if (!async_out_close(async_files[i].out))
+	    {
+	      exit(BINNIE_EXIT_ERR_WRITE);
+	    }
+	  async_files[i] = async_files[--async_files_n];
+	  break;
+	}
+    }
   DLOG("binnie_close: returning");
 }
@@ -0,0 +1,732 @@
+/*
+ * binnie_pipeline_bench.c End-to-end synthetic BridgeBuilder pipeline benchmark.
+ *
+ * Copyright (c) 2013 Genome Research Ltd.
+ *
+ * This file is part of BridgeBuilder.
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Runs the whole BridgeBuilder pipeline on synthetic data and times each
+ * stage.  An "old" reference is generated along with a "new" one that
+ * differs from it by substitutions in a set of edited regions, and the
+ * bridge (each edited region of the new reference plus flanks) stands in
+ * for baker's output.  Reads are simulated from the new reference and
+ * "aligned" by a deterministic stand-in aligner that knows where each read
+ * came from (its position is carried in the QNAME): against the old
+ * reference reads that cross an edit get MAPQ 0 or are left unmapped, and
+ * reads lying within a bridge contig are aligned to it.  binnie then bins
+ * the original and bridge BAMs, the stand-in aligner places the bridged
+ * and to-be-remapped reads on the new reference, and brunel merges them
+ * with the unchanged reads.  For each stage it reports the wall time,
+ * bytes written and peak memory, then the fraction of reads in each bin
+ * and whether brunel's output holds exactly the reads binnie was given.
+ * Run through "make bench".
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+#include "progname.h"
+#include "xalloc.h"
+
+/* htslib headers */
+#include <htslib/sam.h>
+#include <htslib/kstring.h>
+
+/* binnie includes */
+#include "binnie.h"
+
+/* reads crossing more edited bases than this are unmapped in the original */
+#define BENCH_MAX_MISMATCHES 3
+#define BENCH_PATH_LENGTH 4096
+
+typedef enum { STAGE_REFERENCES, STAGE_ALIGN, STAGE_BINNIE, STAGE_REALIGN, STAGE_BRUNEL, STAGE_COUNT } bench_stage;
+static const char *stage_name[STAGE_COUNT] = { "references", "align", "binnie", "realign", "brunel" };
+
+typedef enum { BIN_UNCHANGED, BIN_BRIDGED, BIN_REMAP, BIN_COUNT } bench_bin;
+static const char *bin_name[BIN_COUNT] = { "unchanged", "bridged", "remap" };
+
+typedef struct {
+  int contigs;
+  int contig_length;
+  int edits;
+  int edit_length;
+  double edit_rate;
+  long reads;
+  int read_length;
+  const char *binnie;
+  const char *brunel;
+  const char *dir;
+  uint64_t seed;
+  bool keep;
+} bench_opts_t;
+
+/* an edited region of the new reference, and the bridge contig around it */
+typedef struct {
+  int contig;
+  int start;
+  int end;
+  int bridge_start;
+  int bridge_end;
+} bench_edit_t;
+
+typedef struct {
+  char **old_seq;
+  char **new_seq;
+  bench_edit_t *edits;		/* contigs * edits, in contig then position order */
+  size_t edit_count;
+} bench_refs_t;
+
+/* a read by where it was simulated from */
+typedef struct {
+  int contig;
+  int pos;
+  long id;
+} bench_read_t;
+
+typedef struct {
+  double seconds;
+  double max_rss_mib;
+  uint64_t bytes;
+} stage_result_t;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so runs are repeatable across platforms */
+static uint64_t rng(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int rng_below(int n)
+{
+  return (int) (rng() % (uint64_t) n);
+}
+
+static double rng_unit(void)
+{
+  return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double self_rss_mib(void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss / 1024.0;
+}
+
+static char *bench_path(const bench_opts_t *opts, const char *name)
+{
+  char *path = xmalloc(BENCH_PATH_LENGTH);
+  if (snprintf(path, BENCH_PATH_LENGTH, "%s/%s", opts->dir, name) >= BENCH_PATH_LENGTH)
+    errx(BINNIE_EXIT_ERR_ARGS, "path too long for %s", name);
+  return path;
+}
+
+/* adds the size of a file written by a stage to its result */
+static void count_bytes(stage_result_t *result, const char *path)
+{
+  struct stat st;
+  if (stat(path, &st) == 0)
+    result->bytes += (uint64_t) st.st_size;
+}
+
+/*
+ * generate_refs
+ * -------------
+ * Generates the old reference and a new one differing from it by
+ * substitutions in opts->edits regions per contig, one placed at random in
+ * each equal slice of the contig.  Substitutions keep the two references the
+ * same length, so a read's position is the same on either and the stand-in
+ * aligner can place it exactly.
+ *
+ * OUTPUT: the references and their edits
+ */
+static bench_refs_t generate_refs(const bench_opts_t *opts)
+{
+  static const char bases[] = "ACGT";
+  bench_refs_t refs;
+  int flank = opts->read_length;
+  int slice = opts->contig_length / opts->edits;
+
+  refs.old_seq = xnmalloc(opts->contigs, sizeof(char *));
+  refs.new_seq = xnmalloc(opts->contigs, sizeof(char *));
+  refs.edit_count = (size_t) opts->contigs * opts->edits;
+  refs.edits = xnmalloc(refs.edit_count, sizeof(bench_edit_t));
+
+  for (int c = 0; c < opts->contigs; c++)
+    {
+      refs.old_seq[c] = xmalloc(opts->contig_length + 1);
+      for (int i = 0; i < opts->contig_length; i++)
+	refs.old_seq[c][i] = bases[rng() & 3];
+      refs.old_seq[c][opts->contig_length] = '\0';
+      refs.new_seq[c] = xstrdup(refs.old_seq[c]);
+
+      for (int e = 0; e < opts->edits; e++)
+	{
+	  bench_edit_t *edit = &refs.edits[(size_t) c * opts->edits + e];
+	  int room = slice - opts->edit_length - 2 * flank;
+	  edit->contig = c;
+	  edit->start = e * slice + flank + rng_below(room);
+	  edit->end = edit->start + opts->edit_length;
+	  edit->bridge_start = edit->start - flank;
+	  edit->bridge_end = edit->end + flank;
+	  for (int i = edit->start; i < edit->end; i++)
+	    if (rng_unit() < opts->edit_rate)
+	      refs.new_seq[c][i] = bases[(strchr(bases, refs.old_seq[c][i]) - bases + 1 + rng_below(3)) & 3];
+	}
+    }
+  return refs;
+}
+
+static void write_fasta_record(FILE *fp, const char *name, const char *seq, int length)
+{
+  fprintf(fp, ">%s\n", name);
+  for (int i = 0; i < length; i += 60)
+    fprintf(fp, "%.*s\n", length - i < 60 ? length - i : 60, seq + i);
+}
+
+/*
+ * write_refs
+ * ----------
+ * Writes the old and new references, the bridge (the stand-in for baker's
+ * output) and the new reference's header for brunel.
+ *
+ * OUTPUT: none (exits on error)
+ */
+static void write_refs(const bench_opts_t *opts, const bench_refs_t *refs, stage_result_t *result)
+{
+  const char *names[] = { "old.fa", "new.fa", "bridge.fa", "new_header.sam" };
+  FILE *fp[4];
+  char name[32];
+
+  for (int f = 0; f < 4; f++)
+    {
+      char *path = bench_path(opts, names[f]);
+      fp[f] = fopen(path, "w");
+      if (fp[f] == NULL)
+	err(BINNIE_EXIT_ERR_OUT_FILES, "could not open %s", path);
+      free(path);
+    }
+
+  fprintf(fp[3], "@HD\tVN:1.4\tSO:coordinate\n");
+  for (int c = 0; c < opts->contigs; c++)
+    {
+      snprintf(name, sizeof(name), "chr%d", c + 1);
+      write_fasta_record(fp[0], name, refs->old_seq[c], opts->contig_length);
+      write_fasta_record(fp[1], name, refs->new_seq[c], opts->contig_length);
+      fprintf(fp[3], "@SQ\tSN:%s\tLN:%d\n", name, opts->contig_length);
+    }
+  fprintf(fp[3], "@RG\tID:bench\tSM:bench\n");
+  for (size_t e = 0; e < refs->edit_count; e++)
+    {
+      const bench_edit_t *edit = &refs->edits[e];
+      snprintf(name, sizeof(name), "bridge%zu", e);
+      write_fasta_record(fp[2], name, refs->new_seq[edit->contig] + edit->bridge_start,
+			 edit->bridge_end - edit->bridge_start);
+    }
+
+  for (int f = 0; f < 4; f++)
+    {
+      if (ferror(fp[f]) || fclose(fp[f]) != 0)
+	errx(BINNIE_EXIT_ERR_WRITE, "could not write %s", names[f]);
+      char *path = bench_path(opts, names[f]);
+      count_bytes(result, path);
+      free(path);
+    }
+}
+
+/* header text for a BAM whose targets are the old reference or the bridge */
+static bam_hdr_t *make_header(const bench_opts_t *opts, const bench_refs_t *refs, bool bridge)
+{
+  kstring_t text = { 0, 0, NULL };
+  bam_hdr_t *header;
+
+  ksprintf(&text, "@HD\tVN:1.4\tSO:%s\n", bridge ? "unsorted" : "coordinate");
+  if (bridge)
+    for (size_t e = 0; e < refs->edit_count; e++)
+      ksprintf(&text, "@SQ\tSN:bridge%zu\tLN:%d\n", e, refs->edits[e].bridge_end - refs->edits[e].bridge_start);
+  else
+    for (int c = 0; c < opts->contigs; c++)
+      ksprintf(&text, "@SQ\tSN:chr%d\tLN:%d\n", c + 1, opts->contig_length);
+  kputs("@RG\tID:bench\tSM:bench\n", &text);
+
+  header = sam_hdr_parse(text.l, text.s);
+  if (header == NULL)
+    errx(BINNIE_EXIT_ERR_NULL, "could not parse generated header");
+  header->l_text = text.l;
+  header->text = text.s;
+  return header;
+}
+
+static int compare_reads(const void *a, const void *b)
+{
+  const bench_read_t *ra = a, *rb = b;
+  if (ra->contig != rb->contig)
+    return ra->contig < rb->contig ? -1 : 1;
+  if (ra->pos != rb->pos)
+    return ra->pos < rb->pos ? -1 : 1;
+  return (ra->id > rb->id) - (ra->id < rb->id);
+}
+
+/* the edit whose bridge contig wholly holds a read, or -1 */
+static long bridge_of(const bench_opts_t *opts, const bench_refs_t *refs, const bench_read_t *read)
+{
+  int slice = opts->contig_length / opts->edits;
+  int e = read->pos / slice;
+  if (e >= opts->edits)
+    return -1;
+  size_t index = (size_t) read->contig * opts->edits + e;
+  const bench_edit_t *edit = &refs->edits[index];
+  if (read->pos >= edit->bridge_start && read->pos + opts->read_length <= edit->bridge_end)
+    return (long) index;
+  return -1;
+}
+
+static int mismatches(const bench_opts_t *opts, const bench_refs_t *refs, const bench_read_t *read)
+{
+  const char *o = refs->old_seq[read->contig] + read->pos;
+  const char *n = refs->new_seq[read->contig] + read->pos;
+  int count = 0;
+  for (int i = 0; i < opts->read_length; i++)
+    count += o[i] != n[i];
+  return count;
+}
+
+/* writes one read as a SAM line through sam_parse1, so the BAM is well formed */
+static void write_read(samFile *fp, bam_hdr_t *header, bam1_t *b, kstring_t *line, const bench_opts_t *opts,
+		       const bench_refs_t *refs, const bench_read_t *read, const char *target, int pos, int mapq)
+{
+  line->l = 0;
+  ksprintf(line, "r%ld:%d:%d\t%d\t%s\t%d\t%d\t", read->id, read->contig, read->pos,
+	   target ? 0 : BAM_FUNMAP, target ? target : "*", target ? pos + 1 : 0, target ? mapq : 0);
+  if (target)
+    ksprintf(line, "%dM", opts->read_length);
+  else
+    kputc('*', line);
+  kputs("\t*\t0\t0\t", line);
+  kputsn(refs->new_seq[read->contig] + read->pos, opts->read_length, line);
+  kputs("\t*\tRG:Z:bench", line);
+  if (sam_parse1(line, header, b) < 0)
+    errx(BINNIE_EXIT_ERR_NULL, "could not parse generated read %ld", read->id);
+  if (sam_write1(fp, header, b) < 0)
+    errx(BINNIE_EXIT_ERR_WRITE, "could not write generated read %ld", read->id);
+}
+
+/*
+ * write_alignments
+ * ----------------
+ * Simulates opts->reads reads from the new reference at random positions
+ * and writes them as the stand-in aligner would align them: original.bam
+ * against the old reference in coordinate order (unmapped reads last),
+ * and bridge.bam against the bridge in the same order, holding only the
+ * reads that fall wholly within a bridge contig.  A read that crosses
+ * edited bases maps with MAPQ 0 to the old reference, or not at all if it
+ * crosses more than BENCH_MAX_MISMATCHES; on the bridge it maps uniquely
+ * only if it crosses an edit, and otherwise with MAPQ 0 as it also matches
+ * the unedited reference.
+ *
+ * OUTPUT: none (exits on error)
+ */
+static void write_alignments(const bench_opts_t *opts, const bench_refs_t *refs, stage_result_t *result)
+{
+  char *original_path = bench_path(opts, "original.bam");
+  char *bridge_path = bench_path(opts, "bridge.bam");
+  samFile *original = sam_open(original_path, "wb", 0);
+  samFile *bridge = sam_open(bridge_path, "wb", 0);
+  bam_hdr_t *original_header = make_header(opts, refs, false);
+  bam_hdr_t *bridge_header = make_header(opts, refs, true);
+  bench_read_t *reads = xnmalloc(opts->reads, sizeof(bench_read_t));
+  bench_read_t *unmapped = xnmalloc(opts->reads, sizeof(bench_read_t));
+  long unmapped_count = 0;
+  bam1_t *b = bam_init1();
+  kstring_t line = { 0, 0, NULL };
+
+  if (original == NULL || bridge == NULL)
+    err(BINNIE_EXIT_ERR_OUT_FILES, "could not open %s or %s", original_path, bridge_path);
+  if (sam_hdr_write(original, original_header) < 0 || sam_hdr_write(bridge, bridge_header) < 0)
+    errx(BINNIE_EXIT_ERR_WRITE, "could not write headers");
+
+  for (long i = 0; i < opts->reads; i++)
+    {
+      reads[i].contig = rng_below(opts->contigs);
+      reads[i].pos = rng_below(opts->contig_length - opts->read_length);
+      reads[i].id = i;
+    }
+  qsort(reads, opts->reads, sizeof(bench_read_t), compare_reads);
+
+  /* mapped reads in coordinate order, then the unmapped ones */
+  for (int pass = 0; pass < 2; pass++)
+    {
+      bench_read_t *set = pass == 0 ? reads : unmapped;
+      long count = pass == 0 ? opts->reads : unmapped_count;
+      for (long i = 0; i < count; i++)
+	{
+	  const bench_read_t *read = &set[i];
+	  int mm = mismatches(opts, refs, read);
+	  if (pass == 0 && mm > BENCH_MAX_MISMATCHES)
+	    {
+	      unmapped[unmapped_count++] = *read;
+	      continue;
+	    }
+	  if (pass == 0)
+	    write_read(original, original_header, b, &line, opts, refs, read,
+		       original_header->target_name[read->contig], read->pos, mm == 0 ? 60 : 0);
+	  else
+	    write_read(original, original_header, b, &line, opts, refs, read, NULL, 0, 0);
+
+	  long e = bridge_of(opts, refs, read);
+	  if (e >= 0)
+	    write_read(bridge, bridge_header, b, &line, opts, refs, read, bridge_header->target_name[e],
+		       read->pos - refs->edits[e].bridge_start, mm > 0 ? 60 : 0);
+	}
+    }
+
+  if (sam_close(original) < 0 || sam_close(bridge) < 0)
+    errx(BINNIE_EXIT_ERR_WRITE, "could not close %s or %s", original_path, bridge_path);
+  count_bytes(result, original_path);
+  count_bytes(result, bridge_path);
+
+  free(line.s);
+  bam_destroy1(b);
+  free(reads);
+  free(unmapped);
+  bam_hdr_destroy(original_header);
+  bam_hdr_destroy(bridge_header);
+  free(original_path);
+  free(bridge_path);
+}
+
+/*
+ * run_stage
+ * ---------
+ * Runs a pipeline program with its stderr going to dir/<stage>.log, and
+ * records its wall time and peak memory.
+ *
+ * OUTPUT: none (exits if the program fails)
+ */
+static void run_stage(const bench_opts_t *opts, bench_stage stage, char **args, stage_result_t *result)
+{
+  char log_name[64];
+  struct rusage ru;
+  int status = 0;
+  double start;
+  pid_t pid;
+
+  snprintf(log_name, sizeof(log_name), "%s.log", stage_name[stage]);
+  char *log_path = bench_path(opts, log_name);
+
+  start = now();
+  pid = fork();
+  if (pid == 0)
+    {
+      if (freopen(log_path, "w", stderr) == NULL)
+	_exit(127);
+      execvp(args[0], args);
+      fprintf(stderr, "could not run %s: %s\n", args[0], strerror(errno));
+      _exit(127);
+    }
+  if (pid < 0 || wait4(pid, &status, 0, &ru) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    errx(BINNIE_EXIT_ERR_ARGS, "%s failed, see %s", args[0], log_path);
+  result->seconds = now() - start;
+  result->max_rss_mib = ru.ru_maxrss / 1024.0;
+  free(log_path);
+}
+
+/*
+ * realign
+ * -------
+ * The stand-in aligner's second pass: places each read from binnie's
+ * bridged and remap bins at the position it was simulated from on the new
+ * reference and writes them, coordinate sorted, to realigned.bam.
+ *
+ * OUTPUT: none (exits on error)
+ */
+static void realign(const bench_opts_t *opts, const bench_refs_t *refs, stage_result_t *result)
+{
+  const char *inputs[] = { "bridged.bam", "remap.bam" };
+  size_t count = 0, size = 1024;
+  bench_read_t *reads = xnmalloc(size, sizeof(bench_read_t));
+  bam1_t *b = bam_init1();
+  kstring_t line = { 0, 0, NULL };
+
+  for (int f = 0; f < 2; f++)
+    {
+      char *path = bench_path(opts, inputs[f]);
+      samFile *in = sam_open(path, "r", 0);
+      bam_hdr_t *header = in ? sam_hdr_read(in) : NULL;
+      if (header == NULL)
+	err(BINNIE_EXIT_ERR_IN_FILES, "could not read %s", path);
+      while (sam_read1(in, header, b) >= 0)
+	{
+	  bench_read_t read;
+	  if (sscanf(bam_get_qname(b), "r%ld:%d:%d", &read.id, &read.contig, &read.pos) != 3)
+	    errx(BINNIE_EXIT_ERR_READ_ORIG, "unexpected read name %s in %s", bam_get_qname(b), path);
+	  if (count == size)
+	    reads = x2nrealloc(reads, &size, sizeof(bench_read_t));
+	  reads[count++] = read;
+	}
+      bam_hdr_destroy(header);
+      sam_close(in);
+      free(path);
+    }
+  qsort(reads, count, sizeof(bench_read_t), compare_reads);
+
+  char *out_path = bench_path(opts, "realigned.bam");
+  samFile *out = sam_open(out_path, "wb", 0);
+  bam_hdr_t *header = make_header(opts, refs, false);
+  if (out == NULL || sam_hdr_write(out, header) < 0)
+    err(BINNIE_EXIT_ERR_OUT_FILES, "could not open %s", out_path);
+  for (size_t i = 0; i < count; i++)
+    write_read(out, header, b, &line, opts, refs, &reads[i], header->target_name[reads[i].contig], reads[i].pos, 60);
+  if (sam_close(out) < 0)
+    errx(BINNIE_EXIT_ERR_WRITE, "could not close %s", out_path);
+  count_bytes(result, out_path);
+
+  free(line.s);
+  bam_destroy1(b);
+  bam_hdr_destroy(header);
+  free(reads);
+  free(out_path);
+}
+
+/* reads the count, sum and xor of a labelled line of a checksum file */
+static bool read_checksum(const char *path, const char *label, uint64_t ck[3])
+{
+  FILE *fp = fopen(path, "r");
+  char name[256];
+  unsigned long long count, sum, xor;
+  bool found = false;
+
+  if (fp == NULL)
+    return false;
+  while (!found && fscanf(fp, "%255s", name) == 1)
+    {
+      if (strcmp(name, label) == 0 && fscanf(fp, "%llu %llx %llx", &count, &sum, &xor) == 3)
+	{
+	  ck[0] = count;
+	  ck[1] = sum;
+	  ck[2] = xor;
+	  found = true;
+	}
+      fscanf(fp, "%*[^\n]");
+    }
+  fclose(fp);
+  return found;
+}
+
+static void bench_usage(void)
+{
+  fprintf(stderr, "Usage: %s [options]\n", program_name);
+  fprintf(stderr, "  -c, --contigs N          contigs in the reference (default 4)\n");
+  fprintf(stderr, "  -l, --contig_length N    length of each contig (default 5000000)\n");
+  fprintf(stderr, "  -e, --edits N            edited regions per contig (default 50)\n");
+  fprintf(stderr, "  -E, --edit_length N      length of each edited region (default 2000)\n");
+  fprintf(stderr, "  -p, --edit_rate P        fraction of bases substituted in an edited region (default 0.02)\n");
+  fprintf(stderr, "  -n, --reads N            reads to simulate (default 1000000)\n");
+  fprintf(stderr, "  -L, --read_length N      read length (default 100)\n");
+  fprintf(stderr, "  -B, --binnie PATH        binnie to run (default ./binnie)\n");
+  fprintf(stderr, "  -M, --brunel PATH        brunel to run (default ../../brunel/src/brunel)\n");
+  fprintf(stderr, "  -d, --dir DIR            where to write the pipeline's files (default $TMPDIR)\n");
+  fprintf(stderr, "  -s, --seed N             random seed\n");
+  fprintf(stderr, "  -k, --keep               keep the pipeline's files\n");
+}
+
+int main(int argc, char *argv[])
+{
+  static struct option bench_options[] =
+    {
+      {"contigs",		required_argument,	0,	'c'},
+      {"contig_length",		required_argument,	0,	'l'},
+      {"edits",			required_argument,	0,	'e'},
+      {"edit_length",		required_argument,	0,	'E'},
+      {"edit_rate",		required_argument,	0,	'p'},
+      {"reads",			required_argument,	0,	'n'},
+      {"read_length",		required_argument,	0,	'L'},
+      {"binnie",		required_argument,	0,	'B'},
+      {"brunel",		required_argument,	0,	'M'},
+      {"dir",			required_argument,	0,	'd'},
+      {"seed",			required_argument,	0,	's'},
+      {"keep",			no_argument,		0,	'k'},
+      {"help",			no_argument,		0,	'h'},
+      {0, 0, 0, 0}
+    };
+  bench_opts_t opts = { 4, 5000000, 50, 2000, 0.02, 1000000, 100, "./binnie", "../../brunel/src/brunel",
+			getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", 0x9e3779b97f4a7c15ULL, false };
+  stage_result_t results[STAGE_COUNT];
+  int c;
+
+  set_program_name(argv[0]);
+  while ((c = getopt_long(argc, argv, "c:l:e:E:p:n:L:B:M:d:s:kh", bench_options, NULL)) >= 0)
+    {
+      switch (c)
+	{
+	case 'c': opts.contigs = atoi(optarg); break;
+	case 'l': opts.contig_length = atoi(optarg); break;
+	case 'e': opts.edits = atoi(optarg); break;
+	case 'E': opts.edit_length = atoi(optarg); break;
+	case 'p': opts.edit_rate = atof(optarg); break;
+	case 'n': opts.reads = atol(optarg); break;
+	case 'L': opts.read_length = atoi(optarg); break;
+	case 'B': opts.binnie = optarg; break;
+	case 'M': opts.brunel = optarg; break;
+	case 'd': opts.dir = optarg; break;
+	case 's': opts.seed = strtoull(optarg, NULL, 0); break;
+	case 'k': opts.keep = true; break;
+	case 'h':
+	  bench_usage();
+	  exit(BINNIE_EXIT_SUCCESS);
+	default:
+	  bench_usage();
+	  exit(BINNIE_EXIT_ERR_ARGS);
+	}
+    }
+  if (optind != argc || opts.contigs < 1 || opts.edits < 1 || opts.reads < 1 || opts.read_length < 1
+      || opts.edit_length < 1 || opts.edit_rate < 0 || opts.edit_rate > 1
+      || opts.contig_length / opts.edits <= opts.edit_length + 2 * opts.read_length)
+    {
+      bench_usage();
+      exit(BINNIE_EXIT_ERR_ARGS);
+    }
+  rng_state = opts.seed ? opts.seed : 1;
+  memset(results, 0, sizeof(results));
+
+  double start = now();
+  bench_refs_t refs = generate_refs(&opts);
+  write_refs(&opts, &refs, &results[STAGE_REFERENCES]);
+  results[STAGE_REFERENCES].seconds = now() - start;
+  results[STAGE_REFERENCES].max_rss_mib = self_rss_mib();
+
+  start = now();
+  write_alignments(&opts, &refs, &results[STAGE_ALIGN]);
+  results[STAGE_ALIGN].seconds = now() - start;
+  results[STAGE_ALIGN].max_rss_mib = self_rss_mib();
+
+  char *original = bench_path(&opts, "original.bam");
+  char *bridge = bench_path(&opts, "bridge.bam");
+  char *unchanged = bench_path(&opts, "unchanged.bam");
+  char *bridged = bench_path(&opts, "bridged.bam");
+  char *remap = bench_path(&opts, "remap.bam");
+  char *binnie_checksums = bench_path(&opts, "binnie_checksums.txt");
+  char *binnie_args[] = { (char *) opts.binnie, "-u", unchanged, "-b", bridged, "-r", remap,
+			  "-c", binnie_checksums, original, bridge, NULL };
+  run_stage(&opts, STAGE_BINNIE, binnie_args, &results[STAGE_BINNIE]);
+  count_bytes(&results[STAGE_BINNIE], unchanged);
+  count_bytes(&results[STAGE_BINNIE], bridged);
+  count_bytes(&results[STAGE_BINNIE], remap);
+  count_bytes(&results[STAGE_BINNIE], binnie_checksums);
+
+  start = now();
+  realign(&opts, &refs, &results[STAGE_REALIGN]);
+  results[STAGE_REALIGN].seconds = now() - start;
+  results[STAGE_REALIGN].max_rss_mib = self_rss_mib();
+
+  char *new_header = bench_path(&opts, "new_header.sam");
+  char *realigned = bench_path(&opts, "realigned.bam");
+  char *merged = bench_path(&opts, "merged.bam");
+  char *brunel_checksums = bench_path(&opts, "brunel_checksums.txt");
+  char *brunel_args[] = { (char *) opts.brunel, "--checksum", brunel_checksums, new_header,
+			  unchanged, realigned, merged, NULL };
+  run_stage(&opts, STAGE_BRUNEL, brunel_args, &results[STAGE_BRUNEL]);
+  count_bytes(&results[STAGE_BRUNEL], merged);
+  count_bytes(&results[STAGE_BRUNEL], brunel_checksums);
+
+  printf("#stage\tseconds\tbytes_written\tmax_rss_mib\n");
+  stage_result_t total = { 0, 0, 0 };
+  for (int s = 0; s < STAGE_COUNT; s++)
+    {
+      printf("%s\t%.3f\t%" PRIu64 "\t%.1f\n", stage_name[s], results[s].seconds, results[s].bytes,
+	     results[s].max_rss_mib);
+      total.seconds += results[s].seconds;
+      total.bytes += results[s].bytes;
+      if (results[s].max_rss_mib > total.max_rss_mib)
+	total.max_rss_mib = results[s].max_rss_mib;
+    }
+  printf("total\t%.3f\t%" PRIu64 "\t%.1f\n", total.seconds, total.bytes, total.max_rss_mib);
+
+  uint64_t original_ck[3], bin_ck[3], merged_ck[3];
+  if (!read_checksum(binnie_checksums, "original", original_ck))
+    errx(BINNIE_EXIT_ERR_IN_FILES, "no original reads in %s", binnie_checksums);
+  printf("#bin\treads\tfraction\n");
+  for (int i = 0; i < BIN_COUNT; i++)
+    {
+      if (!read_checksum(binnie_checksums, bin_name[i], bin_ck))
+	errx(BINNIE_EXIT_ERR_IN_FILES, "no %s reads in %s", bin_name[i], binnie_checksums);
+      printf("%s\t%" PRIu64 "\t%.4f\n", bin_name[i], bin_ck[0],
+	     original_ck[0] ? (double) bin_ck[0] / original_ck[0] : 0.0);
+    }
+  bool conserved = read_checksum(brunel_checksums, "output", merged_ck)
+    && memcmp(original_ck, merged_ck, sizeof(original_ck)) == 0;
+  printf("#reads_conserved\t%s\n", conserved ? "yes" : "no");
+
+  if (!opts.keep)
+    {
+      const char *files[] = { "old.fa", "new.fa", "bridge.fa", "new_header.sam", "original.bam", "bridge.bam",
+			      "unchanged.bam", "bridged.bam", "remap.bam", "binnie_checksums.txt",
+			      "realigned.bam", "merged.bam", "brunel_checksums.txt", "binnie.log", "brunel.log" };
+      for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+	{
+	  char *path = bench_path(&opts, files[f]);
+	  unlink(path);
+	  free(path);
+	}
+    }
+
+  for (int contig = 0; contig < opts.contigs; contig++)
+    {
+      free(refs.old_seq[contig]);
+      free(refs.new_seq[contig]);
+    }
+  free(refs.old_seq);
+  free(refs.new_seq);
+  free(refs.edits);
+  free(original);
+  free(bridge);
+  free(unchanged);
+  free(bridged);
+  free(remap);
+  free(binnie_checksums);
+  free(new_header);
+  free(realigned);
+  free(merged);
+  free(brunel_checksums);
+  exit(conserved ? BINNIE_EXIT_SUCCESS : BINNIE_EXIT_ERR_WRITE);
+}
@@ -0,0 +1,55 @@
+/*
+ * binnie_probes.h - static tracepoints (USDT)
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ * Author: Joshua C. Randall <jcrandall@alum.mit.edu>
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef _BINNIE_PROBES_H
+#define _BINNIE_PROBES_H 1
+
+/*
+ * Static tracepoints for perf, bpftrace or SystemTap, under the provider
+ * "binnie".  Each is a single nop until a tracer attaches, so arguments 
+ * should be values already to hand (QNAMEs are passed as pointers into 
+ * the record).  Without sys/sdt.h they compile to nothing.
+ *
+ *   read_ingested(read_count, refid, pos)
+ *   read_binned(read_count, bin, matched)           matched: a bridge read was paired with it
+ *   template_resolved(segments, bin, qname)         the last segment of a template is buffered
+ *   buffer_flush(reads_output, reads_left, new_refid, original_done)
+ *   forced_remap(reason, previous_bin, qname)       reason is a BINNIE_REMAP_REASON_* value
+ *   output_block_written(fd, offset, length)        from bb_asyncout.c, an --io_uring block reached the file
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define BINNIE_PROBE3(name, a, b, c) DTRACE_PROBE3(binnie, name, a, b, c)
+#define BINNIE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(binnie, name, a, b, c, d)
+#else
+/* arguments are cast to void so locals kept only for a probe do not warn */
+#define BINNIE_PROBE3(name, a, b, c) do { (void) (a); (void) (b); (void) (c); } while (0)
+#define BINNIE_PROBE4(name, a, b, c, d) do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
+#endif
+
+/* why a read was moved to the REMAP bin after binnie_read_bin */
+#define BINNIE_REMAP_REASON_MATES_UNKNOWN  1	/* expected mate count unknown */
+#define BINNIE_REMAP_REASON_MATES_MISSING  2	/* mates not all seen within the buffer */
+#define BINNIE_REMAP_REASON_BINS_DISAGREE  3	/* segments of the template binned differently */
+
+#endif /* _BINNIE_PROBES_H */
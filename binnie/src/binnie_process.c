@@ -48,6 +48,7 @@
 /* binnie includes */
 #include "binnie.h"
 #include "binnie_log.h"
+#include "binnie_probes.h"
 #include "binnie_process.h"
 
 /* htslib for sam/bam processing */
@@ -64,7 +65,9 @@
  *
  * INPUT: pointers to open samFile structures for original and bridge 
  *        BAM files (opened for input and pre-sorted on contig/position) 
- *        and for unchanged, bridged, and remap BAM files (opened for output).
+ *        and for unchanged, bridged, and remap BAM files (opened for output),
+ *        and an array of BINNIE_CHECKSUM_COUNT checksum sets to accumulate
+ *        (or NULL) and whether they should cover read sequences.
  *
  * OUTPUT: none (side effect is that output files are written to).
  *
@@ -87,7 +90,7 @@
  *    then change its bin to Remap.
  *
  */
-bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_fp, samFile *bridge_in_fp, samFile *unchanged_out_fp, samFile *bridged_out_fp, samFile *remap_out_fp)
+bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_fp, samFile *bridge_in_fp, samFile *unchanged_out_fp, samFile *bridged_out_fp, samFile *remap_out_fp, binnie_checksum_t *checksums, bool checksum_seq)
 {
   bool original_done;
   bool bridge_done;
@@ -166,6 +169,7 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
       binnie_binned_read_t *bbr;
       int ret; 
       bool success;
+      bool matched;
       int32_t refid;
       int32_t pos;
       int32_t reads_output;
@@ -184,12 +188,18 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
 
 	  /* increment read_count */
 	  read_count++;
+
+	  if (checksums != NULL)
+	    {
+	      binnie_checksum_add(&checksums[BINNIE_CHECKSUM_ORIGINAL], original_read->bam_read, checksum_seq);
+	    }
       
 	  DLOG(gettext("binnie_process: processing read [%d]"), read_count);
 
 	  /* get refid and pos from original */
 	  refid = br_get_refid(original_read);
 	  pos = br_get_pos(original_read);
+	  BINNIE_PROBE3(read_ingested, read_count, refid, pos);
         }
       else if ( ret == -1 )
         {
@@ -254,6 +264,7 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
 	      /* have a match for the original read, bin the reads */
 	      DLOG(gettext("binnie_process: original_read matches current_bridge_read"));
 	      bbr = binnie_read_bin(original_read, current_bridge_read);
+	      matched = true;
 	      
 	      DLOG(gettext("binnie_process: initializing current_bridge_read"));
 	      current_bridge_read = br_init();
@@ -263,6 +274,7 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
 	      /* original_read doesn't match bridge_read, output the original */
 	      DLOG(gettext("binnie_process: original read is not a match for current_bridge_read"));
 	      bbr = binnie_read_bin(original_read, NULL);
+	      matched = false;
 	    }
 	  
 	  /* if bbr is NULL, it means that binnie_read_bin wants to discard this read */
@@ -271,6 +283,7 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
 	      DLOG(gettext("binnie_process: have NULL bbr (binnie_read_bin wants to discard this read), skipping to next iteration of processing loop"));
 	      continue;
 	    }
+	  BINNIE_PROBE3(read_binned, read_count, bbr->bin, matched);
 	  
 	  /* verify refid has not decreased */
 	  DLOG(gettext("binnie_process: checking that refid has not decreased.  refid=[%d] last_refid=[%d]"), refid, last_refid);
@@ -396,11 +409,13 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
 	  if (bbr->expected_mate_count < 0)
 	    {
 	      blog(2, gettext("expected mate count unknown, setting bin to REMAP for read rg=[%s] qname=[%s] (was destined for bin [%s])"), br_get_read_group(bbr->br), br_get_qname(bbr->br), bbr_get_bin_name(bbr));
+	      BINNIE_PROBE3(forced_remap, BINNIE_REMAP_REASON_MATES_UNKNOWN, bbr->bin, bam_get_qname(bbr->br->bam_read));
 	      bbr->bin = BINNIE_REMAP;
 	    }
 	  else if (bbr->mate_count < bbr->expected_mate_count)
 	    {
 	      blog(5, gettext("mate count [%d] less than expected mate count [%d], setting bin to REMAP for read rg=[%s] qname=[%s] (was destined for bin [%s])"), bbr->mate_count, bbr->expected_mate_count, br_get_read_group(bbr->br), br_get_qname(bbr->br), bbr_get_bin_name(bbr));
+	      BINNIE_PROBE3(forced_remap, BINNIE_REMAP_REASON_MATES_MISSING, bbr->bin, bam_get_qname(bbr->br->bam_read));
 	      bbr->bin = BINNIE_REMAP;
 	    }
 	  
@@ -437,6 +452,11 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
           default:
             errx(BINNIE_EXIT_ERR_INVALID_BIN, gettext("binnie_process: invalid bin [%d] for buffered read RG=[%s] QNAME=[%s]"), bbr->bin, br_get_read_group(bbr->br), br_get_qname(bbr->br));
           }
+
+	  if (checksums != NULL)
+	    {
+	      binnie_checksum_add(&checksums[BINNIE_CHECKSUM_UNCHANGED + bbr->bin], bbr->br->bam_read, checksum_seq);
+	    }
           
           /* remove the read from the buffer (this will call bbr_dispose for us) */
 	  DLOG("binnie_process: calling gl_list_remove_at 0");
@@ -466,6 +486,10 @@ bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_
 
         } /* while original_done ... || new_refid ... || ... > buffer_size || ... > max_buffer_bases */
       DLOG(gettext("binnie_process: finished buffer output loop after outputting [%d] reads."), reads_output);
+      if (reads_output > 0)
+	{
+	  BINNIE_PROBE4(buffer_flush, reads_output, buffer_read_count, new_refid, original_done);
+	}
 
       DLOG(gettext("binnie_process: done processing read [%d]"), read_count);
     } while ( !original_done );
@@ -922,6 +946,7 @@ void binnie_read_buffer (binnie_binned_read_t *bbr, gl_list_t output_buffer)
           /* sweep backwards through linked list, resetting all bins to remap */
           do
             {
+	      BINNIE_PROBE3(forced_remap, BINNIE_REMAP_REASON_BINS_DISAGREE, bbri->bin, bam_get_qname(bbri->br->bam_read));
               bbri->bin = BINNIE_REMAP;
               bbri = bbri->prev_mate;
             } while (bbri != NULL);
@@ -929,6 +954,11 @@ void binnie_read_buffer (binnie_binned_read_t *bbr, gl_list_t output_buffer)
       
     } /* node != NULL */
 
+  if (bbr->mate_count == bbr->expected_mate_count)
+    {
+      BINNIE_PROBE3(template_resolved, bbr->expected_mate_count + 1, bbr->bin, bam_get_qname(bbr->br->bam_read));
+    }
+
   DLOG("binnie_read_buffer: returning (void)");
 } /* binnie_read_buffer */
 
@@ -28,6 +28,7 @@
 
 /* binnie includes */
 #include "binnie.h"
+#include "binnie_checksum.h"
 
 /* htslib for sam/bam processing */
 #include <htslib/sam.h>
@@ -55,7 +56,7 @@ typedef struct binnie_binned_read_t_ {
 } binnie_binned_read_t;
 
 
-bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_fp, samFile *bridge_in_fp, samFile *unchanged_out_fp, samFile *bridged_out_fp, samFile *remap_out_fp);
+bool binnie_process(int buffer_size, int max_buffer_bases, samFile *original_in_fp, samFile *bridge_in_fp, samFile *unchanged_out_fp, samFile *bridged_out_fp, samFile *remap_out_fp, binnie_checksum_t *checksums, bool checksum_seq);
 
 binnie_binned_read_t *binnie_read_bin(binnie_read_t *original_read, binnie_read_t *bridge_read);
 
@@ -30,26 +30,43 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <getopt.h>
 
 /* gnulib headers */
 #include "progname.h"
 #include "xalloc.h"
 
+/* internationalisation */
+#include "gettext.h"
+
 /* brindley includes */
+#include "brindley.h"
 #include "brindley_log.h"
 #include "brindley_coordmap.h"
+#include "brindley_io.h"
+#include "brindley_compose.h"
+#include "brindley_refcache.h"
+#include "brindley_serve.h"
+#include "brindley_vcf.h"
+
+/* htslib */
+#include <htslib/hts.h>
+#include <htslib/kseq.h>
+#include <htslib/kstring.h>
 
 #define LINE_LENGTH 256
+// Lines looked up together through bc_map_ranges
+#define LOOKUP_BATCH 4096
 
 Range* createRange(char* input) {
   char *from_sn = xmalloc(LINE_LENGTH * sizeof(char));
   int from_pos;
-  int is2 = sscanf(input, "%s\t%d", from_sn, &from_pos);
+  int is2 = sscanf(input, "%255s\t%d", from_sn, &from_pos);
   if (is2 == 2) {
     volatile Range* new = xmalloc(sizeof(*new));
     new->start = from_pos-1;
     new->end = from_pos-1;
-    char *prefix_sn = xmalloc(LINE_LENGTH * sizeof(char));
+    char *prefix_sn = xzalloc(LINE_LENGTH * sizeof(char));
     // prefix_sn = strncat(prefix_sn, "chr", 4);
     new->id = strncat(prefix_sn, from_sn, LINE_LENGTH);
     free(from_sn);
@@ -60,59 +77,160 @@ Range* createRange(char* input) {
   }
 }
 
+// Lift and print a batch of ranges, freeing their ids.  Unlifted
+// positions are left out of indexed output, having nothing to index;
+// returns how many were left out.
+static size_t lift_batch(CoordMap* map, Range* from, Range* to, size_t n, bc_direction direction, bool skip_unlifted,
+                       kstring_t* buf, brindley_out_t* out) {
+  size_t skipped = 0;
+  bc_map_ranges(map, from, n, direction, to, NULL);
+  buf->l = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (to[i].id != NULL) {
+      ksprintf(buf, "%s\t%d\n", to[i].id, to[i].start+1);
+    } else if (!skip_unlifted) {
+      kputs(".\t.\n", buf);
+    } else {
+      skipped++;
+    }
+    free(from[i].id);
+  }
+  if (!bo_write(out, buf->s, buf->l)) {
+    fprintf(stderr, "%s\n", "Error writing output.");
+    exit(BRINDLEY_EXIT_ERR_WRITE);
+  }
+  return skipped;
+}
+
+static void usage(void) {
+  fprintf(stderr, gettext("Usage: %s [options] <input> <liftover_map> [output]\n"), program_name);
+  fprintf(stderr, gettext("       %s vcf [options] <input(vcf|vcf.gz|bcf)> <liftover_map> [output]\n"), program_name);
+  fprintf(stderr, gettext("       %s compose <a_to_b_map> <b_to_c_map> [output]\n"), program_name);
+  fprintf(stderr, gettext("       %s serve [options] <liftover_map> <socket>\n"), program_name);
+  fprintf(stderr, gettext("       %s query [-R|--reverse] <socket> [input] [output]\n"), program_name);
+  fprintf(stderr, gettext("       %s refcache <reference(fa|fa.gz)> <output>\n"), program_name);
+  fprintf(stderr, gettext("Options: \n"));
+  fprintf(stderr, gettext("  -R, --reverse      Lift from the map's target assembly back to its source\n"));
+  fprintf(stderr, gettext("  -@, --threads N    Compression threads for .gz output [default: 0]\n"));
+  fprintf(stderr, gettext("  -x, --index        Tabix index the (sorted, .gz) output, leaving out unlifted positions\n"));
+  fprintf(stderr, gettext("Input and map may be plain, gzipped or bgzipped; output ending .gz or .bgz is bgzipped.\n"));
+}
+
 int main(int argc, char *argv[])
 {
 
   /* setup progname */
   set_program_name (argv[0]);
 
-  FILE *in;
-  FILE *out;
-  char *mapFile;
-
-  if (argc == 3) {
-    // Assume in mapfile
-    in = fopen(argv[1] ,"r");
-    mapFile = argv[2];
-    out = stdout;
-  } else if (argc == 4) {
-    // in mapfile out
-    in = fopen(argv[1], "r");
-    out = fopen(argv[3], "w");
-    mapFile = argv[2];
-  } else {
-    fprintf(stderr, gettext("Usage: %s [options] <input> <liftover_map> [output]\n"), program_name);
+  if (argc > 1 && strcmp(argv[1], "vcf") == 0) {
+    return brindley_vcf(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "compose") == 0) {
+    return brindley_compose(argc - 1, argv + 1);
   }
+  if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+    return brindley_serve(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "query") == 0) {
+    return brindley_query(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "refcache") == 0) {
+    return brindley_refcache(argc - 1, argv + 1);
+  }
+
+  static struct option long_options[] = {
+    {"reverse", no_argument,       0, 'R'},
+    {"threads", required_argument, 0, '@'},
+    {"index",   no_argument,       0, 'x'},
+    {"help",    no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+  bc_direction direction = BC_FORWARD;
+  int threads = 0;
+  bool index = false;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "R@:xh", long_options, NULL)) >= 0) {
+    switch (c) {
+    case 'R':
+      // Lift from the map's target back to its source
+      direction = BC_REVERSE;
+      break;
+    case '@':
+      threads = brindley_int_arg('@', optarg, 0);
+      break;
+    case 'x':
+      index = true;
+      break;
+    case 'h':
+      usage();
+      exit(BRINDLEY_EXIT_SUCCESS);
+    default:
+      usage();
+      exit(BRINDLEY_EXIT_ERR_ARGS);
+    }
+  }
+  if (argc - optind < 2 || argc - optind > 3) {
+    usage();
+    exit(BRINDLEY_EXIT_ERR_ARGS);
+  }
+  char *inFile = argv[optind];
+  char *mapFile = argv[optind + 1];
+  char *outFile = argc - optind == 3 ? argv[optind + 2] : NULL;
 
   CoordMap *map = bc_read_file(mapFile);
 
+  htsFile *in = hts_open(inFile, "r", NULL);
   if (!in) {
-    fprintf(stderr, "%s\nFilename:%s", "Unable to read input file.", argv[1]);
+    fprintf(stderr, "%s\nFilename:%s", "Unable to read input file.", inFile);
     exit(1234);
   }
+  brindley_out_t *out = bo_open(outFile, threads);
   if (!out) {
     fprintf(stderr, "%s\n", "Unable to open output file for writing.");
     exit(1235);
   }
+  if (index && !bo_is_bgzf(out)) {
+    fprintf(stderr, "%s\n", "Indexing needs an output file ending .gz or .bgz.");
+    exit(BRINDLEY_EXIT_ERR_ARGS);
+  }
 
-  char line[LINE_LENGTH];
+  kstring_t line = { 0, 0, NULL };
+  kstring_t buf = { 0, 0, NULL };
+  Range* from = xnmalloc(LOOKUP_BATCH, sizeof(Range));
+  Range* to = xnmalloc(LOOKUP_BATCH, sizeof(Range));
+  size_t n = 0;
+  size_t skipped = 0;
     // Read each line into the thing
-  while (fgets(line, LINE_LENGTH-1, in) != NULL) {
-    Range* from = createRange(line);
-    Range* to = bc_map_range(map, from);
-    free(from);
-    
-    if (to != NULL) {
-      fprintf(out, "%s\t%d\n", to->id, to->start+1);
-      free(to);
-    } else {
-      fprintf(out, ".\t.\n");
+  while (hts_getline(in, KS_SEP_LINE, &line) >= 0) {
+    Range* r = createRange(line.s);
+    from[n++] = *r;
+    free(r);
+    if (n == LOOKUP_BATCH) {
+      skipped += lift_batch(map, from, to, n, direction, index, &buf, out);
+      n = 0;
     }
   }
+  skipped += lift_batch(map, from, to, n, direction, index, &buf, out);
+  free(from);
+  free(to);
+  free(line.s);
+  free(buf.s);
 
   bc_free_coordmap(map);
 
-  fclose(out);
-  fclose(in);
+  hts_close(in);
+  if (!bo_close(out)) {
+    fprintf(stderr, "%s\n", "Error writing output.");
+    exit(BRINDLEY_EXIT_ERR_WRITE);
+  }
+  if (index && !bo_index(outFile)) {
+    fprintf(stderr, "%s\n", "Unable to index output; is it sorted?");
+    exit(BRINDLEY_EXIT_ERR_WRITE);
+  }
+  if (skipped > 0) {
+    fprintf(stderr, gettext("%zu positions could not be lifted and were left out of the indexed output\n"), skipped);
+  }
+  return BRINDLEY_EXIT_SUCCESS;
 }
 
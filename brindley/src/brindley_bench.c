@@ -0,0 +1,374 @@
+/*
+ * brindley_bench.c Brindley liftover benchmark.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Generates liftover maps and query sets of realistic shape and times the
+ * lookup paths of brindley_coordmap.c against them, so changes there can
+ * be compared.  For each map size it reports the load time and resident
+ * memory, then for each query set and path the lookups per second and the
+ * per-lookup latency percentiles.  Run through "make bench".
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+#include "progname.h"
+#include "xalloc.h"
+
+/* brindley includes */
+#include "brindley.h"
+#include "brindley_coordmap.h"
+
+/* lookups handed to bc_map_ranges at once, as the default mode does */
+#define BENCH_BATCH 4096
+#define BENCH_ID_LENGTH 32
+
+typedef enum { SET_SORTED, SET_RANDOM, SET_RANGE, SET_BOUNDARY, SET_COUNT } query_set;
+static const char *set_name[SET_COUNT] = { "sorted", "random", "range", "boundary" };
+
+typedef struct {
+  int start;
+  int end;
+} span_t;
+
+/* one generated map: per source contig, its blocks' source spans */
+typedef struct {
+  size_t contigs;
+  size_t blocks_per_contig;
+  char (*ids)[BENCH_ID_LENGTH];
+  span_t *spans;		/* contigs * blocks_per_contig, in order */
+} bench_map_t;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so runs are repeatable across platforms */
+static uint64_t rng(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int rng_below(int n)
+{
+  return (int) (rng() % (uint64_t) n);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* current resident set size in MiB */
+static double rss_mib(void)
+{
+  long pages = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp != NULL)
+    {
+      if (fscanf(fp, "%*s %ld", &pages) != 1)
+	pages = 0;
+      fclose(fp);
+    }
+  if (pages == 0)
+    {
+      /* no procfs: fall back on the peak, in KiB on Linux and the BSDs */
+      struct rusage ru;
+      getrusage(RUSAGE_SELF, &ru);
+      return ru.ru_maxrss / 1024.0;
+    }
+  return pages * (double) sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+/*
+ * generate_map
+ * ------------
+ *
+ * Writes a map of about n_blocks blocks spread over n_contigs contigs to
+ * fn: ungapped blocks of 50bp to 5kb separated by short gaps, one in ten
+ * on the reverse strand of the target, and a few contigs lifted onto a
+ * differently named one.
+ *
+ */
+static bench_map_t generate_map(const char *fn, size_t n_blocks, size_t n_contigs)
+{
+  bench_map_t m;
+  size_t c, b;
+
+  m.contigs = n_contigs;
+  m.blocks_per_contig = n_blocks / n_contigs > 0 ? n_blocks / n_contigs : 1;
+  m.ids = xnmalloc(n_contigs, sizeof(*m.ids));
+  m.spans = xnmalloc(n_contigs * m.blocks_per_contig, sizeof(span_t));
+
+  FILE *fp = fopen(fn, "w");
+  if (fp == NULL)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, "could not write map [%s]", fn);
+  fprintf(fp, "from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n");
+  for (c = 0; c < n_contigs; c++)
+    {
+      int from = rng_below(1000);
+      int to = rng_below(1000);
+      snprintf(m.ids[c], BENCH_ID_LENGTH, "chr%zu", c + 1);
+      const char *to_id = rng_below(20) == 0 ? "chrUn" : m.ids[c];
+      for (b = 0; b < m.blocks_per_contig; b++)
+	{
+	  int len = 50 + rng_below(4950);
+	  span_t *s = &m.spans[c * m.blocks_per_contig + b];
+	  s->start = from;
+	  s->end = from + len;
+	  if (rng_below(10) == 0)
+	    fprintf(fp, "%s\t%d\t%d\tnew_%s\t%d\t%d\n", m.ids[c], from, from + len, to_id, to + len, to);
+	  else
+	    fprintf(fp, "%s\t%d\t%d\tnew_%s\t%d\t%d\n", m.ids[c], from, from + len, to_id, to, to + len);
+	  from += len + rng_below(500);
+	  to += len + rng_below(800);
+	}
+    }
+  if (fclose(fp) != 0)
+    err(BRINDLEY_EXIT_ERR_WRITE, "could not write map [%s]", fn);
+  return m;
+}
+
+/*
+ * generate_queries
+ * ----------------
+ *
+ * sorted: single positions in map order; random: uniformly chosen contig
+ * and position; range: spans of up to 1kb at random; boundary: positions
+ * within a base of block ends, where lookups most often fail.
+ *
+ */
+static void generate_queries(const bench_map_t *m, query_set set, Range *q, size_t n)
+{
+  size_t total = m->contigs * m->blocks_per_contig;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      size_t k = set == SET_SORTED ? i * total / n : (size_t) (rng() % total);
+      const span_t *s = &m->spans[k];
+      q[i].id = m->ids[k / m->blocks_per_contig];
+      switch (set)
+	{
+	case SET_BOUNDARY:
+	  q[i].start = (rng_below(2) ? s->start : s->end) + rng_below(3) - 1;
+	  q[i].end = q[i].start;
+	  break;
+	case SET_RANGE:
+	  q[i].start = s->start + rng_below(s->end - s->start);
+	  q[i].end = q[i].start + rng_below(1000);
+	  break;
+	default:
+	  q[i].start = s->start + rng_below(s->end - s->start);
+	  q[i].end = q[i].start;
+	  break;
+	}
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, double p)
+{
+  return n == 0 ? 0.0 : sorted[(size_t) (p * (n - 1))];
+}
+
+/*
+ * run_path
+ * --------
+ *
+ * Times one lookup path over the queries and prints a result row.  The
+ * single path times every lookup; the batched path times whole batches and
+ * reports their cost per lookup, the latency a caller of it sees.
+ *
+ */
+static void run_path(CoordMap *map, const char *prefix, const char *path, bool batched,
+		     const Range *q, size_t n, double *lat)
+{
+  Range *out = xnmalloc(BENCH_BATCH, sizeof(Range));
+  size_t lifted = 0;
+  size_t samples = 0;
+  size_t i;
+
+  double begin = now();
+  if (batched)
+    {
+      for (i = 0; i < n; i += BENCH_BATCH)
+	{
+	  size_t len = n - i < BENCH_BATCH ? n - i : BENCH_BATCH;
+	  double t0 = now();
+	  lifted += bc_map_ranges(map, q + i, len, BC_FORWARD, out, NULL);
+	  lat[samples++] = (now() - t0) / len;
+	}
+    }
+  else
+    {
+      for (i = 0; i < n; i++)
+	{
+	  double t0 = now();
+	  Range *r = bc_map_range(map, (Range *) &q[i]);
+	  lat[samples++] = now() - t0;
+	  if (r != NULL)
+	    lifted++;
+	  free(r);
+	}
+    }
+  double elapsed = now() - begin;
+
+  qsort(lat, samples, sizeof(double), compare_doubles);
+  printf("%s\t%s\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.3f\n", prefix, path, n / elapsed,
+	 percentile(lat, samples, 0.5) * 1e9, percentile(lat, samples, 0.9) * 1e9,
+	 percentile(lat, samples, 0.99) * 1e9, percentile(lat, samples, 0.999) * 1e9,
+	 n > 0 ? (double) lifted / n : 0.0);
+  fflush(stdout);
+  free(out);
+}
+
+static void bench_usage(void)
+{
+  fprintf(stderr, "Usage: %s [options]\n", program_name);
+  fprintf(stderr, "Options: \n");
+  fprintf(stderr, "  -b, --blocks N,...   Map sizes in blocks [default: 20000,200000,2000000]\n");
+  fprintf(stderr, "  -c, --contigs N      Contigs per map (fewer for small maps) [default: 3000]\n");
+  fprintf(stderr, "  -q, --queries N      Lookups per query set and path [default: 1000000]\n");
+  fprintf(stderr, "  -d, --dir DIR        Where to write generated maps [default: $TMPDIR or /tmp]\n");
+  fprintf(stderr, "  -s, --seed N         Random seed\n");
+}
+
+int main(int argc, char **argv)
+{
+  static struct option bench_options[] =
+    {
+      {"blocks",	required_argument,	0,	'b'},
+      {"contigs",	required_argument,	0,	'c'},
+      {"queries",	required_argument,	0,	'q'},
+      {"dir",		required_argument,	0,	'd'},
+      {"seed",		required_argument,	0,	's'},
+      {"help",		no_argument,		0,	'h'},
+      {0, 0, 0, 0}
+    };
+  char *blocks = xstrdup("20000,200000,2000000");
+  size_t max_contigs = 3000;
+  size_t n = 1000000;
+  const char *dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+  int c;
+
+  set_program_name(argv[0]);
+  while ((c = getopt_long(argc, argv, "b:c:q:d:s:h", bench_options, NULL)) >= 0)
+    {
+      switch (c)
+	{
+	case 'b':
+	  free(blocks);
+	  blocks = xstrdup(optarg);
+	  break;
+	case 'c':
+	  max_contigs = strtoul(optarg, NULL, 10);
+	  break;
+	case 'q':
+	  n = strtoul(optarg, NULL, 10);
+	  break;
+	case 'd':
+	  dir = optarg;
+	  break;
+	case 's':
+	  rng_state = strtoull(optarg, NULL, 10) | 1;
+	  break;
+	case 'h':
+	  bench_usage();
+	  return BRINDLEY_EXIT_SUCCESS;
+	default:
+	  bench_usage();
+	  return BRINDLEY_EXIT_ERR_ARGS;
+	}
+    }
+  if (max_contigs == 0 || n == 0)
+    {
+      bench_usage();
+      return BRINDLEY_EXIT_ERR_ARGS;
+    }
+
+  Range *q = xnmalloc(n, sizeof(Range));
+  double *lat = xnmalloc(n, sizeof(double));
+  char *fn = xmalloc(strlen(dir) + 64);
+  char *saveptr = NULL;
+  char *tok;
+
+  printf("blocks\tcontigs\tload_seconds\trss_mib\tqueries\tpath\tlookups_per_second\tp50_ns\tp90_ns\tp99_ns\tp999_ns\tlifted\n");
+  for (tok = strtok_r(blocks, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+    {
+      size_t n_blocks = strtoul(tok, NULL, 10);
+      size_t n_contigs = n_blocks / 10 < max_contigs ? n_blocks / 10 : max_contigs;
+      int set;
+      if (n_blocks == 0)
+	continue;
+      if (n_contigs == 0)
+	n_contigs = 1;
+
+      sprintf(fn, "%s/brindley_bench.%ld.map", dir, (long) getpid());
+      bench_map_t m = generate_map(fn, n_blocks, n_contigs);
+
+      double rss_before = rss_mib();
+      double t0 = now();
+      CoordMap *map = bc_read_file(fn);
+      double load = now() - t0;
+      double rss = rss_mib() - rss_before;
+      unlink(fn);
+
+      for (set = 0; set < SET_COUNT; set++)
+	{
+	  char prefix[256];
+	  snprintf(prefix, sizeof(prefix), "%zu\t%zu\t%.3f\t%.1f\t%s", m.contigs * m.blocks_per_contig,
+		   m.contigs, load, rss, set_name[set]);
+	  generate_queries(&m, set, q, n);
+	  run_path(map, prefix, "single", false, q, n, lat);
+	  run_path(map, prefix, "batched", true, q, n, lat);
+	}
+
+      bc_free_coordmap(map);
+      free(m.ids);
+      free(m.spans);
+    }
+
+  free(fn);
+  free(lat);
+  free(q);
+  free(blocks);
+  return BRINDLEY_EXIT_SUCCESS;
+}
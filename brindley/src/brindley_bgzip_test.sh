@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# brindley_bgzip_test.sh Compressed input and bgzipped, indexed output.
+#
+# Copyright (c) 2013 Genome Research Ltd.
+#
+# This file is part of BridgeBuilder.
+#
+# BridgeBuilder is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 3 of the License, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# Lifts the same positions from plain and gzipped input to plain and .gz
+# output, with and without compression threads, and checks that -x writes a
+# tabix index, leaves the unlifted positions out and says how many, and
+# needs .gz output.  Run through "make check"; prints one TAP line per check.
+
+BRINDLEY=${BRINDLEY:-./brindley}
+T=brindley_bgzip_test
+checks=0
+failures=0
+
+check() {
+    checks=$((checks + 1))
+    if [ "$1" -eq 0 ]; then
+        echo "ok $checks - $2"
+    else
+        echo "not ok $checks - $2"
+        failures=$((failures + 1))
+    fi
+}
+
+cleanup() {
+    rm -f $T.map $T.in $T.in.gz $T.expected $T.*.out $T.*.gz $T.*.tbi $T.err
+}
+trap cleanup EXIT
+
+printf 'from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n' > $T.map
+printf 'chr1\t100\t200\tnew1\t1000\t1100\n' >> $T.map
+printf 'chr1\t200\t300\tnew1\t2300\t2200\n' >> $T.map
+printf 'chr2\t0\t50\tnew2\t500\t550\n' >> $T.map
+
+# ordered so that the lifted positions are sorted, as indexing needs; chr1 5
+# and chr3 10 do not lift
+printf 'chr1\t150\nchr1\t5\nchr1\t160\nchr1\t260\nchr1\t250\nchr2\t25\nchr3\t10\n' > $T.in
+printf 'new1\t1050\n.\t.\nnew1\t1060\nnew1\t2242\nnew1\t2252\nnew2\t525\n.\t.\n' > $T.expected
+gzip -c $T.in > $T.in.gz
+
+"$BRINDLEY" $T.in $T.map $T.plain.out && diff $T.expected $T.plain.out
+check $? "plain input and output"
+"$BRINDLEY" $T.in.gz $T.map $T.gzin.out && diff $T.expected $T.gzin.out
+check $? "gzipped input"
+"$BRINDLEY" $T.in $T.map $T.out.gz && gzip -dc $T.out.gz | diff $T.expected -
+check $? ".gz output"
+"$BRINDLEY" -@ 2 $T.in.gz $T.map $T.threads.gz && gzip -dc $T.threads.gz | diff $T.expected -
+check $? ".gz output with -@"
+
+"$BRINDLEY" -x $T.in $T.map $T.indexed.gz 2> $T.err \
+    && [ "$(gzip -dc $T.indexed.gz.tbi | head -c 3)" = TBI ]
+check $? "-x writes a tabix index"
+grep -v '^\.' $T.expected > $T.lifted.out && gzip -dc $T.indexed.gz | diff $T.lifted.out -
+check $? "-x leaves out unlifted positions"
+grep -q '^2 positions could not be lifted and were left out of the indexed output$' $T.err
+check $? "-x says how many positions were left out"
+
+"$BRINDLEY" -x $T.in $T.map $T.indexed.out 2> /dev/null
+[ $? -ne 0 ] && [ ! -e $T.indexed.out.tbi ]
+check $? "-x refused for output that is not bgzipped"
+"$BRINDLEY" -@ many $T.in $T.map $T.bad_threads.gz 2> /dev/null
+[ $? -ne 0 ]
+check $? "-@ refused without a number"
+
+echo "1..$checks"
+[ $failures -eq 0 ]
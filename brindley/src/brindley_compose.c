@@ -0,0 +1,75 @@
+/*
+ * brindley_compose.c Brindley map composition.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Chains an A to B map and a B to C map into a single A to C map, so data
+ * moving across several assemblies is lifted once rather than through text
+ * written and re-read between runs.
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+#include "progname.h"
+
+/* internationalisation */
+#include "gettext.h"
+
+/* brindley includes */
+#include "brindley.h"
+#include "brindley_log.h"
+#include "brindley_coordmap.h"
+#include "brindley_compose.h"
+
+/*
+ * brindley_compose
+ * ----------------
+ *
+ * OUTPUT: exit code
+ *
+ */
+int brindley_compose(int argc, char **argv)
+{
+  if (argc < 3 || argc > 4)
+    {
+      fprintf(stderr, gettext("Usage: %s compose <a_to_b_map> <b_to_c_map> [output]\n"), program_name);
+      return BRINDLEY_EXIT_ERR_ARGS;
+    }
+
+  CoordMap *first = bc_read_file(argv[1]);
+  CoordMap *second = bc_read_file(argv[2]);
+  FILE *out = argc == 4 ? fopen(argv[3], "w") : stdout;
+  if (out == NULL)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("could not open output file [%s]"), argv[3]);
+
+  size_t count = bc_compose(first, second, out);
+  blog(1, gettext("wrote %zu blocks lifting through [%s] then [%s]"), count, argv[1], argv[2]);
+
+  if (ferror(out) || (out != stdout && fclose(out) != 0))
+    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("error writing composed map"));
+  bc_free_coordmap(second);
+  bc_free_coordmap(first);
+  return BRINDLEY_EXIT_SUCCESS;
+}
@@ -21,7 +21,6 @@
  */
 #include "config.h"
 
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,37 +32,56 @@
 #include "hash-pjw.h"
 #include "brindley_coordmap.h"
 
+/* htslib, for reading maps that are gzipped or bgzipped */
+#include <htslib/hts.h>
+#include <htslib/kseq.h>
+
 #define LINE_LENGTH 256
-#define LINE_SEP = '\t'
-#define MAX_DEPTH 500
 
-typedef struct CoordMap {
-  gl_list_t * entries;
-} CoordMap;
+// Binary searches run side by side by bc_map_ranges
+#define BC_LOOKUP_GROUP 16
 
-typedef struct avl_node {
-  Range * key;
-  Range * data;
-  int balance;
-  struct avl_node *child[2];
-} avl_node;
+#if defined(__GNUC__)
+#define bc_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define bc_prefetch(addr)
+#endif
 
+/*
+ * Every line of the map becomes one Block.  Each direction has its own
+ * index: per source contig, the blocks' intervals on that side sorted by
+ * start, pointing back into the shared block array rather than holding
+ * copies of the ranges.
+ */
 typedef struct {
-  char * key;
-  avl_node * data;
-} entry;
+  Range from;
+  Range to;
+} Block;
+
+typedef struct {
+  int start;
+  int end;
+  size_t block;
+} Interval;
 
 typedef struct {
-  Range* from;
-  Range* to;
-} RangeMap;
+  char * key;
+  Interval * intervals;
+  size_t count;
+  size_t size;
+} entry;
 
-void avl_free(avl_node *thing);
+typedef struct CoordMap {
+  Block * blocks;
+  size_t blockCount;
+  gl_list_t entries[2];
+} CoordMap;
 
 void bc_free_coordmap(CoordMap* coordMap) {
- gl_list_free(*(coordMap->entries));
- free(coordMap->entries);
- free(coordMap);
+  gl_list_free(coordMap->entries[BC_FORWARD]);
+  gl_list_free(coordMap->entries[BC_REVERSE]);
+  free(coordMap->blocks);
+  free(coordMap);
 }
 
 /*
@@ -128,270 +146,407 @@ void entry_dispose(const void *elt)
 
   /* free the entry struct itself */
   free(bbr->key);
-  avl_free(bbr->data);
-  free(bbr);
+  free(bbr->intervals);
+  free((entry *) bbr);
 
   DLOG("entry_dispose: returning void");
 }
 
-Range * clone_range(Range* old) {
-  Range* new = xmalloc(sizeof(*new));
-  new->start = old->start;
-  new->end = old->end;
-  new->id = old->id;
-  return new;
+static entry* find_entry(gl_list_t list, char* id) {
+  entry e_bad = { id, NULL, 0, 0 };
+  gl_list_node_t n = gl_list_search(list, &e_bad);
+  return n == NULL ? NULL : (entry*) gl_list_node_value(list, n);
 }
 
-// Allocate a single AVL node.
-avl_node* avl_single (Range* key1, Range* data1) {
-  avl_node* rn = xmalloc (sizeof *rn);
-  Range *key = clone_range(key1);
-  Range *data = clone_range(data1);
-
-  if (rn != NULL) {
-    rn->key=key;
-    rn->data=data;
-    rn->balance = 0;
-    rn->child[0]=rn->child[1]=NULL;
+/*
+ * add_interval
+ * ------------
+ *
+ * Files block number block under contig id of one direction's index,
+ * creating the contig on first sight.
+ *
+ * OUTPUT: the index's copy of id, which the block then shares
+ *
+ */
+static char* add_interval(gl_list_t list, char* id, int start, int end, size_t block) {
+  entry* e = find_entry(list, id);
+  if (e == NULL) {
+    e = xzalloc(sizeof(entry));
+    e->key = xstrdup(id);
+    gl_list_add_last(list, e);
   }
-  return rn;
+  if (e->count == e->size) {
+    e->intervals = x2nrealloc(e->intervals, &e->size, sizeof(Interval));
+  }
+  // Reverse-strand blocks run from to_start down to to_end
+  Interval iv = { start < end ? start : end, start < end ? end : start, block };
+  e->intervals[e->count++] = iv;
+  return e->key;
+}
+
+static int compare_intervals(const void* a, const void* b) {
+  const Interval* x = a;
+  const Interval* y = b;
+  return (x->start > y->start) - (x->start < y->start);
 }
 
-void avl_free(avl_node *tree) {
-  if (tree->child[0]!=NULL) {
-    avl_free(tree->child[0]);
+CoordMap* bc_read_file(const char *filename) {
+  DLOG("bc_read_file()");
+  CoordMap *cm = xzalloc(sizeof(CoordMap));
+  size_t blockSize = 0;
+  for (int dir = BC_FORWARD; dir <= BC_REVERSE; dir++) {
+    cm->entries[dir] = gl_list_create_empty(GL_AVLTREEHASH_LIST, 
+					    entry_equals, 
+					    entry_hashcode, 
+					    entry_dispose, 
+					    true);
+  }
+  htsFile *fp = hts_open(filename, "r", NULL);
+
+  if (!fp) exit(1234);
+
+  kstring_t line = { 0, 0, NULL };
+  char from_sn[LINE_LENGTH];
+  char to_sn[LINE_LENGTH];
+  // Ignore header
+  hts_getline(fp, KS_SEP_LINE, &line);
+  // Read each line into the thing
+  while (hts_getline(fp, KS_SEP_LINE, &line) >= 0) {
+    // Parse the line
+    // Tab separated
+    // from_sn from_start      from_end        to_sn   to_start        to_end
+    int from_start, from_end, to_start, to_end;
+    if (sscanf(line.s, "%255s\t%d\t%d\t%255s\t%d\t%d", from_sn, &from_start, &from_end, to_sn, &to_start, &to_end) != 6) {
+      continue;
+    }
+    DLOG("Input line: %s\t%d\t%d\t%s\t%d\t%d", from_sn, from_start, from_end, to_sn, to_start, to_end);
+    if (cm->blockCount == blockSize) {
+      cm->blocks = x2nrealloc(cm->blocks, &blockSize, sizeof(Block));
+    }
+    Block* b = &cm->blocks[cm->blockCount];
+    b->from.start = from_start;
+    b->from.end = from_end;
+    b->from.id = add_interval(cm->entries[BC_FORWARD], from_sn, from_start, from_end, cm->blockCount);
+    b->to.start = to_start;
+    b->to.end = to_end;
+    b->to.id = add_interval(cm->entries[BC_REVERSE], to_sn, to_start, to_end, cm->blockCount);
+    cm->blockCount++;
   }
-  if (tree->child[1]!=NULL) {
-    avl_free(tree->child[1]);
+  free(line.s);
+  hts_close(fp);
+
+  for (int dir = BC_FORWARD; dir <= BC_REVERSE; dir++) {
+    const void* elt;
+    gl_list_node_t node;
+    gl_list_iterator_t it = gl_list_iterator(cm->entries[dir]);
+    while (gl_list_iterator_next(&it, &elt, &node)) {
+      const entry* e = elt;
+      qsort(e->intervals, e->count, sizeof(Interval), compare_intervals);
+    }
+    gl_list_iterator_free(&it);
   }
-  free(tree->key->id);
-  free(tree->key);
-  free(tree->data->id);
-  free(tree->data);
-  free(tree);
+  return cm;
+}
 
+Range* bc_map_range(CoordMap* coordMap, Range* oldRef) {
+  return bc_map_range_dir(coordMap, oldRef, BC_FORWARD, NULL);
 }
 
-int sgn(int x) {
-  if (x > 0) {
-    return 1;
-  } else if (x < 0){
-    return -1;
-  } else {
-    return 1;
-  }
+Range* bc_map_range_strand(CoordMap* coordMap, Range* oldRef, bool* reverse) {
+  return bc_map_range_dir(coordMap, oldRef, BC_FORWARD, reverse);
 }
 
 /*
-  Look up a node in the tree. Returns NULL (yuck!) if the tree does not contain the item.
-*/
-RangeMap *avl_lookup(avl_node *tree, Range* key) {
-  int a = tree->key->start < key->start;
-  if (a && tree->key->end > key->end) {
-    RangeMap *r = xmalloc(sizeof *r);
-    r->from = tree->key;
-    r->to = tree->data;
-    return r;
-  } else if (a && tree->key->end > key->start) {
-    return NULL;
-  } else {
-    if (tree->child[a] == NULL) {
-      return NULL;
+ * find_block
+ * ----------
+ *
+ * Binary search for the last interval starting before the range; the range
+ * lifts only if that interval strictly contains it.
+ *
+ * OUTPUT: the containing block, or NULL
+ *
+ */
+static const Block* find_block(const CoordMap* coordMap, const entry* e, const Range* oldRef) {
+  size_t lo = 0;
+  size_t hi = e->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (e->intervals[mid].start < oldRef->start) {
+      lo = mid + 1;
     } else {
-     return avl_lookup(tree->child[a], key);
+      hi = mid;
     }
   }
+  if (lo == 0 || e->intervals[lo - 1].end <= oldRef->end) {
+    return NULL;
+  }
+  return &coordMap->blocks[e->intervals[lo - 1].block];
 }
 
-// Rotate root in dir and return the new root
-avl_node * avl_rotate(avl_node* p, int dir) {
-  avl_node *c = p->child[dir];
-  p->child[dir] = c->child[!dir];
-  c->child[!dir] = p;
-
-  // Update balance!
-  int d = (dir == 0) ? -1 : 1;
-  if (c->balance * d < 0) {
-    p->balance = p->balance + d - c->balance;
+/*
+ * lift_through
+ * ------------
+ *
+ * Lifts oldRef through block b in direction into newRef.  A block whose
+ * to_start is greater than its to_end lies on the reverse strand of the
+ * target, so positions count down from to_start and the range comes out
+ * flipped, in either direction.
+ *
+ */
+static void lift_through(const Block* b, const Range* oldRef, bc_direction direction, Range* newRef, bool* reverse) {
+  bool reversed = b->to.start > b->to.end;
+  if (direction == BC_FORWARD) {
+    if (reversed) {
+      newRef->start = b->to.start - (oldRef->end - b->from.start);
+      newRef->end = b->to.start - (oldRef->start - b->from.start);
+    } else {
+      newRef->start = oldRef->start - b->from.start + b->to.start;
+      newRef->end = newRef->start + (oldRef->end - oldRef->start);
+    }
+    newRef->id = b->to.id;
   } else {
-    p->balance = p->balance  + d;
+    if (reversed) {
+      newRef->start = b->from.start + (b->to.start - oldRef->end);
+      newRef->end = b->from.start + (b->to.start - oldRef->start);
+    } else {
+      newRef->start = oldRef->start - b->to.start + b->from.start;
+      newRef->end = newRef->start + (oldRef->end - oldRef->start);
+    }
+    newRef->id = b->from.id;
   }
-
-  if (p->balance * d > 0) {
-    c->balance = c->balance + p->balance + d;
-  } else {
-    c->balance = c->balance + d;
+  if (reverse != NULL) {
+    *reverse = reversed;
   }
-
-  return c;
 }
 
-// Balance the tree after an insert.
-// Dir indicates the side of the tree with a positive imbalance - e.g.
-// dir=0 suggests a left imbalance, dir=1 suggests a right imbalance.
-avl_node * avl_insert_balance(avl_node* p, int dir) {
-  int pbal = dir == 0 ? 1 : -1;
-  // We need to test whether the sign of c's balance agrees with the dir
-  if (sgn(p->child[dir]->balance) != pbal) {
-    avl_node *d = avl_rotate(p->child[dir], !dir);
-    p->child[dir] = d;
+/*
+ * bc_map_range_dir
+ * ----------------
+ *
+ * Lifts oldRef through the block containing it, from the map's source to
+ * its target (BC_FORWARD) or back again (BC_REVERSE).
+ *
+ * INPUT: map, range to lift, direction, and where to say whether the block
+ *        was reversed (may be NULL)
+ * OUTPUT: newly allocated lifted range, or NULL if no block contains it
+ *
+ */
+Range* bc_map_range_dir(CoordMap* coordMap, Range* oldRef, bc_direction direction, bool* reverse) {
+  DLOG("bc_map_range()");
+  entry* e = find_entry(coordMap->entries[direction], oldRef->id);
+  if (e == NULL) {
+    return NULL;
+  }
+  const Block* b = find_block(coordMap, e, oldRef);
+  if (b == NULL) {
+    return NULL;
   }
-  return avl_rotate(p, dir);
+
+  Range* newRef = xmalloc(sizeof *newRef);
+  lift_through(b, oldRef, direction, newRef, reverse);
+  return newRef;
 }
 
-/* Insert a node into the tree. We walk down the tree until we insert, storing the path
-   which we used to walk down. We then walk back up the same path checking whether we need
-   to rebalance.
-*/
-avl_node* avl_insert(avl_node* tree, Range* key, Range* value) {
-
-  // Iterator
-  avl_node *i = tree;
-  int idx = 0;
-  // Store which nodes we visit
-  avl_node *rev[MAX_DEPTH];
-  // And which directions we take (corresponds to the direction to the next node.)
-  int revd[MAX_DEPTH];
-
-  for (;;) {
-    if (i != NULL) {
-      // Record we've visited
-      int dir = key->start > i->key->start;
-      revd[idx] = dir;
-      rev[idx] = i;
-
-      // Increment
-      idx = idx + 1;
-      // and walk
-      i = i->child[dir];
-    } else {
-      idx = idx - 1;
-      i = rev[idx];
-      break;
+/*
+ * bc_map_ranges
+ * -------------
+ *
+ * Lifts n ranges at once.  On an unsorted batch each lookup is a chain of
+ * dependent cache misses down a large interval array, so rather than
+ * searching one range after another, groups of BC_LOOKUP_GROUP binary
+ * searches advance a step at a time in lockstep, each prefetching its next
+ * probe while the others take their step.
+ *
+ * INPUT: map, ranges to lift, how many, direction, where to store the
+ *        results (id NULL if not lifted) and whether each block was
+ *        reversed (may be NULL)
+ * OUTPUT: number of ranges lifted
+ *
+ */
+size_t bc_map_ranges(CoordMap* coordMap, const Range* oldRefs, size_t n, bc_direction direction, Range* newRefs, bool* reverse) {
+  const entry* e[BC_LOOKUP_GROUP];
+  size_t lo[BC_LOOKUP_GROUP];
+  size_t hi[BC_LOOKUP_GROUP];
+  size_t lifted = 0;
+
+  for (size_t base = 0; base < n; base += BC_LOOKUP_GROUP) {
+    size_t group = n - base < BC_LOOKUP_GROUP ? n - base : BC_LOOKUP_GROUP;
+    size_t active = 0;
+    for (size_t k = 0; k < group; k++) {
+      e[k] = find_entry(coordMap->entries[direction], oldRefs[base + k].id);
+      lo[k] = 0;
+      hi[k] = e[k] == NULL ? 0 : e[k]->count;
+      if (lo[k] < hi[k]) {
+        bc_prefetch(&e[k]->intervals[hi[k] / 2]);
+        active++;
+      }
     }
-  }
-
-  // Insert the new child.
-  i->child[revd[idx]] = avl_single(key, value);
-
-  // Walk back up the path.
-  while(idx != 0) {
-    // Update the balance
-    rev[idx]->balance += revd[idx] == 0 ? 1 : -1;
-
-    int bal = rev[idx]->balance;
-    if (bal == 0) {
-      /* If we get a balance 0 during the walk up, then we have balanced a subtree
-      and hence need walk no further.
-      */
-      break;
-    } else if (bal < -1 || bal > 1) {
-      // Out of balance, so we need to rebalance.
-      rev[idx - 1]->child[revd[idx - 1]] = avl_insert_balance(rev[idx], revd[idx]);
-      break;
+    while (active > 0) {
+      active = 0;
+      for (size_t k = 0; k < group; k++) {
+        if (lo[k] >= hi[k]) {
+          continue;
+        }
+        size_t mid = lo[k] + (hi[k] - lo[k]) / 2;
+        if (e[k]->intervals[mid].start < oldRefs[base + k].start) {
+          lo[k] = mid + 1;
+        } else {
+          hi[k] = mid;
+        }
+        if (lo[k] < hi[k]) {
+          bc_prefetch(&e[k]->intervals[lo[k] + (hi[k] - lo[k]) / 2]);
+          active++;
+        }
+      }
+    }
+    for (size_t k = 0; k < group; k++) {
+      const Range* oldRef = &oldRefs[base + k];
+      Range* newRef = &newRefs[base + k];
+      newRef->id = NULL;
+      if (e[k] == NULL || lo[k] == 0 || e[k]->intervals[lo[k] - 1].end <= oldRef->end) {
+        continue;
+      }
+      lift_through(&coordMap->blocks[e[k]->intervals[lo[k] - 1].block], oldRef, direction, newRef,
+		   reverse == NULL ? NULL : &reverse[base + k]);
+      lifted++;
     }
-    idx = idx - 1;
   }
+  return lifted;
+}
 
-  return rev[idx];
+static int compare_ids(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
 }
 
-CoordMap* bc_read_file(const char *filename) {
-  DLOG("bc_read_file()");
-  gl_list_t *map = xmalloc(sizeof(gl_list_t));
-  *map = gl_list_create_empty(GL_AVLTREEHASH_LIST, 
-			      entry_equals, 
-			      entry_hashcode, 
-			      entry_dispose, 
-			      true);
-  FILE *fp = fopen(filename, "r");
+/*
+ * bc_target_ids
+ * -------------
+ *
+ * INPUT: map, direction, and where to store the number of contigs found
+ * OUTPUT: newly allocated, sorted array of the distinct contig names
+ *         lifted onto in that direction (the names themselves are owned
+ *         by the map)
+ *
+ */
+char** bc_target_ids(CoordMap* coordMap, bc_direction direction, size_t* count) {
+  // Contigs lifted onto are the ones the opposite direction is keyed on
+  gl_list_t list = coordMap->entries[direction == BC_FORWARD ? BC_REVERSE : BC_FORWARD];
+  char** ids = xnmalloc(gl_list_size(list) + 1, sizeof(char*));
+  const void* elt;
+  gl_list_node_t node;
+
+  *count = 0;
+  gl_list_iterator_t it = gl_list_iterator(list);
+  while (gl_list_iterator_next(&it, &elt, &node)) {
+    ids[(*count)++] = ((const entry*)elt)->key;
+  }
+  gl_list_iterator_free(&it);
 
-  if (!fp) exit(1234);
+  qsort(ids, *count, sizeof(char*), compare_ids);
+  return ids;
+}
 
-  // Ignore header
-  while (fgetc(fp) != '\n') {}
-  // Read each line into the thing
-  char line[LINE_LENGTH];
-  while (fgets(line, LINE_LENGTH, fp) != NULL) {
-    // Parse the line
-    // Tab separated
-    // from_sn from_start      from_end        to_sn   to_start        to_end
-    char *from_sn = xmalloc(LINE_LENGTH * sizeof(char));
-    char *to_sn = xmalloc(LINE_LENGTH * sizeof(char));
-    int from_start, from_end, to_start, to_end;
-    sscanf(line, "%s\t%d\t%d\t%s\t%d\t%d", from_sn, &from_start, &from_end, to_sn, &to_start, &to_end);
-    DLOG("Input line: %s\t%d\t%d\t%s\t%d\t%d", from_sn, from_start, from_end, to_sn, to_start, to_end);
-    Range from_range = { from_start, from_end, from_sn };
-    Range to_range = { to_start, to_end, to_sn };
-    entry *e_bad = xmalloc(sizeof(entry));
-    e_bad->key=from_sn;
-    e_bad->data=NULL;
-
-    // Check whether we already have something for this key.
-    gl_list_node_t n = gl_list_search(*map, e_bad);
-    free(e_bad);
-    if (n == NULL) {
-      avl_node * newtree = avl_single(&from_range, &to_range);
-      entry* e1 = xmalloc(sizeof(entry));
-      e1->key=strndup(from_sn, LINE_LENGTH-1);
-      e1->data = newtree;
-      gl_list_add_last(*map, e1);
-    } else {
-      entry* e = (entry*) gl_list_node_value(*map, n);
-      avl_insert(e->data, &from_range, &to_range);
-    }
+static int compare_blocks(const void* a, const void* b) {
+  const Block* x = a;
+  const Block* y = b;
+  int c = strcmp(x->from.id, y->from.id);
+  if (c != 0) {
+    return c;
   }
-
-  fclose(fp);
-  CoordMap *cm = xmalloc(sizeof(CoordMap));
-  cm->entries = map;
-  return cm;
+  return (x->from.start > y->from.start) - (x->from.start < y->from.start);
 }
 
-Range* bc_map_range(CoordMap* coordMap, Range* oldRef) {
-  DLOG("bc_map_range()");
-  char * key = oldRef->id;
-  //  entry e_bad = {key, NULL};
-  entry *e_bad = xmalloc(sizeof(entry));
-  e_bad->key=key;
-  e_bad->data=NULL;
-  gl_list_t* map = coordMap->entries;
-  gl_list_node_t n = gl_list_search(*map, e_bad);
-  free(e_bad);
-
-  Range *mappedFrom;
-  Range *mappedTo;
-  if (n == NULL) {
-    return NULL;
-  } else {
-    entry* e = (entry*) gl_list_node_value(*map, n);
-    RangeMap* rm = avl_lookup(e->data, oldRef);
-    if (rm == NULL) {
-      return NULL;
-    } else {
-      mappedFrom = rm->from;
-      mappedTo = rm->to;
-      free(rm);
-    }
+// Where position pos of a block's source lands on its target
+static int block_lift(const Block* b, int pos) {
+  if (b->to.start > b->to.end) {
+    return b->to.start - (pos - b->from.start);
   }
+  return b->to.start + (pos - b->from.start);
+}
 
-  // Look up offsets in mapped range.
-  int toStart = mappedTo->start;
-  int toEnd = mappedTo->end;
-  if (toStart > toEnd) {
-    // If I must program in C, I'm at least going to do silly hacky C things like doing this
-    // swap to avoid the 'expense' of another variable.
-    toEnd = toStart + toEnd;
-    toStart = toEnd - toStart;
-    toEnd = toEnd - toStart;
+// The inverse of block_lift: which source position lands on pos
+static int block_unlift(const Block* b, int pos) {
+  if (b->to.start > b->to.end) {
+    return b->from.start + (b->to.start - pos);
   }
-  int start = oldRef->start - mappedFrom->start + toStart;
-  int end = start + (oldRef->end - oldRef->start);
+  return b->from.start + (pos - b->to.start);
+}
 
-  Range* newRef = xmalloc(sizeof *newRef);
-  newRef->start = start;
-  newRef->end = end;
-  newRef->id = mappedTo->id;
+/*
+ * bc_compose
+ * ----------
+ *
+ * Chains two maps, first lifting A to B and second lifting B to C, into
+ * one lifting A straight to C.  For each contig of B, the first map's
+ * target intervals and the second map's source intervals are both already
+ * sorted by start, so one sweep along them finds every overlap; each
+ * overlap becomes a block of the composed map.  Blocks on the reverse
+ * strand in either map compose to the forward strand if both are reversed.
+ * The second map's source blocks must not overlap, as for any lookup.
+ *
+ * INPUT: the A to B map, the B to C map, and where to write the A to C
+ *        map, sorted by source contig and position
+ * OUTPUT: number of blocks written
+ *
+ */
+size_t bc_compose(CoordMap* first, CoordMap* second, FILE* out) {
+  Block* composed = NULL;
+  size_t count = 0;
+  size_t size = 0;
+  const void* elt;
+  gl_list_node_t node;
+
+  gl_list_iterator_t it = gl_list_iterator(first->entries[BC_REVERSE]);
+  while (gl_list_iterator_next(&it, &elt, &node)) {
+    const entry* x = elt;
+    const entry* y = find_entry(second->entries[BC_FORWARD], x->key);
+    if (y == NULL) {
+      continue;
+    }
+    size_t j0 = 0;
+    for (size_t i = 0; i < x->count; i++) {
+      const Interval* xi = &x->intervals[i];
+      // Blocks of y ending before xi also end before every later x interval
+      while (j0 < y->count && y->intervals[j0].end <= xi->start) {
+        j0++;
+      }
+      for (size_t j = j0; j < y->count && y->intervals[j].start < xi->end; j++) {
+        const Interval* yj = &y->intervals[j];
+        int lo = xi->start > yj->start ? xi->start : yj->start;
+        int hi = xi->end < yj->end ? xi->end : yj->end;
+        if (lo >= hi) {
+          continue;
+        }
+        const Block* ab = &first->blocks[xi->block];
+        const Block* bc = &second->blocks[yj->block];
+        int a0 = block_unlift(ab, lo);
+        int a1 = block_unlift(ab, hi);
+        if (a0 > a1) {
+          int t = a0;
+          a0 = a1;
+          a1 = t;
+        }
+        if (count == size) {
+          composed = x2nrealloc(composed, &size, sizeof(Block));
+        }
+        Block* b = &composed[count++];
+        b->from.start = a0;
+        b->from.end = a1;
+        b->from.id = ab->from.id;
+        b->to.start = block_lift(bc, block_lift(ab, a0));
+        b->to.end = block_lift(bc, block_lift(ab, a1));
+        b->to.id = bc->to.id;
+      }
+    }
+  }
+  gl_list_iterator_free(&it);
 
-  return newRef;
+  qsort(composed, count, sizeof(Block), compare_blocks);
+  fprintf(out, "from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n");
+  for (size_t i = 0; i < count; i++) {
+    fprintf(out, "%s\t%d\t%d\t%s\t%d\t%d\n", composed[i].from.id, composed[i].from.start, composed[i].from.end,
+	    composed[i].to.id, composed[i].to.start, composed[i].to.end);
+  }
+  free(composed);
+  return count;
 }
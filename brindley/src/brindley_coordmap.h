@@ -20,6 +20,10 @@
  *
  */
 
+ #include <stdbool.h>
+ #include <stddef.h>
+ #include <stdio.h>
+
  #define READ_UNMAPPED (-1)
 
  // Co-ordinate map
@@ -32,11 +36,33 @@
   char* id;    
  } Range;
 
+ // Which way to lift: from the map's source to its target, or back
+ typedef enum {
+  BC_FORWARD = 0,
+  BC_REVERSE = 1
+ } bc_direction;
+
  // Read map from file
  CoordMap* bc_read_file(const char *filename);
 
  // Look up co-ordinates
  Range* bc_map_range(CoordMap* coordMap, Range* oldRef);
 
+ // Look up co-ordinates, also saying whether they fell in a reverse-strand block
+ Range* bc_map_range_strand(CoordMap* coordMap, Range* oldRef, bool* reverse);
+
+ // Look up co-ordinates in either direction through the same map
+ Range* bc_map_range_dir(CoordMap* coordMap, Range* oldRef, bc_direction direction, bool* reverse);
+
+ // Look up many co-ordinates at once into newRefs (id NULL where not lifted),
+ // returning how many were lifted; faster than one at a time on unsorted input
+ size_t bc_map_ranges(CoordMap* coordMap, const Range* oldRefs, size_t n, bc_direction direction, Range* newRefs, bool* reverse);
+
+ // List the distinct contigs the map lifts onto in direction (the strings belong to the map)
+ char** bc_target_ids(CoordMap* coordMap, bc_direction direction, size_t* count);
+
+ // Write the map lifting A to C made by chaining an A to B and a B to C map
+ size_t bc_compose(CoordMap* first, CoordMap* second, FILE* out);
+
  // Free the coordinate map
  void bc_free_coordmap(CoordMap* coordMap);
@@ -0,0 +1,252 @@
+/*
+ * brindley_coordmap_test.c Tests of brindley co-ordinate mapping.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Checks lifts through a small map with forward and reverse-strand blocks:
+ * both directions, single and batched lookups agreeing, the strict
+ * containment rule at block edges, and bc_compose chaining two maps.  Run
+ * through "make check"; prints one TAP line per check.
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+#include "xalloc.h"
+
+/* brindley includes */
+#include "brindley.h"
+#include "brindley_coordmap.h"
+
+#define FIRST_MAP "brindley_coordmap_test.first.map"
+#define SECOND_MAP "brindley_coordmap_test.second.map"
+#define COMPOSED_MAP "brindley_coordmap_test.composed.map"
+
+/*
+ * chr1 [100,200) lifts forward onto new1 [1000,1100), chr1 [200,300) onto
+ * the reverse strand of new1 from 2300 down to 2200, and chr2 onto new2.
+ * The second map takes new1 on to final1, again with its second block
+ * reversed, so chr1 composes onto final1 on the forward strand throughout.
+ */
+static const char *first_map =
+  "from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n"
+  "chr1\t100\t200\tnew1\t1000\t1100\n"
+  "chr1\t200\t300\tnew1\t2300\t2200\n"
+  "chr2\t0\t50\tnew2\t500\t550\n";
+
+static const char *second_map =
+  "from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n"
+  "new1\t1000\t1100\tfinal1\t0\t100\n"
+  "new1\t2200\t2300\tfinal1\t300\t200\n";
+
+static const char *composed_map =
+  "from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n"
+  "chr1\t100\t200\tfinal1\t0\t100\n"
+  "chr1\t200\t300\tfinal1\t200\t300\n";
+
+/* a lookup and what it should give (to_id NULL if it should not lift) */
+typedef struct {
+  bc_direction direction;
+  const char *id;
+  int start;
+  int end;
+  const char *to_id;
+  int to_start;
+  int to_end;
+  bool reverse;
+} lift_case;
+
+static const lift_case cases[] = {
+  /* forward, inside each block */
+  { BC_FORWARD, "chr1", 150, 160, "new1", 1050, 1060, false },
+  { BC_FORWARD, "chr1", 250, 260, "new1", 2240, 2250, true },
+  { BC_FORWARD, "chr2", 10, 20, "new2", 510, 520, false },
+  /* reverse, back onto the same source ranges */
+  { BC_REVERSE, "new1", 1050, 1060, "chr1", 150, 160, false },
+  { BC_REVERSE, "new1", 2240, 2250, "chr1", 250, 260, true },
+  { BC_REVERSE, "new2", 510, 520, "chr2", 10, 20, false },
+  /* a range lifts only if strictly inside a block */
+  { BC_FORWARD, "chr1", 101, 110, "new1", 1001, 1010, false },
+  { BC_FORWARD, "chr1", 100, 110, NULL, 0, 0, false },
+  { BC_FORWARD, "chr1", 190, 199, "new1", 1090, 1099, false },
+  { BC_FORWARD, "chr1", 190, 200, NULL, 0, 0, false },
+  { BC_FORWARD, "chr1", 200, 210, NULL, 0, 0, false },
+  { BC_FORWARD, "chr1", 201, 210, "new1", 2290, 2299, true },
+  { BC_FORWARD, "chr1", 195, 205, NULL, 0, 0, false },
+  { BC_FORWARD, "chr1", 290, 300, NULL, 0, 0, false },
+  { BC_REVERSE, "new1", 2200, 2210, NULL, 0, 0, false },
+  { BC_REVERSE, "new1", 2201, 2210, "chr1", 290, 299, true },
+  { BC_REVERSE, "new1", 2290, 2300, NULL, 0, 0, false },
+  /* outside every block, and unknown contigs */
+  { BC_FORWARD, "chr1", 50, 60, NULL, 0, 0, false },
+  { BC_FORWARD, "chr1", 400, 410, NULL, 0, 0, false },
+  { BC_FORWARD, "chrX", 150, 160, NULL, 0, 0, false },
+  { BC_REVERSE, "chr1", 150, 160, NULL, 0, 0, false },
+};
+
+#define N_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static int checks = 0;
+static int failures = 0;
+
+static void check(bool ok, const char *what, size_t i)
+{
+  checks++;
+  if (!ok)
+    failures++;
+  printf("%s %d - %s %zu\n", ok ? "ok" : "not ok", checks, what, i);
+}
+
+static void write_file(const char *fn, const char *text)
+{
+  FILE *fp = fopen(fn, "w");
+  if (fp == NULL)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, "could not write map [%s]", fn);
+  fputs(text, fp);
+  if (fclose(fp) != 0)
+    err(BRINDLEY_EXIT_ERR_WRITE, "could not write map [%s]", fn);
+}
+
+static bool same_lift(const lift_case *c, const Range *r, bool reverse)
+{
+  if (c->to_id == NULL)
+    return r == NULL || r->id == NULL;
+  return r != NULL && r->id != NULL && strcmp(r->id, c->to_id) == 0
+    && r->start == c->to_start && r->end == c->to_end && reverse == c->reverse;
+}
+
+/* lift through one map then the other, as the composed map should */
+static Range *lift_twice(CoordMap *first, CoordMap *second, Range *r)
+{
+  Range *mid = bc_map_range(first, r);
+  Range *out;
+
+  if (mid == NULL)
+    return NULL;
+  out = bc_map_range(second, mid);
+  free(mid);
+  return out;
+}
+
+int main(void)
+{
+  CoordMap *first, *second, *composed;
+  Range queries[N_CASES], batched[N_CASES];
+  bool reverse[N_CASES];
+  Range *r;
+  bool rev;
+  size_t i;
+  int pos;
+
+  write_file(FIRST_MAP, first_map);
+  write_file(SECOND_MAP, second_map);
+  first = bc_read_file(FIRST_MAP);
+  second = bc_read_file(SECOND_MAP);
+
+  /* one at a time */
+  for (i = 0; i < N_CASES; i++)
+    {
+      queries[i].id = (char *) cases[i].id;
+      queries[i].start = cases[i].start;
+      queries[i].end = cases[i].end;
+      rev = false;
+      r = bc_map_range_dir(first, &queries[i], cases[i].direction, &rev);
+      check(same_lift(&cases[i], r, rev), "single lift", i);
+      free(r);
+    }
+
+  /* batched, each direction in one call, several lookup groups long */
+  for (int dir = BC_FORWARD; dir <= BC_REVERSE; dir++)
+    {
+      Range q[N_CASES * 3];
+      Range out[N_CASES * 3];
+      bool out_rev[N_CASES * 3];
+      size_t idx[N_CASES * 3];
+      size_t n = 0, lifted, expected = 0;
+
+      for (int round = 0; round < 3; round++)
+	for (i = 0; i < N_CASES; i++)
+	  if (cases[i].direction == (bc_direction) dir)
+	    {
+	      idx[n] = i;
+	      q[n++] = queries[i];
+	      if (cases[i].to_id != NULL)
+		expected++;
+	    }
+      memset(out_rev, 0, sizeof(out_rev));
+      lifted = bc_map_ranges(first, q, n, dir, out, out_rev);
+      check(lifted == expected, "batched lift count for direction", dir);
+      for (i = 0; i < n; i++)
+	{
+	  batched[idx[i]] = out[i];
+	  reverse[idx[i]] = out_rev[i];
+	}
+    }
+  for (i = 0; i < N_CASES; i++)
+    check(same_lift(&cases[i], &batched[i], reverse[i]), "batched lift", i);
+
+  /* compose, and check the result against lifting through both maps */
+  FILE *fp = fopen(COMPOSED_MAP, "w+");
+  if (fp == NULL)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, "could not write map [%s]", COMPOSED_MAP);
+  check(bc_compose(first, second, fp) == 2, "composed block count", 0);
+  rewind(fp);
+  char text[1024];
+  size_t len = fread(text, 1, sizeof(text) - 1, fp);
+  text[len] = '\0';
+  fclose(fp);
+  check(strcmp(text, composed_map) == 0, "composed map text", 0);
+
+  composed = bc_read_file(COMPOSED_MAP);
+  for (pos = 101; pos < 299; pos++)
+    {
+      Range q = { pos, pos + 1, "chr1" };
+      Range *direct = bc_map_range(composed, &q);
+      Range *chained = lift_twice(first, second, &q);
+      bool ok = (direct == NULL) == (chained == NULL);
+      if (ok && direct != NULL)
+	ok = strcmp(direct->id, chained->id) == 0 && direct->start == chained->start
+	  && direct->end == chained->end;
+      check(ok, "composed lift matches chained lift at", pos);
+      free(direct);
+      free(chained);
+    }
+  /* and back again */
+  Range back = { 50, 60, "final1" };
+  r = bc_map_range_dir(composed, &back, BC_REVERSE, NULL);
+  check(r != NULL && strcmp(r->id, "chr1") == 0 && r->start == 150 && r->end == 160,
+	"composed reverse lift", 0);
+  free(r);
+
+  bc_free_coordmap(composed);
+  bc_free_coordmap(second);
+  bc_free_coordmap(first);
+  remove(FIRST_MAP);
+  remove(SECOND_MAP);
+  remove(COMPOSED_MAP);
+
+  printf("1..%d\n", checks);
+  return failures == 0 ? BRINDLEY_EXIT_SUCCESS : 1;
+}
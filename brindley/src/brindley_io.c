@@ -0,0 +1,128 @@
+/*
+ * brindley_io.c Brindley compressed output.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Output for the line-based modes, either plain or through BGZF with
+ * compression spread over threads.  Input needs no counterpart: hts_open
+ * and hts_getline already read plain, gzip and bgzip text alike.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* gnulib headers */
+#include "xalloc.h"
+
+/* htslib */
+#include <htslib/bgzf.h>
+#include <htslib/tbx.h>
+
+/* brindley includes */
+#include "brindley_io.h"
+
+/* BGZF blocks each compression thread takes at a time */
+#define BO_SUB_BLOCKS 256
+
+struct brindley_out
+{
+  FILE *fp;
+  BGZF *bgzf;
+};
+
+static bool has_suffix(const char *fn, const char *suffix)
+{
+  size_t len = strlen(fn);
+  size_t slen = strlen(suffix);
+  return len >= slen && strcmp(fn + len - slen, suffix) == 0;
+}
+
+/*
+ * bo_open
+ * -------
+ *
+ * OUTPUT: output handle, or NULL if fn could not be opened
+ *
+ */
+brindley_out_t *bo_open(const char *fn, int threads)
+{
+  brindley_out_t *out = xzalloc(sizeof(*out));
+
+  if (fn == NULL || strcmp(fn, "-") == 0)
+    out->fp = stdout;
+  else if (has_suffix(fn, ".gz") || has_suffix(fn, ".bgz"))
+    {
+      out->bgzf = bgzf_open(fn, "w");
+      if (out->bgzf != NULL && threads > 0)
+	bgzf_mt(out->bgzf, threads, BO_SUB_BLOCKS);
+    }
+  else
+    out->fp = fopen(fn, "w");
+
+  if (out->fp == NULL && out->bgzf == NULL)
+    {
+      free(out);
+      return NULL;
+    }
+  return out;
+}
+
+bool bo_is_bgzf(const brindley_out_t *out)
+{
+  return out->bgzf != NULL;
+}
+
+bool bo_write(brindley_out_t *out, const char *data, size_t len)
+{
+  if (out->bgzf != NULL)
+    return bgzf_write(out->bgzf, data, len) == (ssize_t) len;
+  return fwrite(data, 1, len, out->fp) == len;
+}
+
+bool bo_close(brindley_out_t *out)
+{
+  bool ok;
+
+  if (out->bgzf != NULL)
+    ok = bgzf_close(out->bgzf) == 0;
+  else if (out->fp == stdout)
+    ok = fflush(stdout) == 0 && !ferror(stdout);
+  else
+    ok = !ferror(out->fp) & (fclose(out->fp) == 0);
+  free(out);
+  return ok;
+}
+
+/*
+ * bo_index
+ * --------
+ *
+ * Builds fn.tbi over contig and position in the first two columns.
+ *
+ * OUTPUT: false if the file could not be indexed, e.g. it is not sorted
+ *
+ */
+bool bo_index(const char *fn)
+{
+  tbx_conf_t conf = { TBX_GENERIC, 1, 2, 0, '#', 0 };
+  return tbx_index_build(fn, 0, &conf) == 0;
+}
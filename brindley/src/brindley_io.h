@@ -0,0 +1,44 @@
+/*
+ * brindley_io.h Brindley compressed output.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BRINDLEY_IO_H
+#define BRINDLEY_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* text output, bgzipped when the file name ends in .gz or .bgz */
+typedef struct brindley_out brindley_out_t;
+
+/* open fn for writing ("-" or NULL for stdout) with threads compression threads */
+brindley_out_t *bo_open(const char *fn, int threads);
+
+/* true if output goes through BGZF, and so can be indexed */
+bool bo_is_bgzf(const brindley_out_t *out);
+
+bool bo_write(brindley_out_t *out, const char *data, size_t len);
+
+/* flush and close, returning false on any write error */
+bool bo_close(brindley_out_t *out);
+
+/* tabix index a closed, bgzipped, sorted chr\tpos file */
+bool bo_index(const char *fn);
+
+#endif
@@ -22,12 +22,20 @@
 
 #include "config.h"
 
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 /* gnulib headers */
 #include "progname.h"
 
+/* internationalisation */
+#include "gettext.h"
+
+#include "brindley.h"
 #include "brindley_log.h"
 
 /*
@@ -71,3 +79,24 @@ void DLOG(const char *msgfmt, ...)
 }
 #endif
 
+/*
+ * brindley_int_arg
+ *
+ * Parses ARG, the argument given to command-line option OPTION, as a
+ * whole decimal number of at least MIN, exiting with a usage error if it
+ * is anything else.
+ *
+ * OUTPUT: the number
+ *
+ */
+int brindley_int_arg(char option, const char *arg, int min)
+{
+  char *end;
+  long value;
+
+  errno = 0;
+  value = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || errno != 0 || value < min || value > INT_MAX)
+    errx(BRINDLEY_EXIT_ERR_ARGS, gettext("-%c needs a whole number of at least %d, not [%s]"), option, min, arg);
+  return (int) value;
+}
@@ -31,6 +31,9 @@ unsigned int verbosity;
 
 void blog(unsigned int level, const char *msgfmt, ...);
 
+/* the argument of option as an int of at least min, exiting if it is not one */
+int brindley_int_arg(char option, const char *arg, int min);
+
 
 #ifdef DEBUG
 /* debug flag: if true, print debugging messages to stderr */
@@ -0,0 +1,312 @@
+/*
+ * brindley_refcache.c BridgeBuilder reference cache.
+ *
+ * Copyright (c) 2013 Genome Research Ltd.
+ *
+ * This file is part of BridgeBuilder.
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Builds reference caches from FASTA, for reading through the shared reader
+ * in common/bb_refcache.c, which maps them read-only so every process using
+ * the same reference shares one copy of it in the page cache.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* gnulib headers */
+#include "progname.h"
+#include "xalloc.h"
+#include "xstrndup.h"
+
+/* internationalisation */
+#include "gettext.h"
+
+/* htslib */
+#include <htslib/hts.h>
+#include <htslib/kseq.h>
+#include <htslib/kstring.h>
+
+/* brindley includes */
+#include "brindley.h"
+#include "brindley_log.h"
+#include "brindley_refcache.h"
+
+/* 2-bit code of each base, 4 for anything stored as N */
+static uint8_t base_code[256];
+
+static void init_tables(void)
+{
+  static const char bases[] = "ACGT";
+  int i;
+
+  memset(base_code, 4, sizeof(base_code));
+  for (i = 0; i < 4; i++)
+    {
+      base_code[(unsigned char) bases[i]] = i;
+      base_code[tolower((unsigned char) bases[i])] = i;
+    }
+}
+
+typedef struct {
+  FILE *fp;
+  const char *fn;
+  uint64_t offset;
+} rc_writer_t;
+
+/* a contig while its sequence is being read */
+typedef struct {
+  rc_contig_t contig;
+  char *name;
+  rc_run_t *n_runs;
+  size_t n_size;
+  rc_run_t *mask_runs;
+  size_t mask_size;
+  uint8_t pending;
+  hts_md5_context *md5;
+} rc_building_t;
+
+typedef struct {
+  const char *name;
+  uint32_t index;
+} rc_order_t;
+
+static void rc_write(rc_writer_t *w, const void *data, size_t len)
+{
+  if (len > 0 && fwrite(data, 1, len, w->fp) != len)
+    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not write to [%s]"), w->fn);
+  w->offset += len;
+}
+
+static void rc_align(rc_writer_t *w)
+{
+  static const uint8_t zero[8];
+  rc_write(w, zero, (8 - w->offset % 8) % 8);
+}
+
+/* extend the last run to cover pos, or start a new one */
+static void add_run(rc_run_t **runs, uint32_t *count, size_t *size, uint32_t pos)
+{
+  if (*count > 0 && (*runs)[*count - 1].end == pos)
+    {
+      (*runs)[*count - 1].end++;
+      return;
+    }
+  if (*count == *size)
+    *runs = x2nrealloc(*runs, size, sizeof(rc_run_t));
+  (*runs)[*count].start = pos;
+  (*runs)[*count].end = pos + 1;
+  (*count)++;
+}
+
+static void add_bases(rc_writer_t *w, rc_building_t *b, const char *s, size_t len, kstring_t *upper)
+{
+  size_t i;
+
+  upper->l = 0;
+  for (i = 0; i < len; i++)
+    {
+      unsigned char c = s[i];
+      if (isspace(c))
+	continue;
+      uint64_t pos = b->contig.length;
+      if (pos >= UINT32_MAX)
+	errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("contig [%s] is too long for a reference cache"), b->name);
+      uint8_t code = base_code[c];
+      if (code == 4)
+	{
+	  add_run(&b->n_runs, &b->contig.n_count, &b->n_size, pos);
+	  code = 0;
+	}
+      if (islower(c))
+	add_run(&b->mask_runs, &b->contig.mask_count, &b->mask_size, pos);
+      b->pending |= code << (2 * (pos % 4));
+      if (pos % 4 == 3)
+	{
+	  rc_write(w, &b->pending, 1);
+	  b->pending = 0;
+	}
+      b->contig.length++;
+      kputc(toupper(c), upper);
+    }
+  hts_md5_update(b->md5, upper->s, upper->l);
+}
+
+/* write the rest of a contig's sections, leaving its entry complete */
+static void finish_contig(rc_writer_t *w, rc_building_t *b)
+{
+  if (b->contig.length % 4 != 0)
+    rc_write(w, &b->pending, 1);
+  rc_align(w);
+  b->contig.n_offset = w->offset;
+  rc_write(w, b->n_runs, b->contig.n_count * sizeof(rc_run_t));
+  rc_align(w);
+  b->contig.mask_offset = w->offset;
+  rc_write(w, b->mask_runs, b->contig.mask_count * sizeof(rc_run_t));
+  rc_align(w);
+  hts_md5_final(b->contig.md5, b->md5);
+  hts_md5_destroy(b->md5);
+  free(b->n_runs);
+  free(b->mask_runs);
+}
+
+static int compare_order(const void *a, const void *b)
+{
+  return strcmp(((const rc_order_t *) a)->name, ((const rc_order_t *) b)->name);
+}
+
+/*
+ * rc_build
+ * --------
+ * Reads fasta line by line, writing each contig's packed bases as they
+ * come so only its N and soft-mask runs are held, then writes the names,
+ * contig table and name order and fills in the header.
+ *
+ * OUTPUT: number of contigs written (exits on error)
+ *
+ */
+uint32_t rc_build(const char *fasta, const char *fn)
+{
+  rc_writer_t w = { NULL, fn, 0 };
+  rc_header_t header;
+  rc_contig_t *contigs = NULL;
+  char **names = NULL;
+  size_t size = 0;
+  uint32_t count = 0, i;
+  rc_building_t b;
+  bool in_contig = false;
+  kstring_t line = { 0, 0, NULL };
+  kstring_t upper = { 0, 0, NULL };
+
+  init_tables();
+  htsFile *in = hts_open(fasta, "r", NULL);
+  if (in == NULL)
+    errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not open reference [%s]"), fasta);
+  w.fp = fopen(fn, "wb");
+  if (w.fp == NULL)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("could not open output file [%s]"), fn);
+
+  memset(&header, 0, sizeof(header));
+  rc_write(&w, &header, sizeof(header));
+
+  while (hts_getline(in, KS_SEP_LINE, &line) >= 0)
+    {
+      if (line.l > 0 && line.s[0] == '>')
+	{
+	  if (in_contig)
+	    {
+	      finish_contig(&w, &b);
+	      contigs[count - 1] = b.contig;
+	    }
+	  if (count == size)
+	    {
+	      contigs = x2nrealloc(contigs, &size, sizeof(rc_contig_t));
+	      names = xnrealloc(names, size, sizeof(char *));
+	    }
+	  memset(&b, 0, sizeof(b));
+	  b.name = xstrndup(line.s + 1, strcspn(line.s + 1, " \t\r"));
+	  b.contig.seq_offset = w.offset;
+	  b.md5 = hts_md5_init();
+	  if (b.md5 == NULL)
+	    errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not start MD5 for [%s]"), b.name);
+	  names[count++] = b.name;
+	  in_contig = true;
+	}
+      else if (in_contig)
+	add_bases(&w, &b, line.s, line.l, &upper);
+    }
+  if (in_contig)
+    {
+      finish_contig(&w, &b);
+      contigs[count - 1] = b.contig;
+    }
+  hts_close(in);
+  if (count == 0)
+    errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("no contigs in [%s]"), fasta);
+
+  for (i = 0; i < count; i++)
+    {
+      contigs[i].name_offset = w.offset;
+      rc_write(&w, names[i], strlen(names[i]) + 1);
+    }
+  rc_align(&w);
+
+  rc_order_t *order = xnmalloc(count, sizeof(rc_order_t));
+  uint32_t *order_index = xnmalloc(count, sizeof(uint32_t));
+  for (i = 0; i < count; i++)
+    {
+      order[i].name = names[i];
+      order[i].index = i;
+    }
+  qsort(order, count, sizeof(rc_order_t), compare_order);
+  for (i = 0; i < count; i++)
+    {
+      if (i > 0 && strcmp(order[i - 1].name, order[i].name) == 0)
+	errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("contig [%s] appears twice in [%s]"), order[i].name, fasta);
+      order_index[i] = order[i].index;
+    }
+
+  memcpy(header.magic, RC_MAGIC, RC_MAGIC_LENGTH);
+  header.byte_order = RC_BYTE_ORDER;
+  header.n_contigs = count;
+  header.contigs_offset = w.offset;
+  rc_write(&w, contigs, count * sizeof(rc_contig_t));
+  header.order_offset = w.offset;
+  rc_write(&w, order_index, count * sizeof(uint32_t));
+  rc_align(&w);
+  header.file_size = w.offset;
+
+  if (fseek(w.fp, 0, SEEK_SET) != 0)
+    err(BRINDLEY_EXIT_ERR_WRITE, gettext("could not write to [%s]"), fn);
+  rc_write(&w, &header, sizeof(header));
+  if (fclose(w.fp) != 0)
+    err(BRINDLEY_EXIT_ERR_WRITE, gettext("could not close [%s]"), fn);
+
+  for (i = 0; i < count; i++)
+    free(names[i]);
+  free(names);
+  free(contigs);
+  free(order);
+  free(order_index);
+  free(line.s);
+  free(upper.s);
+  return count;
+}
+
+/*
+ * brindley_refcache
+ * -----------------
+ *
+ * OUTPUT: exit code
+ *
+ */
+int brindley_refcache(int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      fprintf(stderr, gettext("Usage: %s refcache <reference(fa|fa.gz)> <output>\n"), program_name);
+      return BRINDLEY_EXIT_ERR_ARGS;
+    }
+
+  uint32_t count = rc_build(argv[1], argv[2]);
+  blog(1, gettext("wrote %u contigs from [%s] to [%s]"), count, argv[1], argv[2]);
+  return BRINDLEY_EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+/*
+ * brindley_refcache.h BridgeBuilder reference cache.
+ *
+ * Copyright (c) 2013 Genome Research Ltd.
+ *
+ * This file is part of BridgeBuilder.
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Writing reference caches.  The format and the reader, which brunel builds
+ * in too, are in common/bb_refcache.h.
+ */
+#ifndef BRINDLEY_REFCACHE_H
+#define BRINDLEY_REFCACHE_H
+
+#include <stdint.h>
+
+#include "bb_refcache.h"
+
+/* write a cache of fasta (plain or gzipped) to fn, returning the number of contigs */
+uint32_t rc_build(const char *fasta, const char *fn);
+
+/* entry point for "brindley refcache" (argv[0] is "refcache") */
+int brindley_refcache(int argc, char **argv);
+
+#endif
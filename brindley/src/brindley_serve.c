@@ -0,0 +1,535 @@
+/*
+ * brindley_serve.c Brindley liftover service.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Keeps a liftover map loaded and answers batched lookups over a Unix
+ * domain socket, so that tools lifting a handful of positions do not each
+ * pay for bc_read_file.  A fixed pool of threads accept and serve
+ * connections; the map is only read once loaded so they share it freely.
+ * A client that sends nothing for the idle timeout is dropped, so idle
+ * clients cannot hold on to every thread.
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+#include "progname.h"
+#include "xalloc.h"
+
+/* internationalisation */
+#include "gettext.h"
+
+/* brindley includes */
+#include "brindley.h"
+#include "brindley_log.h"
+#include "brindley_coordmap.h"
+#include "brindley_serve.h"
+
+#define SERVE_DEFAULT_THREADS 4
+#define SERVE_DEFAULT_IDLE_TIMEOUT 60
+/* pause before accepting again when out of descriptors or buffers */
+#define SERVE_ACCEPT_RETRY_MS 100
+#define QUERY_BATCH 4096
+#define LINE_LENGTH 256
+
+typedef struct {
+  CoordMap *map;
+  int listen_fd;
+  int idle_timeout;		/* seconds, 0 to wait for ever */
+} serve_ctx_t;
+
+static bool read_exact(FILE *fp, void *buf, size_t len)
+{
+  return len == 0 || fread(buf, len, 1, fp) == 1;
+}
+
+static bool write_exact(FILE *fp, const void *buf, size_t len)
+{
+  return len == 0 || fwrite(buf, len, 1, fp) == 1;
+}
+
+/*
+ * serve_connection
+ * ----------------
+ *
+ * Answers requests on one client connection until the client closes it,
+ * sends something malformed or goes quiet for longer than the socket's
+ * receive timeout.
+ *
+ */
+static void serve_connection(CoordMap *map, int fd)
+{
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+  Range *from = NULL;
+  Range *to = NULL;
+  bool *reverse = NULL;
+  uint8_t *direction = NULL;
+  size_t *id_at = NULL;
+  char *ids = NULL;
+  size_t size = 0;
+  size_t ids_size = 0;
+  uint32_t count;
+  bool dropped = false;
+
+  while (in != NULL && out != NULL && read_exact(in, &count, sizeof(count)))
+    {
+      uint32_t i;
+      size_t ids_len = 0;
+      bool ok = count <= BRINDLEY_SERVE_MAX_BATCH;
+
+      if (ok && count > size)
+	{
+	  size = count;
+	  from = xnrealloc(from, size, sizeof(Range));
+	  to = xnrealloc(to, size, sizeof(Range));
+	  reverse = xnrealloc(reverse, size, sizeof(bool));
+	  direction = xnrealloc(direction, size, sizeof(uint8_t));
+	  id_at = xnrealloc(id_at, size, sizeof(size_t));
+	}
+
+      /* read the whole request, ids packed into one buffer, before lifting */
+      for (i = 0; ok && i < count; i++)
+	{
+	  int32_t range[2];
+	  uint16_t id_len;
+
+	  ok = read_exact(in, range, sizeof(range)) && read_exact(in, &direction[i], sizeof(uint8_t))
+	    && read_exact(in, &id_len, sizeof(id_len)) && direction[i] <= BC_REVERSE;
+	  if (!ok)
+	    break;
+	  if (ids_len + id_len + 1 > ids_size)
+	    {
+	      ids_size = ids_len + id_len + 1;
+	      ids = x2nrealloc(ids, &ids_size, 1);
+	    }
+	  ok = read_exact(in, ids + ids_len, id_len);
+	  ids[ids_len + id_len] = '\0';
+	  from[i].start = range[0];
+	  from[i].end = range[1];
+	  id_at[i] = ids_len;
+	  ids_len += id_len + 1;
+	}
+      for (i = 0; ok && i < count; i++)
+	from[i].id = ids + id_at[i];
+
+      /* runs of queries going the same way are lifted together */
+      for (i = 0; ok && i < count;)
+	{
+	  uint32_t j = i + 1;
+	  while (j < count && direction[j] == direction[i])
+	    j++;
+	  bc_map_ranges(map, from + i, j - i, direction[i], to + i, reverse + i);
+	  i = j;
+	}
+
+      ok = ok && write_exact(out, &count, sizeof(count));
+      for (i = 0; ok && i < count; i++)
+	{
+	  int32_t range[2] = { -1, -1 };
+	  uint8_t strand = BRINDLEY_SERVE_UNMAPPED;
+	  uint16_t to_len = 0;
+	  if (to[i].id != NULL)
+	    {
+	      range[0] = to[i].start;
+	      range[1] = to[i].end;
+	      strand = reverse[i] ? BRINDLEY_SERVE_REVERSE : BRINDLEY_SERVE_FORWARD;
+	      to_len = strlen(to[i].id);
+	    }
+	  ok = write_exact(out, range, sizeof(range)) && write_exact(out, &strand, sizeof(strand))
+	    && write_exact(out, &to_len, sizeof(to_len)) && write_exact(out, to[i].id, to_len);
+	}
+      if (!ok || fflush(out) != 0)
+	{
+	  if ((ferror(in) || ferror(out)) && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    blog(1, gettext("dropping client that timed out mid-request"));
+	  else
+	    blog(1, gettext("dropping client after malformed request or write error"));
+	  dropped = true;
+	  break;
+	}
+    }
+  if (!dropped && in != NULL && ferror(in) && (errno == EAGAIN || errno == EWOULDBLOCK))
+    blog(2, gettext("dropping idle client"));
+
+  free(from);
+  free(to);
+  free(reverse);
+  free(direction);
+  free(id_at);
+  free(ids);
+  if (out != NULL)
+    fclose(out);
+  if (in != NULL)
+    fclose(in);
+  else
+    close(fd);
+}
+
+/*
+ * serve_worker
+ * ------------
+ *
+ * Accepts and serves connections one at a time.  Running out of file
+ * descriptors or buffers is logged once per spell and waited out rather
+ * than stopping the server; other accept errors are fatal.
+ *
+ */
+static void *serve_worker(void *arg)
+{
+  serve_ctx_t *ctx = arg;
+  struct timeval timeout = { ctx->idle_timeout, 0 };
+  struct timespec retry = { 0, SERVE_ACCEPT_RETRY_MS * 1000000L };
+  bool short_of_resources = false;
+
+  for (;;)
+    {
+      int fd = accept(ctx->listen_fd, NULL, NULL);
+      if (fd < 0)
+	{
+	  if (errno == EINTR || errno == ECONNABORTED)
+	    continue;
+	  if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+	    {
+	      if (!short_of_resources)
+		warn(gettext("accept failed, retrying"));
+	      short_of_resources = true;
+	      nanosleep(&retry, NULL);
+	      continue;
+	    }
+	  err(BRINDLEY_EXIT_ERR_IN_FILES, gettext("accept failed"));
+	}
+      short_of_resources = false;
+      /* the timeouts also cover a client that stops reading its results */
+      if (ctx->idle_timeout > 0
+	  && (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+	      || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0))
+	{
+	  warn(gettext("could not set a timeout on a client connection"));
+	  close(fd);
+	  continue;
+	}
+      serve_connection(ctx->map, fd);
+    }
+  return NULL;
+}
+
+static int socket_address(const char *path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    errx(BRINDLEY_EXIT_ERR_ARGS, gettext("socket path too long [%s]"), path);
+  strcpy(addr->sun_path, path);
+  return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+/*
+ * remove_stale_socket
+ * -------------------
+ *
+ * Removes the socket left at path by a server that did not shut down
+ * cleanly, which nothing accepts connections on any more.  Exits if a
+ * server is still listening there; anything else at path is left for
+ * bind to report.
+ *
+ */
+static void remove_stale_socket(const char *path, const struct sockaddr_un *addr)
+{
+  struct stat st;
+  int fd;
+
+  if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+    return;
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return;
+  if (connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) == 0)
+    errx(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("a server is already listening on [%s]"), path);
+  if (errno == ECONNREFUSED)
+    {
+      blog(1, gettext("removing stale socket [%s]"), path);
+      unlink(path);
+    }
+  close(fd);
+}
+
+static void serve_usage(void)
+{
+  fprintf(stderr, gettext("Usage: %s serve [options] <liftover_map> <socket>\n"), program_name);
+  fprintf(stderr, gettext("Options: \n"));
+  fprintf(stderr, gettext("  -t, --threads N   Number of connections served at once [default: %d]\n"), SERVE_DEFAULT_THREADS);
+  fprintf(stderr, gettext("  -i, --idle-timeout S   Drop clients silent for S seconds, 0 for never [default: %d]\n"), SERVE_DEFAULT_IDLE_TIMEOUT);
+  fprintf(stderr, gettext("  -v, --verbose     Increase verbosity\n"));
+}
+
+/*
+ * brindley_serve
+ * --------------
+ *
+ * Loads the map, listens on the socket and serves clients from a pool of
+ * threads until interrupted, when the socket is removed again.
+ *
+ * OUTPUT: exit code
+ *
+ */
+int brindley_serve(int argc, char **argv)
+{
+  static struct option serve_options[] =
+    {
+      {"threads",	required_argument,	0,	't'},
+      {"idle-timeout",	required_argument,	0,	'i'},
+      {"verbose",	no_argument,		0,	'v'},
+      {"help",		no_argument,		0,	'h'},
+      {0, 0, 0, 0}
+    };
+  int threads = SERVE_DEFAULT_THREADS;
+  int idle_timeout = SERVE_DEFAULT_IDLE_TIMEOUT;
+  struct sockaddr_un addr;
+  serve_ctx_t ctx;
+  sigset_t stop;
+  int sig;
+  int c;
+  int i;
+
+  while ((c = getopt_long(argc, argv, "t:i:vh", serve_options, NULL)) >= 0)
+    {
+      switch (c)
+	{
+	case 't':
+	  threads = brindley_int_arg('t', optarg, 1);
+	  break;
+	case 'i':
+	  idle_timeout = brindley_int_arg('i', optarg, 0);
+	  break;
+	case 'v':
+	  verbosity++;
+	  break;
+	case 'h':
+	  serve_usage();
+	  return BRINDLEY_EXIT_SUCCESS;
+	default:
+	  serve_usage();
+	  return BRINDLEY_EXIT_ERR_ARGS;
+	}
+    }
+  if (argc - optind != 2)
+    {
+      serve_usage();
+      return BRINDLEY_EXIT_ERR_ARGS;
+    }
+  const char *map_file = argv[optind];
+  const char *socket_path = argv[optind + 1];
+
+  blog(1, gettext("loading map [%s]"), map_file);
+  ctx.map = bc_read_file(map_file);
+  ctx.idle_timeout = idle_timeout;
+
+  ctx.listen_fd = socket_address(socket_path, &addr);
+  if (ctx.listen_fd >= 0)
+    remove_stale_socket(socket_path, &addr);
+  if (ctx.listen_fd < 0
+      || bind(ctx.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+      || listen(ctx.listen_fd, 128) != 0)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("could not listen on socket [%s]"), socket_path);
+
+  /* workers inherit the blocked signals, leaving them to sigwait below */
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  sigaddset(&stop, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (i = 0; i < threads; i++)
+    {
+      pthread_t tid;
+      if (pthread_create(&tid, NULL, serve_worker, &ctx) != 0)
+	errx(BRINDLEY_EXIT_ERR_ARGS, gettext("could not start worker thread"));
+      pthread_detach(tid);
+    }
+  blog(1, gettext("serving [%s] on [%s] with %d threads"), map_file, socket_path, threads);
+
+  sigwait(&stop, &sig);
+  blog(1, gettext("stopping on signal %d"), sig);
+  close(ctx.listen_fd);
+  unlink(socket_path);
+  return BRINDLEY_EXIT_SUCCESS;
+}
+
+/*
+ * query_batch
+ * -----------
+ *
+ * Sends n queries and prints their results in the same form as the
+ * default brindley mode.
+ *
+ */
+static void query_batch(FILE *sock_in, FILE *sock_out, Range *queries, uint32_t n, uint8_t direction, FILE *out)
+{
+  char id[UINT16_MAX + 1];
+  uint32_t i;
+
+  bool ok = write_exact(sock_out, &n, sizeof(n));
+  for (i = 0; ok && i < n; i++)
+    {
+      int32_t range[2] = { queries[i].start, queries[i].end };
+      uint16_t id_len = strlen(queries[i].id);
+      ok = write_exact(sock_out, range, sizeof(range)) && write_exact(sock_out, &direction, sizeof(direction))
+	&& write_exact(sock_out, &id_len, sizeof(id_len))
+	&& write_exact(sock_out, queries[i].id, id_len);
+    }
+  if (!ok || fflush(sock_out) != 0)
+    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not send request to server"));
+
+  uint32_t count;
+  if (!read_exact(sock_in, &count, sizeof(count)) || count != n)
+    errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("bad response from server"));
+  for (i = 0; i < n; i++)
+    {
+      int32_t range[2];
+      uint8_t strand;
+      uint16_t id_len;
+      if (!read_exact(sock_in, range, sizeof(range)) || !read_exact(sock_in, &strand, sizeof(strand))
+	  || !read_exact(sock_in, &id_len, sizeof(id_len)) || !read_exact(sock_in, id, id_len))
+	errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("truncated response from server"));
+      id[id_len] = '\0';
+      if (strand == BRINDLEY_SERVE_UNMAPPED)
+	fprintf(out, ".\t.\n");
+      else
+	fprintf(out, "%s\t%d\n", id, range[0] + 1);
+    }
+}
+
+/*
+ * brindley_query
+ * --------------
+ *
+ * Command-line client: reads chr\tpos lines like the default mode, sends
+ * them to a running server in batches and prints the lifted positions.
+ * -R lifts them back from the map's target to its source.
+ *
+ * OUTPUT: exit code
+ *
+ */
+static void query_usage(void)
+{
+  fprintf(stderr, gettext("Usage: %s query [options] <socket> [input] [output]\n"), program_name);
+  fprintf(stderr, gettext("Options: \n"));
+  fprintf(stderr, gettext("  -R, --reverse     Lift from the map's target assembly back to its source\n"));
+}
+
+int brindley_query(int argc, char **argv)
+{
+  static struct option query_options[] =
+    {
+      {"reverse",	no_argument,		0,	'R'},
+      {"help",		no_argument,		0,	'h'},
+      {0, 0, 0, 0}
+    };
+  struct sockaddr_un addr;
+  Range *queries;
+  uint32_t n = 0;
+  char line[LINE_LENGTH];
+  uint8_t direction = BC_FORWARD;
+  uint32_t i;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "Rh", query_options, NULL)) >= 0)
+    {
+      switch (c)
+	{
+	case 'R':
+	  direction = BC_REVERSE;
+	  break;
+	case 'h':
+	  query_usage();
+	  return BRINDLEY_EXIT_SUCCESS;
+	default:
+	  query_usage();
+	  return BRINDLEY_EXIT_ERR_ARGS;
+	}
+    }
+  if (argc - optind < 1 || argc - optind > 3)
+    {
+      query_usage();
+      return BRINDLEY_EXIT_ERR_ARGS;
+    }
+  const char *socket_path = argv[optind];
+  const char *in_file = argc - optind > 1 ? argv[optind + 1] : NULL;
+  const char *out_file = argc - optind > 2 ? argv[optind + 2] : NULL;
+  FILE *in = in_file != NULL ? fopen(in_file, "r") : stdin;
+  if (in == NULL)
+    err(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not open input file [%s]"), in_file);
+  FILE *out = out_file != NULL ? fopen(out_file, "w") : stdout;
+  if (out == NULL)
+    err(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("could not open output file [%s]"), out_file);
+
+  int fd = socket_address(socket_path, &addr);
+  if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    err(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not connect to [%s]"), socket_path);
+  FILE *sock_in = fdopen(fd, "r");
+  FILE *sock_out = fdopen(dup(fd), "w");
+
+  queries = xcalloc(QUERY_BATCH, sizeof(Range));
+  for (i = 0; i < QUERY_BATCH; i++)
+    queries[i].id = xmalloc(LINE_LENGTH);
+  while (fgets(line, LINE_LENGTH, in) != NULL)
+    {
+      int pos;
+      if (sscanf(line, "%255s\t%d", queries[n].id, &pos) != 2)
+	errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("unable to construct range from input [%s]"), line);
+      queries[n].start = queries[n].end = pos - 1;
+      if (++n == QUERY_BATCH)
+	{
+	  query_batch(sock_in, sock_out, queries, n, direction, out);
+	  n = 0;
+	}
+    }
+  if (n > 0)
+    query_batch(sock_in, sock_out, queries, n, direction, out);
+
+  for (i = 0; i < QUERY_BATCH; i++)
+    free(queries[i].id);
+  free(queries);
+  fclose(sock_out);
+  fclose(sock_in);
+  if (out != stdout)
+    fclose(out);
+  if (in != stdin)
+    fclose(in);
+  return BRINDLEY_EXIT_SUCCESS;
+}
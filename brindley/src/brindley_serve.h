@@ -0,0 +1,55 @@
+/*
+ * brindley_serve.h Brindley liftover service.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BRINDLEY_SERVE_H
+#define BRINDLEY_SERVE_H
+
+#include <stdint.h>
+
+/*
+ * Protocol spoken over the Unix domain socket, all integers in host byte
+ * order (client and server share a machine).  A client sends any number of
+ * requests on one connection and closes it when done; the server closes
+ * connections that stay silent for its idle timeout:
+ *
+ *   request:  uint32 count, then count queries of
+ *             int32 start, int32 end (0-based, inclusive), uint8 direction,
+ *             uint16 id_len, id
+ *   response: uint32 count, then count results of
+ *             int32 start, int32 end, uint8 strand, uint16 id_len, id
+ *
+ * direction is a bc_direction, so each query may lift either way through
+ * the map.  strand is one of the BRINDLEY_SERVE_* values below; unmapped
+ * results have no id (id_len 0).
+ */
+#define BRINDLEY_SERVE_FORWARD  0
+#define BRINDLEY_SERVE_REVERSE  1
+#define BRINDLEY_SERVE_UNMAPPED 255
+
+/* most queries accepted in a single request */
+#define BRINDLEY_SERVE_MAX_BATCH (1 << 20)
+
+/* entry point for "brindley serve" (argv[0] is "serve") */
+int brindley_serve(int argc, char **argv);
+
+/* entry point for "brindley query", the command-line client */
+int brindley_query(int argc, char **argv);
+
+#endif
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# brindley_serve_test.sh Round trip through "brindley serve" and "brindley query".
+#
+# Copyright (c) 2013 Genome Research Ltd.
+#
+# This file is part of BridgeBuilder.
+#
+# BridgeBuilder is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 3 of the License, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# Serves a small map with forward and reverse-strand blocks and checks that
+# queries both ways give what the default mode gives, that a silent client
+# is dropped after the idle timeout, that a socket left by a killed server
+# is replaced, and that stopping the server removes its socket.  Run through
+# "make check"; prints one TAP line per check.
+
+BRINDLEY=${BRINDLEY:-./brindley}
+T=brindley_serve_test
+SOCKET=$T.sock
+checks=0
+failures=0
+
+check() {
+    checks=$((checks + 1))
+    if [ "$1" -eq 0 ]; then
+        echo "ok $checks - $2"
+    else
+        echo "not ok $checks - $2"
+        failures=$((failures + 1))
+    fi
+}
+
+# start_server [options]: serves $T.map on $SOCKET, waiting up to 5s for it
+start_server() {
+    "$BRINDLEY" serve "$@" $T.map $SOCKET &
+    server=$!
+    tries=0
+    while [ ! -S $SOCKET ] && [ $tries -lt 50 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    [ -S $SOCKET ]
+}
+
+stop_server() {
+    kill -TERM $server 2>/dev/null
+    wait $server 2>/dev/null
+}
+
+cleanup() {
+    kill -KILL $server $holder 2>/dev/null
+    rm -f $SOCKET $T.map $T.in $T.*.out $T.fifo
+}
+trap cleanup EXIT
+
+printf 'from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n' > $T.map
+printf 'chr1\t100\t200\tnew1\t1000\t1100\n' >> $T.map
+printf 'chr1\t200\t300\tnew1\t2300\t2200\n' >> $T.map
+printf 'chr2\t0\t50\tnew2\t500\t550\n' >> $T.map
+printf 'chr1\t101\nchr1\t150\nchr1\t201\nchr1\t250\nchr1\t300\nchr2\t25\nchr1\t5\nchr3\t10\n' > $T.in
+
+rm -f $SOCKET
+start_server -t 1 -i 1
+check $? "server listening"
+
+"$BRINDLEY" query $SOCKET $T.in $T.query.out && "$BRINDLEY" $T.in $T.map $T.direct.out \
+    && diff $T.direct.out $T.query.out
+check $? "query lifts as the default mode does"
+
+# lift the lifted positions back, leaving out those that did not lift
+grep -v '^\.' $T.direct.out > $T.lifted.out
+"$BRINDLEY" query -R $SOCKET $T.lifted.out $T.back.out && "$BRINDLEY" --reverse $T.lifted.out $T.map $T.back_direct.out \
+    && diff $T.back_direct.out $T.back.out
+check $? "query -R lifts as the default mode does"
+paste $T.in $T.direct.out | awk -F '\t' '$3 != "." { print $1 "\t" $2 }' | diff - $T.back.out
+check $? "query -R undoes the lift"
+
+# a client holding the only thread without sending anything is dropped
+mkfifo $T.fifo
+exec 3<>$T.fifo
+"$BRINDLEY" query $SOCKET $T.fifo > /dev/null 3>&- &
+holder=$!
+sleep 0.5
+timeout 10 "$BRINDLEY" query $SOCKET $T.in $T.idle.out && diff $T.direct.out $T.idle.out
+check $? "idle client dropped"
+exec 3>&-
+wait $holder
+
+# a socket left behind by a killed server does not stop a new one
+kill -KILL $server
+wait $server 2>/dev/null
+[ -S $SOCKET ]
+check $? "killed server leaves its socket"
+start_server
+check $? "server replaces stale socket"
+"$BRINDLEY" query $SOCKET $T.in $T.stale.out && diff $T.direct.out $T.stale.out
+check $? "query after replacing stale socket"
+
+"$BRINDLEY" serve $T.map $SOCKET 2>/dev/null
+[ $? -ne 0 ] && [ -S $SOCKET ]
+check $? "second server refused while the first is listening"
+
+stop_server
+[ ! -e $SOCKET ]
+check $? "socket removed on stop"
+
+echo "1..$checks"
+[ $failures -eq 0 ]
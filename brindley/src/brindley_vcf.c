@@ -0,0 +1,554 @@
+/*
+ * brindley_vcf.c Brindley VCF/BCF liftover.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Lifts a VCF or BCF through a liftover map record by record: CHROM, POS
+ * and INFO/END are rewritten, the contig lines are replaced by those of the
+ * target assembly, and records that land on reverse-strand blocks have their
+ * alleles reverse complemented (padded indels being re-anchored on the base
+ * before them in the new reference) and INFO/CIPOS and CIEND mirrored.
+ * INFO fields giving a second position, which may lie in another block or
+ * on another contig, are removed from lifted records and listed in the
+ * header instead.  Records that cannot be lifted can be
+ * written to a separate file with the original header.  Output is in input
+ * order, so anything lifted across rearrangements needs sorting afterwards.
+ */
+
+#include "config.h"
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* gnulib headers */
+#include <stdbool.h>
+#include "progname.h"
+#include "xalloc.h"
+
+/* internationalisation */
+#include "gettext.h"
+
+/* htslib */
+#include <htslib/hts.h>
+#include <htslib/kstring.h>
+#include <htslib/vcf.h>
+#include <htslib/faidx.h>
+
+/* brindley includes */
+#include "brindley.h"
+#include "brindley_log.h"
+#include "brindley_coordmap.h"
+#include "brindley_refcache.h"
+#include "brindley_vcf.h"
+
+typedef struct {
+  CoordMap *map;
+  bc_direction direction;
+  faidx_t *fai;
+  refcache_t *cache;
+  bcf_hdr_t *in_hdr;
+  bcf_hdr_t *out_hdr;
+  kstring_t alleles;
+  int32_t *end;
+  int n_end;
+  int32_t *cipos;
+  int n_cipos;
+  int32_t *ciend;
+  int n_ciend;
+  const char *dropped[4];	/* those of dropped_info in the input header */
+  int n_dropped;
+} vcf_lift_t;
+
+/*
+ * Position-valued INFO fields that lifting POS says nothing about: the
+ * second breakpoint of an SV, as CHR2 with POS2 or END2.  Left in place
+ * they would be coordinates in the old assembly, so they are dropped.
+ */
+static const char *dropped_info[] = { "CHR2", "POS2", "END2" };
+#define N_DROPPED_INFO (sizeof(dropped_info) / sizeof(dropped_info[0]))
+
+/* why a record could not be lifted, for the summary */
+enum {
+  LIFT_OK = 0,
+  LIFT_NO_BLOCK,
+  LIFT_NO_CONTIG,
+  LIFT_SYMBOLIC,
+  LIFT_NO_REFERENCE,
+  LIFT_REASONS
+};
+
+static const char *lift_reason[LIFT_REASONS] = {
+  "lifted",
+  "not contained in a single block",
+  "target contig not in header",
+  "symbolic allele on reverse strand",
+  "reverse-strand indel without --reference"
+};
+
+static char complement(char c)
+{
+  switch (c)
+    {
+    case 'A': return 'T';
+    case 'C': return 'G';
+    case 'G': return 'C';
+    case 'T': return 'A';
+    case 'a': return 't';
+    case 'c': return 'g';
+    case 'g': return 'c';
+    case 't': return 'a';
+    default: return c;
+    }
+}
+
+/* append the reverse complement of the first len bases of s */
+static void kput_revcomp(const char *s, size_t len, kstring_t *str)
+{
+  size_t i;
+
+  for (i = len; i > 0; i--)
+    kputc(complement(s[i - 1]), str);
+}
+
+static bool allele_symbolic(const char *a)
+{
+  return a[0] == '<' || a[0] == '*' || a[0] == '.' || strchr(a, '[') != NULL || strchr(a, ']') != NULL;
+}
+
+/* the base at pos of target in the new reference, from a cache or FASTA */
+static bool reference_base(vcf_lift_t *ctx, const char *target, int pos, char *base)
+{
+  if (ctx->cache != NULL)
+    {
+      int64_t id = rc_find(ctx->cache, target);
+      return id >= 0 && rc_fetch(ctx->cache, id, pos, pos + 1, true, base) == 1;
+    }
+  if (ctx->fai == NULL)
+    return false;
+
+  int len = 0;
+  char *seq = faidx_fetch_seq(ctx->fai, target, pos, pos, &len);
+  bool ok = seq != NULL && len == 1;
+  if (ok)
+    *base = seq[0];
+  free(seq);
+  return ok;
+}
+
+/*
+ * reverse_alleles
+ * ---------------
+ *
+ * Builds the comma-separated alleles of rec as seen from the reverse
+ * strand into ctx->alleles.  Alleles of equal length are simply reverse
+ * complemented.  Indels whose alleles share a leading padding base lose
+ * it (it is now at their end) and gain the base before the lifted
+ * position, taken from the new reference, so *pos moves back by one.
+ *
+ * OUTPUT: LIFT_OK or the reason the alleles cannot be reversed
+ *
+ */
+static int reverse_alleles(vcf_lift_t *ctx, bcf1_t *rec, const char *target, int *pos)
+{
+  char **allele = rec->d.allele;
+  size_t ref_len = strlen(allele[0]);
+  bool same_length = true;
+  bool padded = true;
+  int i;
+
+  for (i = 0; i < rec->n_allele; i++)
+    {
+      if (allele_symbolic(allele[i]))
+	return LIFT_SYMBOLIC;
+      if (strlen(allele[i]) != ref_len)
+	same_length = false;
+      if (allele[i][0] != allele[0][0])
+	padded = false;
+    }
+
+  ctx->alleles.l = 0;
+  if (same_length || !padded)
+    {
+      for (i = 0; i < rec->n_allele; i++)
+	{
+	  if (i > 0)
+	    kputc(',', &ctx->alleles);
+	  kput_revcomp(allele[i], strlen(allele[i]), &ctx->alleles);
+	}
+      return LIFT_OK;
+    }
+
+  char pad;
+  if (*pos == 0 || !reference_base(ctx, target, *pos - 1, &pad))
+    return LIFT_NO_REFERENCE;
+  for (i = 0; i < rec->n_allele; i++)
+    {
+      if (i > 0)
+	kputc(',', &ctx->alleles);
+      kputc(pad, &ctx->alleles);
+      kput_revcomp(allele[i] + 1, strlen(allele[i]) - 1, &ctx->alleles);
+    }
+  (*pos)--;
+  return LIFT_OK;
+}
+
+/*
+ * reverse_intervals
+ * -----------------
+ *
+ * CIPOS and CIEND are confidence intervals around POS and END.  On the
+ * reverse strand the old END becomes the new POS and offsets change sign,
+ * so CIPOS takes the mirror image of CIEND (or of CIPOS itself if there is
+ * no CIEND, as for a single position) and CIEND that of CIPOS.
+ *
+ */
+static void reverse_intervals(vcf_lift_t *ctx, bcf1_t *rec)
+{
+  bool has_pos = bcf_get_info_int32(ctx->in_hdr, rec, "CIPOS", &ctx->cipos, &ctx->n_cipos) == 2;
+  bool has_end = bcf_get_info_int32(ctx->in_hdr, rec, "CIEND", &ctx->ciend, &ctx->n_ciend) == 2;
+  int32_t mirror[2];
+
+  if (has_end)
+    {
+      mirror[0] = -ctx->ciend[1];
+      mirror[1] = -ctx->ciend[0];
+      bcf_update_info_int32(ctx->out_hdr, rec, "CIPOS", mirror, 2);
+      if (has_pos)
+	{
+	  mirror[0] = -ctx->cipos[1];
+	  mirror[1] = -ctx->cipos[0];
+	  bcf_update_info_int32(ctx->out_hdr, rec, "CIEND", mirror, 2);
+	}
+    }
+  else if (has_pos)
+    {
+      mirror[0] = -ctx->cipos[1];
+      mirror[1] = -ctx->cipos[0];
+      bcf_update_info_int32(ctx->out_hdr, rec, "CIPOS", mirror, 2);
+    }
+}
+
+/*
+ * lift_record
+ * -----------
+ *
+ * Lifts rec in place from the input to the output header.  The whole
+ * reference span must fall in one block.  rec is only modified if the
+ * lift succeeds.
+ *
+ * OUTPUT: LIFT_OK or the reason it could not be lifted
+ *
+ */
+static int lift_record(vcf_lift_t *ctx, bcf1_t *rec)
+{
+  bool reverse = false;
+  int ret = LIFT_OK;
+
+  bcf_unpack(rec, BCF_UN_STR | BCF_UN_INFO);
+
+  Range from;
+  from.start = rec->pos;
+  from.end = rec->pos + (rec->rlen > 0 ? rec->rlen : 1) - 1;
+  from.id = (char *) bcf_seqname(ctx->in_hdr, rec);
+  Range *to = bc_map_range_dir(ctx->map, &from, ctx->direction, &reverse);
+  if (to == NULL)
+    return LIFT_NO_BLOCK;
+
+  int rid = bcf_hdr_name2id(ctx->out_hdr, to->id);
+  int pos = to->start;
+  if (rid < 0)
+    ret = LIFT_NO_CONTIG;
+  else if (reverse)
+    ret = reverse_alleles(ctx, rec, to->id, &pos);
+  free(to);
+  if (ret != LIFT_OK)
+    return ret;
+
+  int32_t rlen = rec->rlen;
+  if (reverse)
+    bcf_update_alleles_str(ctx->out_hdr, rec, ctx->alleles.s);
+  rec->rid = rid;
+  rec->pos = pos;
+
+  /* END keeps the record's length, blocks being ungapped */
+  if (bcf_get_info_int32(ctx->in_hdr, rec, "END", &ctx->end, &ctx->n_end) == 1)
+    {
+      int32_t end = pos + rlen;
+      bcf_update_info_int32(ctx->out_hdr, rec, "END", &end, 1);
+    }
+  if (reverse)
+    reverse_intervals(ctx, rec);
+  for (int i = 0; i < ctx->n_dropped; i++)
+    {
+      if (bcf_get_info(ctx->in_hdr, rec, ctx->dropped[i]) != NULL)
+	{
+	  int id = bcf_hdr_id2int(ctx->in_hdr, BCF_DT_ID, ctx->dropped[i]);
+	  bcf_update_info(ctx->out_hdr, rec, ctx->dropped[i], NULL, 0, bcf_hdr_id2type(ctx->in_hdr, BCF_HL_INFO, id));
+	}
+    }
+  return LIFT_OK;
+}
+
+/*
+ * target_header
+ * -------------
+ *
+ * Copies the input header with its contig lines replaced by the target
+ * assembly's: those of the reference index if there is one (with lengths),
+ * otherwise every contig the map lifts onto.  Notes which INFO fields of
+ * dropped_info the input defines, and so will be dropped, in ctx and in
+ * the brindleyLiftover line.
+ *
+ */
+static bcf_hdr_t *target_header(vcf_lift_t *ctx, const char *map_file)
+{
+  bcf_hdr_t *hdr = bcf_hdr_dup(ctx->in_hdr);
+  kstring_t line = { 0, 0, NULL };
+  size_t d;
+  int i;
+
+  for (d = 0; d < N_DROPPED_INFO; d++)
+    {
+      int id = bcf_hdr_id2int(ctx->in_hdr, BCF_DT_ID, dropped_info[d]);
+      if (bcf_hdr_idinfo_exists(ctx->in_hdr, BCF_HL_INFO, id))
+	ctx->dropped[ctx->n_dropped++] = dropped_info[d];
+    }
+
+  bcf_hdr_remove(hdr, BCF_HL_CTG, NULL);
+  if (ctx->cache != NULL)
+    {
+      uint32_t n = rc_ncontigs(ctx->cache);
+      uint32_t j;
+      for (j = 0; j < n; j++)
+	{
+	  line.l = 0;
+	  ksprintf(&line, "##contig=<ID=%s,length=%llu>", rc_name(ctx->cache, j),
+		   (unsigned long long) rc_length(ctx->cache, j));
+	  bcf_hdr_append(hdr, line.s);
+	}
+    }
+  else if (ctx->fai != NULL)
+    {
+      for (i = 0; i < faidx_nseq(ctx->fai); i++)
+	{
+	  const char *name = faidx_iseq(ctx->fai, i);
+	  line.l = 0;
+	  ksprintf(&line, "##contig=<ID=%s,length=%d>", name, faidx_seq_len(ctx->fai, name));
+	  bcf_hdr_append(hdr, line.s);
+	}
+    }
+  else
+    {
+      size_t n;
+      char **ids = bc_target_ids(ctx->map, ctx->direction, &n);
+      size_t j;
+      for (j = 0; j < n; j++)
+	{
+	  line.l = 0;
+	  ksprintf(&line, "##contig=<ID=%s>", ids[j]);
+	  bcf_hdr_append(hdr, line.s);
+	}
+      free(ids);
+    }
+  line.l = 0;
+  ksprintf(&line, "##brindleyLiftover=<Map=\"%s\",Direction=%s", map_file,
+	   ctx->direction == BC_REVERSE ? "reverse" : "forward");
+  for (i = 0; i < ctx->n_dropped; i++)
+    ksprintf(&line, "%s%s", i == 0 ? ",DroppedInfo=\"" : ",", ctx->dropped[i]);
+  kputs(ctx->n_dropped > 0 ? "\">" : ">", &line);
+  bcf_hdr_append(hdr, line.s);
+  free(line.s);
+  bcf_hdr_sync(hdr);
+  return hdr;
+}
+
+/* htslib write mode from an output file name */
+static const char *vcf_mode(const char *filename)
+{
+  size_t len = strlen(filename);
+  if (len >= 4 && strcmp(filename + len - 4, ".bcf") == 0)
+    return "wb";
+  if (len >= 3 && strcmp(filename + len - 3, ".gz") == 0)
+    return "wz";
+  return "w";
+}
+
+static void vcf_usage(void)
+{
+  fprintf(stderr, gettext("Usage: %s vcf [options] <input(vcf|vcf.gz|bcf)> <liftover_map> [output]\n"), program_name);
+  fprintf(stderr, gettext("Options: \n"));
+  fprintf(stderr, gettext("  -r, --reference FILE    Indexed FASTA or reference cache of the assembly lifted onto, for its contig lines and to re-anchor reverse-strand indels\n"));
+  fprintf(stderr, gettext("  -R, --reverse           Lift from the map's target assembly back to its source\n"));
+  fprintf(stderr, gettext("  -u, --unmapped FILE     Write records that could not be lifted to FILE\n"));
+  fprintf(stderr, gettext("  -@, --threads N         Extra threads for BGZF compression and decompression [default: 0]\n"));
+  fprintf(stderr, gettext("  -v, --verbose           Increase verbosity (reports a summary at level 1)\n"));
+  fprintf(stderr, gettext("Output is VCF, bgzipped VCF (.gz) or BCF (.bcf) by file name, and stdout if not given.\n"));
+}
+
+/*
+ * brindley_vcf
+ * ------------
+ *
+ * Parses the vcf subcommand's options and lifts the input file.
+ *
+ * OUTPUT: exit code
+ *
+ */
+int brindley_vcf(int argc, char **argv)
+{
+  static struct option vcf_options[] =
+    {
+      {"reference",	required_argument,	0,	'r'},
+      {"reverse",	no_argument,		0,	'R'},
+      {"unmapped",	required_argument,	0,	'u'},
+      {"threads",	required_argument,	0,	'@'},
+      {"verbose",	no_argument,		0,	'v'},
+      {"help",		no_argument,		0,	'h'},
+      {0, 0, 0, 0}
+    };
+  char *reference = NULL;
+  char *unmapped_file = NULL;
+  int threads = 0;
+  uint64_t count[LIFT_REASONS];
+  vcf_lift_t ctx;
+  int c;
+  int i;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(count, 0, sizeof(count));
+
+  while ((c = getopt_long(argc, argv, "r:Ru:@:vh", vcf_options, NULL)) >= 0)
+    {
+      switch (c)
+	{
+	case 'r':
+	  reference = optarg;
+	  break;
+	case 'R':
+	  ctx.direction = BC_REVERSE;
+	  break;
+	case 'u':
+	  unmapped_file = optarg;
+	  break;
+	case '@':
+	  threads = brindley_int_arg('@', optarg, 0);
+	  break;
+	case 'v':
+	  verbosity++;
+	  break;
+	case 'h':
+	  vcf_usage();
+	  return BRINDLEY_EXIT_SUCCESS;
+	default:
+	  vcf_usage();
+	  return BRINDLEY_EXIT_ERR_ARGS;
+	}
+    }
+  if (argc - optind < 2 || argc - optind > 3)
+    {
+      vcf_usage();
+      return BRINDLEY_EXIT_ERR_ARGS;
+    }
+  const char *in_file = argv[optind];
+  const char *map_file = argv[optind + 1];
+  const char *out_file = argc - optind == 3 ? argv[optind + 2] : "-";
+
+  ctx.map = bc_read_file(map_file);
+  if (reference != NULL && rc_is_cache(reference))
+    {
+      ctx.cache = rc_open(reference);
+      if (ctx.cache == NULL)
+	errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not open reference cache [%s]"), reference);
+    }
+  else if (reference != NULL)
+    {
+      ctx.fai = fai_load(reference);
+      if (ctx.fai == NULL)
+	errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not load reference index for [%s]"), reference);
+    }
+
+  htsFile *in = hts_open(in_file, "r", NULL);
+  if (in == NULL)
+    errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not open input file [%s]"), in_file);
+  if (threads > 0)
+    hts_set_threads(in, threads);
+  ctx.in_hdr = bcf_hdr_read(in);
+  if (ctx.in_hdr == NULL)
+    errx(BRINDLEY_EXIT_ERR_IN_FILES, gettext("could not read VCF/BCF header from [%s]"), in_file);
+  ctx.out_hdr = target_header(&ctx, map_file);
+
+  htsFile *out = hts_open(out_file, vcf_mode(out_file), NULL);
+  if (out == NULL)
+    errx(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("could not open output file [%s]"), out_file);
+  if (threads > 0)
+    hts_set_threads(out, threads);
+  if (bcf_hdr_write(out, ctx.out_hdr) < 0)
+    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not write header to [%s]"), out_file);
+
+  htsFile *unmapped = NULL;
+  if (unmapped_file != NULL)
+    {
+      unmapped = hts_open(unmapped_file, vcf_mode(unmapped_file), NULL);
+      if (unmapped == NULL)
+	errx(BRINDLEY_EXIT_ERR_OUT_FILES, gettext("could not open unmapped output file [%s]"), unmapped_file);
+      if (bcf_hdr_write(unmapped, ctx.in_hdr) < 0)
+	errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not write header to [%s]"), unmapped_file);
+    }
+
+  bcf1_t *rec = bcf_init1();
+  while (bcf_read(in, ctx.in_hdr, rec) >= 0)
+    {
+      int ret = lift_record(&ctx, rec);
+      count[ret]++;
+      if (ret == LIFT_OK)
+	{
+	  if (bcf_write(out, ctx.out_hdr, rec) < 0)
+	    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not write to [%s]"), out_file);
+	}
+      else if (unmapped != NULL)
+	{
+	  if (bcf_write(unmapped, ctx.in_hdr, rec) < 0)
+	    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not write to [%s]"), unmapped_file);
+	}
+    }
+
+  for (i = 0; i < LIFT_REASONS; i++)
+    blog(1, gettext("%s: %llu"), lift_reason[i], (unsigned long long) count[i]);
+
+  bcf_destroy1(rec);
+  if (unmapped != NULL && hts_close(unmapped) != 0)
+    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not close [%s]"), unmapped_file);
+  if (hts_close(out) != 0)
+    errx(BRINDLEY_EXIT_ERR_WRITE, gettext("could not close [%s]"), out_file);
+  hts_close(in);
+  bcf_hdr_destroy(ctx.out_hdr);
+  bcf_hdr_destroy(ctx.in_hdr);
+  if (ctx.fai != NULL)
+    fai_destroy(ctx.fai);
+  rc_close(ctx.cache);
+  free(ctx.alleles.s);
+  free(ctx.end);
+  free(ctx.cipos);
+  free(ctx.ciend);
+  bc_free_coordmap(ctx.map);
+  return BRINDLEY_EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+/*
+ * brindley_vcf.h Brindley VCF/BCF liftover.
+ *
+ * Copyright (c) 2013 Genome Research Ltd. 
+ *
+ * This file is part of BridgeBuilder. 
+ *
+ * BridgeBuilder is free software: you can redistribute it and/or modify it under 
+ * the terms of the GNU General Public License as published by the Free Software 
+ * Foundation; either version 3 of the License, or (at your option) any later 
+ * version. 
+ * 
+ * This program is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.  
+ * 
+ * You should have received a copy of the GNU General Public License along with 
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BRINDLEY_VCF_H
+#define BRINDLEY_VCF_H
+
+/* entry point for "brindley vcf" (argv[0] is "vcf") */
+int brindley_vcf(int argc, char **argv);
+
+#endif
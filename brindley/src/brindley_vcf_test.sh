@@ -0,0 +1,123 @@
+#!/bin/sh
+#
+# brindley_vcf_test.sh Lifts a small VCF with "brindley vcf".
+#
+# Copyright (c) 2013 Genome Research Ltd.
+#
+# This file is part of BridgeBuilder.
+#
+# BridgeBuilder is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 3 of the License, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# Lifts records onto forward and reverse-strand blocks: a reverse-strand SNP
+# is complemented, padded indels there are re-anchored on the base before
+# them in the new reference (or not lifted without one), CIPOS and CIEND are
+# mirrored, CHR2 and POS2 are dropped and said to be, and records spanning a
+# block edge or with a symbolic allele on the reverse strand go to -u.  Run
+# through "make check"; prints one TAP line per check.
+
+BRINDLEY=${BRINDLEY:-./brindley}
+T=brindley_vcf_test
+checks=0
+failures=0
+
+check() {
+    checks=$((checks + 1))
+    if [ "$1" -eq 0 ]; then
+        echo "ok $checks - $2"
+    else
+        echo "not ok $checks - $2"
+        failures=$((failures + 1))
+    fi
+}
+
+# records of a VCF, without the header or sample columns
+records() {
+    grep -v '^#' "$1" | cut -f1-8
+}
+
+cleanup() {
+    rm -f $T.map $T.fa $T.fa.fai $T.vcf $T.*.vcf
+}
+trap cleanup EXIT
+
+printf 'from_sn\tfrom_start\tfrom_end\tto_sn\tto_start\tto_end\n' > $T.map
+printf 'chr1\t100\t200\tnew1\t1000\t1100\n' >> $T.map
+printf 'chr1\t200\t300\tnew1\t2300\t2200\n' >> $T.map
+printf 'chr2\t0\t50\tnew2\t500\t550\n' >> $T.map
+
+# new1 and new2 repeat ACGT, so the base at 0-based p is ACGT[p % 4]
+awk 'BEGIN {
+    split("new1 2400 new2 600", c, " ")
+    for (i = 1; i < 4; i += 2) {
+        print ">" c[i]
+        for (p = 0; p < c[i + 1]; p += 60) {
+            line = ""
+            for (q = p; q < p + 60 && q < c[i + 1]; q++) line = line substr("ACGT", q % 4 + 1, 1)
+            print line
+        }
+    }
+}' > $T.fa
+
+{
+    printf '##fileformat=VCFv4.2\n'
+    printf '##contig=<ID=chr1,length=400>\n##contig=<ID=chr2,length=100>\n'
+    printf '##INFO=<ID=END,Number=1,Type=Integer,Description="End position">\n'
+    printf '##INFO=<ID=CIPOS,Number=2,Type=Integer,Description="Confidence interval around POS">\n'
+    printf '##INFO=<ID=CIEND,Number=2,Type=Integer,Description="Confidence interval around END">\n'
+    printf '##INFO=<ID=CHR2,Number=1,Type=String,Description="Contig of the second breakpoint">\n'
+    printf '##INFO=<ID=POS2,Number=1,Type=Integer,Description="Position of the second breakpoint">\n'
+    printf '##INFO=<ID=DP,Number=1,Type=Integer,Description="Depth">\n'
+    printf '#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n'
+    printf 'chr1\t151\tfwd_snp\tA\tG\t.\t.\t.\n'
+    printf 'chr1\t251\trev_snp\tC\tT\t.\t.\t.\n'
+    printf 'chr1\t251\trev_del\tCAG\tC\t.\t.\t.\n'
+    printf 'chr1\t251\trev_ci\tCAGTA\tC\t.\t.\tEND=255;CIPOS=-1,2;CIEND=-3,4\n'
+    printf 'chr1\t261\trev_ins\tC\tCAT\t.\t.\t.\n'
+    printf 'chr1\t271\trev_sym\tC\t<DEL>\t.\t.\tEND=280\n'
+    printf 'chr1\t200\tedge\tCA\tC\t.\t.\t.\n'
+    printf 'chr2\t11\tbnd\tG\tA\t.\t.\tDP=5;CHR2=chr1;POS2=100\n'
+} > $T.vcf
+
+# rev_del and rev_ci are anchored on new1:2248 and new1:2246, so take T and
+# C; rev_ins on new1:2240, so T
+{
+    printf 'new1\t1051\tfwd_snp\tA\tG\t.\t.\t.\n'
+    printf 'new1\t2251\trev_snp\tG\tA\t.\t.\t.\n'
+    printf 'new1\t2248\trev_del\tTCT\tT\t.\t.\t.\n'
+    printf 'new1\t2246\trev_ci\tCTACT\tC\t.\t.\tEND=2250;CIPOS=-4,3;CIEND=-2,1\n'
+    printf 'new1\t2240\trev_ins\tT\tTAT\t.\t.\t.\n'
+    printf 'new2\t511\tbnd\tG\tA\t.\t.\tDP=5\n'
+} > $T.expected.vcf
+
+"$BRINDLEY" vcf -r $T.fa -u $T.unmapped.vcf $T.vcf $T.map $T.lifted.vcf
+check $? "lift with a reference"
+records $T.lifted.vcf | diff $T.expected.vcf -
+check $? "reverse strand complemented and padded indels re-anchored"
+grep -q '^##brindleyLiftover=<Map="'$T.map'",Direction=forward,DroppedInfo="CHR2,POS2">$' $T.lifted.vcf
+check $? "dropped INFO fields listed in the header"
+[ "$(records $T.unmapped.vcf | cut -f3 | tr '\n' ' ')" = "rev_sym edge " ]
+check $? "symbolic reverse-strand and block-spanning records not lifted"
+
+# without a reference the reverse-strand indels cannot be re-anchored
+"$BRINDLEY" vcf -u $T.unmapped_noref.vcf $T.vcf $T.map $T.noref.vcf
+[ "$(records $T.noref.vcf | cut -f3 | tr '\n' ' ')" = "fwd_snp rev_snp bnd " ] \
+    && [ "$(records $T.unmapped_noref.vcf | cut -f3 | tr '\n' ' ')" = "rev_del rev_ci rev_ins rev_sym edge " ]
+check $? "reverse-strand indels not lifted without a reference"
+
+# lifting back undoes the lift, but for the dropped fields
+"$BRINDLEY" vcf -R $T.noref.vcf $T.map $T.back.vcf && records $T.back.vcf > $T.back_records.vcf \
+    && records $T.vcf | grep -e fwd_snp -e rev_snp -e bnd | sed 's/;CHR2=.*//' | diff - $T.back_records.vcf
+check $? "-R undoes the lift"
+
+echo "1..$checks"
+[ $failures -eq 0 ]
@@ -0,0 +1,357 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+
+// Merge scaling benchmark.  Generates K coordinate sorted BAM inputs
+// sharing one header, with a controllable overlap between the stretches of
+// genome each covers, skew in how many records each holds and a tail of
+// unmapped reads, then times brunel merging them across a sweep of K and
+// output thread counts.  Run through "make bench".
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <htslib/kstring.h>
+#include <htslib/sam.h>
+
+#define BENCH_CONTIGS 24
+#define BENCH_CONTIG_LEN 50000000
+#define BENCH_READ_LEN 100
+
+struct bench_opts {
+    char* brunel;           // brunel binary to run
+    char* dir;              // where inputs and outputs are written
+    char* inputs;           // comma separated values of K
+    char* threads;          // comma separated output thread counts
+    uint64_t records;       // records across all inputs
+    double overlap;         // 0: inputs cover disjoint stretches, 1: all cover everything
+    double skew;            // input i holds records in proportion to 1/(i+1)^skew
+    double unmapped;        // fraction of each input that is an unmapped tail
+    bool keep;              // keep generated files
+};
+
+typedef struct bench_opts bench_opts_t;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+// xorshift64*, so runs are repeatable
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static bool write_header(const char* name) {
+    FILE* fp = fopen(name, "w");
+    if (!fp) {
+        dprintf(STDERR_FILENO, "Could not write header: %s\n", name);
+        return false;
+    }
+    fprintf(fp, "@HD\tVN:1.4\tSO:coordinate\n");
+    for (int i = 0; i < BENCH_CONTIGS; i++) fprintf(fp, "@SQ\tSN:chr%d\tLN:%d\n", i + 1, BENCH_CONTIG_LEN);
+    fprintf(fp, "@RG\tID:bench\tSM:bench\tLB:bench\n");
+    return fclose(fp) == 0;
+}
+
+// Write input `input` of k: count records, all but the unmapped tail placed
+// uniformly in its stretch of the genome (positions counted across the
+// contigs laid end to end) and sorted.
+static bool write_input(const bench_opts_t* opts, bam_hdr_t* header, const char* name, size_t input, size_t k, uint64_t count) {
+    uint64_t genome = (uint64_t)BENCH_CONTIGS * (BENCH_CONTIG_LEN - BENCH_READ_LEN);
+    uint64_t width = genome / k + (uint64_t)(opts->overlap * (double)(genome - genome / k));
+    uint64_t start = k > 1 ? input * (genome - width) / (k - 1) : 0;
+    uint64_t unmapped = (uint64_t)(opts->unmapped * (double)count);
+    uint64_t mapped = count - unmapped;
+
+    uint64_t* pos = malloc((mapped ? mapped : 1) * sizeof(uint64_t));
+    samFile* out = sam_open(name, "wb", 0);
+    bam1_t* b = bam_init1();
+    if (!pos || !out || !b || sam_hdr_write(out, header) != 0) {
+        dprintf(STDERR_FILENO, "Could not write input: %s\n", name);
+        free(pos);
+        if (out) sam_close(out);
+        if (b) bam_destroy1(b);
+        return false;
+    }
+    for (uint64_t i = 0; i < mapped; i++) pos[i] = start + rng() % width;
+    qsort(pos, mapped, sizeof(uint64_t), compare_u64);
+
+    static const char bases[] = "ACGT";
+    char seq[BENCH_READ_LEN + 1];
+    char qual[BENCH_READ_LEN + 1];
+    memset(qual, 'I', BENCH_READ_LEN);
+    seq[BENCH_READ_LEN] = qual[BENCH_READ_LEN] = '\0';
+    kstring_t line = { 0, 0, NULL };
+    bool ok = true;
+    for (uint64_t i = 0; ok && i < count; i++) {
+        uint64_t r = rng();
+        for (int j = 0; j < BENCH_READ_LEN; j++) seq[j] = bases[(r >> (2 * (j % 32))) & 3];
+        line.l = 0;
+        if (i < mapped) {
+            uint64_t contig = pos[i] / (BENCH_CONTIG_LEN - BENCH_READ_LEN);
+            uint64_t offset = pos[i] % (BENCH_CONTIG_LEN - BENCH_READ_LEN);
+            ksprintf(&line, "r%zu.%llu\t%d\tchr%llu\t%llu\t60\t%dM\t*\t0\t0\t%s\t%s\tRG:Z:bench", input,
+                     (unsigned long long)i, (r >> 63) ? BAM_FREVERSE : 0, (unsigned long long)contig + 1,
+                     (unsigned long long)offset + 1, BENCH_READ_LEN, seq, qual);
+        } else {
+            ksprintf(&line, "r%zu.%llu\t%d\t*\t0\t0\t*\t*\t0\t0\t%s\t%s\tRG:Z:bench", input,
+                     (unsigned long long)i, BAM_FUNMAP, seq, qual);
+        }
+        ok = sam_parse1(&line, header, b) >= 0 && sam_write1(out, header, b) >= 0;
+    }
+    if (!ok) dprintf(STDERR_FILENO, "Could not write input: %s\n", name);
+    free(line.s);
+    free(pos);
+    bam_destroy1(b);
+    if (sam_close(out) < 0) ok = false;
+    return ok;
+}
+
+// Pull "key\tvalue" from brunel's --stats report
+static double stats_value(const char* report, const char* key) {
+    size_t len = strlen(key);
+    const char* p = report;
+    while (p && *p) {
+        if (!strncmp(p, key, len) && p[len] == '\t') return atof(p + len + 1);
+        p = strchr(p, '\n');
+        if (p) p++;
+    }
+    return 0.0;
+}
+
+// Run brunel over the k inputs with threads output threads and print a row
+static bool run_merge(const bench_opts_t* opts, size_t k, int threads, uint64_t records) {
+    char** args = calloc(k + 8, sizeof(char*));
+    char* out_name = NULL;
+    char* err_name = NULL;
+    char thread_arg[16];
+    size_t n = 0;
+    bool ok = args != NULL;
+
+    snprintf(thread_arg, sizeof(thread_arg), "%d", threads);
+    ok = ok && asprintf(&out_name, "%s/bench_out.bam", opts->dir) > 0 && asprintf(&err_name, "%s/bench_stats.txt", opts->dir) > 0;
+    if (ok) {
+        args[n++] = opts->brunel;
+        args[n++] = "--stats";
+        args[n++] = "--threads";
+        args[n++] = thread_arg;
+        ok = asprintf(&args[n++], "%s/bench_header.sam", opts->dir) > 0;
+        for (size_t i = 0; ok && i < k; i++) ok = asprintf(&args[n++], "%s/bench_in.%zu.bam", opts->dir, i) > 0;
+        args[n++] = out_name;
+    }
+
+    double start = now();
+    pid_t pid = ok ? fork() : -1;
+    if (pid == 0) {
+        FILE* err = freopen(err_name, "w", stderr);
+        if (!err) _exit(127);
+        execvp(opts->brunel, args);
+        dprintf(STDERR_FILENO, "Could not run %s: %s\n", opts->brunel, strerror(errno));
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage ru;
+    ok = pid > 0 && wait4(pid, &status, 0, &ru) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    double wall = now() - start;
+
+    char report[8192] = "";
+    FILE* fp = err_name ? fopen(err_name, "r") : NULL;
+    if (fp) {
+        report[fread(report, 1, sizeof(report) - 1, fp)] = '\0';
+        fclose(fp);
+    }
+    if (!ok) {
+        dprintf(STDERR_FILENO, "brunel failed merging %zu inputs with %d threads:\n%s", k, threads, report);
+    } else {
+        struct stat st;
+        double out_mib = stat(out_name, &st) == 0 ? st.st_size / (1024.0 * 1024.0) : 0.0;
+        double user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        double sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        printf("%zu\t%d\t%llu\t%.3f\t%.0f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.1f\t%.1f\n", k, threads,
+               (unsigned long long)records, wall, records / wall, user, sys,
+               stats_value(report, "input_seconds"), stats_value(report, "merge_seconds"),
+               stats_value(report, "output_seconds"), ru.ru_maxrss / 1024.0, out_mib);
+        fflush(stdout);
+    }
+
+    if (!opts->keep && out_name) unlink(out_name);
+    if (err_name) unlink(err_name);
+    for (size_t i = 4; args && i < n - 1; i++) free(args[i]);
+    free(args);
+    free(out_name);
+    free(err_name);
+    return ok;
+}
+
+// Generate the k inputs, splitting the records between them by skew
+static bool generate(const bench_opts_t* opts, bam_hdr_t* header, size_t k) {
+    double total = 0.0;
+    for (size_t i = 0; i < k; i++) total += pow(i + 1, -opts->skew);
+    uint64_t left = opts->records;
+    bool ok = true;
+    for (size_t i = 0; ok && i < k; i++) {
+        uint64_t count = i + 1 == k ? left : (uint64_t)(opts->records * pow(i + 1, -opts->skew) / total);
+        if (count > left) count = left;
+        left -= count;
+        char* name = NULL;
+        ok = asprintf(&name, "%s/bench_in.%zu.bam", opts->dir, i) > 0 && write_input(opts, header, name, i, k, count);
+        free(name);
+    }
+    return ok;
+}
+
+static void remove_inputs(const bench_opts_t* opts, size_t k) {
+    for (size_t i = 0; i < k; i++) {
+        char* name = NULL;
+        if (asprintf(&name, "%s/bench_in.%zu.bam", opts->dir, i) > 0) unlink(name);
+        free(name);
+    }
+}
+
+static void usage(void) {
+    dprintf(STDERR_FILENO, "Arguments should be: brunel_bench [options]\r\n");
+    dprintf(STDERR_FILENO, "Options:\r\n");
+    dprintf(STDERR_FILENO, "  --brunel PATH          brunel binary to benchmark [./brunel]\r\n");
+    dprintf(STDERR_FILENO, "  --dir DIR              Where to write generated inputs and outputs [$TMPDIR or /tmp]\r\n");
+    dprintf(STDERR_FILENO, "  --inputs K,...         Numbers of inputs to merge [2,10,100,1000]\r\n");
+    dprintf(STDERR_FILENO, "  --threads N,...        Output compression thread counts [0,4]\r\n");
+    dprintf(STDERR_FILENO, "  --records N            Records across all inputs [2000000]\r\n");
+    dprintf(STDERR_FILENO, "  --overlap F            0 for inputs covering disjoint stretches of genome, 1 for all covering all of it [1]\r\n");
+    dprintf(STDERR_FILENO, "  --skew S               Input i holds records in proportion to 1/(i+1)^S [0]\r\n");
+    dprintf(STDERR_FILENO, "  --unmapped F           Fraction of each input that is a tail of unmapped reads [0.02]\r\n");
+    dprintf(STDERR_FILENO, "  --seed N               Random seed\r\n");
+    dprintf(STDERR_FILENO, "  --keep                 Keep the generated files\r\n");
+}
+
+int main(int argc, char** argv) {
+    const struct option lopts[] = {
+        {"brunel", required_argument, NULL, 'b'},
+        {"dir", required_argument, NULL, 'd'},
+        {"inputs", required_argument, NULL, 'k'},
+        {"threads", required_argument, NULL, '@'},
+        {"records", required_argument, NULL, 'n'},
+        {"overlap", required_argument, NULL, 'o'},
+        {"skew", required_argument, NULL, 's'},
+        {"unmapped", required_argument, NULL, 'u'},
+        {"seed", required_argument, NULL, 'S'},
+        {"keep", no_argument, NULL, 'K'},
+        {"help", no_argument, NULL, 'h'},
+        { NULL, 0, NULL, 0 }
+    };
+    bench_opts_t opts = {
+        .brunel = "./brunel",
+        .dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp",
+        .inputs = "2,10,100,1000",
+        .threads = "0,4",
+        .records = 2000000,
+        .overlap = 1.0,
+        .skew = 0.0,
+        .unmapped = 0.02,
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", lopts, NULL)) != -1) {
+        switch (c) {
+            case 'b': opts.brunel = optarg; break;
+            case 'd': opts.dir = optarg; break;
+            case 'k': opts.inputs = optarg; break;
+            case '@': opts.threads = optarg; break;
+            case 'n': opts.records = strtoull(optarg, NULL, 10); break;
+            case 'o': opts.overlap = atof(optarg); break;
+            case 's': opts.skew = atof(optarg); break;
+            case 'u': opts.unmapped = atof(optarg); break;
+            case 'S': rng_state = strtoull(optarg, NULL, 10) | 1; break;
+            case 'K': opts.keep = true; break;
+            case 'h':
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (opts.overlap < 0.0 || opts.overlap > 1.0 || opts.unmapped < 0.0 || opts.unmapped > 1.0 || opts.skew < 0.0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // brunel holds every input open at once
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    char* header_name = NULL;
+    if (asprintf(&header_name, "%s/bench_header.sam", opts.dir) < 0 || !write_header(header_name)) return EXIT_FAILURE;
+    samFile* hf = sam_open(header_name, "r", 0);
+    bam_hdr_t* header = hf ? sam_hdr_read(hf) : NULL;
+    if (hf) sam_close(hf);
+    if (!header) {
+        dprintf(STDERR_FILENO, "Could not read back header: %s\n", header_name);
+        return EXIT_FAILURE;
+    }
+
+    printf("inputs\tthreads\trecords\twall_seconds\trecords_per_second\tuser_seconds\tsystem_seconds\tinput_seconds\tmerge_seconds\toutput_seconds\tmax_rss_mib\toutput_mib\n");
+    bool ok = true;
+    char* inputs = strdup(opts.inputs);
+    char* save = NULL;
+    for (char* tok = strtok_r(inputs, ",", &save); ok && tok; tok = strtok_r(NULL, ",", &save)) {
+        size_t k = strtoul(tok, NULL, 10);
+        if (k < 1) continue;
+        ok = generate(&opts, header, k);
+        char* threads = strdup(opts.threads);
+        char* tsave = NULL;
+        for (char* t = strtok_r(threads, ",", &tsave); ok && t; t = strtok_r(NULL, ",", &tsave)) {
+            ok = run_merge(&opts, k, atoi(t), opts.records);
+        }
+        free(threads);
+        if (!opts.keep) remove_inputs(&opts, k);
+    }
+    free(inputs);
+    if (!opts.keep) unlink(header_name);
+    free(header_name);
+    bam_hdr_destroy(header);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,206 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Recalculate MD and NM tags against the output reference as records are
+// merged, in place of a separate samtools calmd pass over the final BAM.
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brunel_calmd.h"
+
+// Minimum amount of reference to fetch at a time
+#define REF_WINDOW_SIZE (1 << 20)
+
+ref_window_t* ref_window_init(const char* reference, bam_hdr_t* header) {
+    ref_window_t* ref = calloc(1, sizeof(ref_window_t));
+    if (!ref) return NULL;
+    if (rc_is_cache(reference)) {
+        ref->cache = rc_open(reference);
+        if (!ref->cache) {
+            dprintf(STDERR_FILENO, "Could not open reference cache %s (or it is not valid)\n", reference);
+            free(ref);
+            return NULL;
+        }
+    } else {
+        ref->fai = fai_load(reference);
+        if (!ref->fai) {
+            dprintf(STDERR_FILENO, "Could not load reference index for %s\n", reference);
+            free(ref);
+            return NULL;
+        }
+    }
+    ref->header = header;
+    ref->tid = -1;
+    return ref;
+}
+
+// Append [from, to) of the current contig to the window
+static bool ref_window_fetch(ref_window_t* ref, int32_t from, int32_t to) {
+    size_t need = (size_t)(to - ref->beg);
+    if (ref->cache) {
+        // Unpack straight into the window
+        if (need > ref->size) {
+            ref->size = need;
+            ref->seq = realloc(ref->seq, ref->size);
+        }
+        if (rc_fetch(ref->cache, ref->cache_id, from, to, true, ref->seq + (from - ref->beg)) != (uint64_t)(to - from)) return false;
+        ref->end = to;
+        return true;
+    }
+    int len = 0;
+    char* seq = faidx_fetch_seq(ref->fai, ref->header->target_name[ref->tid], from, to - 1, &len);
+    if (!seq || len != to - from) {
+        free(seq);
+        return false;
+    }
+    if (need > ref->size) {
+        ref->size = need;
+        ref->seq = realloc(ref->seq, ref->size);
+    }
+    memcpy(ref->seq + (from - ref->beg), seq, len);
+    ref->end = to;
+    free(seq);
+    return true;
+}
+
+// The reference holds less of the current contig than the header says.
+// Warn once and treat the contig as missing, rather than fetching again
+// for every record on it.
+static bool ref_window_short(ref_window_t* ref) {
+    dprintf(STDERR_FILENO, "Warning: contig %s is shorter in the reference than in the header, MD/NM left as they are\n", ref->header->target_name[ref->tid]);
+    ref->missing = true;
+    return false;
+}
+
+// Make sure [beg, end) of tid is in the window, sliding it forward and
+// keeping any overlap with what is already held.
+static bool ref_window_cover(ref_window_t* ref, int tid, int32_t beg, int32_t end) {
+    int32_t len = ref->header->target_len[tid];
+    if (end > len) end = len;
+    if (tid == ref->tid && ref->missing) return false;
+    if (tid == ref->tid && beg >= ref->beg && end <= ref->end) return true;
+
+    int32_t to = end;
+    if (to < beg + REF_WINDOW_SIZE) to = beg + REF_WINDOW_SIZE;
+    if (to > len) to = len;
+
+    if (tid == ref->tid && beg >= ref->beg && beg < ref->end) {
+        // Slide: drop what is behind beg and fetch only the new tail
+        memmove(ref->seq, ref->seq + (beg - ref->beg), ref->end - beg);
+        ref->beg = beg;
+        return ref_window_fetch(ref, ref->end, to) || ref_window_short(ref);
+    }
+
+    ref->tid = tid;
+    ref->beg = beg;
+    ref->end = beg;
+    if (ref->cache) {
+        ref->cache_id = rc_find(ref->cache, ref->header->target_name[tid]);
+        ref->missing = ref->cache_id < 0;
+    } else {
+        ref->missing = !faidx_has_seq(ref->fai, ref->header->target_name[tid]);
+    }
+    if (ref->missing) {
+        dprintf(STDERR_FILENO, "Warning: contig %s not in reference, MD/NM left as they are\n", ref->header->target_name[tid]);
+        return false;
+    }
+    return ref_window_fetch(ref, beg, to) || ref_window_short(ref);
+}
+
+// Replace b's MD and NM tags with ones computed against the reference.
+// Unmapped records and those on contigs missing from the reference are
+// left alone.  Returns false only if the record could not be updated.
+bool calmd_record(ref_window_t* ref, bam1_t* b) {
+    if ((b->core.flag & BAM_FUNMAP) || b->core.tid < 0 || b->core.n_cigar == 0) return true;
+    int32_t pos = b->core.pos;
+    int32_t end = bam_endpos(b);
+    if (!ref_window_cover(ref, b->core.tid, pos, end)) return true;
+
+    const uint32_t* cigar = bam_get_cigar(b);
+    const uint8_t* seq = bam_get_seq(b);
+    const char* r = ref->seq - ref->beg;  // index by reference position
+    int32_t x = pos, y = 0, nm = 0, run = 0;
+    size_t md_len = 0, md_size = 64;
+    char* md = malloc(md_size);
+
+    for (uint32_t k = 0; k < b->core.n_cigar; k++) {
+        int op = bam_cigar_op(cigar[k]);
+        int32_t l = bam_cigar_oplen(cigar[k]);
+        // worst case this op adds a number and a base per position
+        if (md_len + 16 * (size_t)l + 32 > md_size) {
+            md_size = md_len + 16 * (size_t)l + 32;
+            md = realloc(md, md_size);
+        }
+        if (op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF) {
+            for (int32_t j = 0; j < l && x + j < ref->end; j++) {
+                int c1 = bam_seqi(seq, y + j);
+                int c2 = seq_nt16_table[(uint8_t)r[x + j]];
+                if ((c1 == c2 && c1 != 15) || c1 == 0) {
+                    run++;
+                } else {
+                    md_len += sprintf(md + md_len, "%d%c", run, toupper((unsigned char)r[x + j]));
+                    run = 0;
+                    nm++;
+                }
+            }
+            x += l;
+            y += l;
+        } else if (op == BAM_CDEL) {
+            md_len += sprintf(md + md_len, "%d^", run);
+            for (int32_t j = 0; j < l && x + j < ref->end; j++) {
+                md[md_len++] = toupper((unsigned char)r[x + j]);
+            }
+            run = 0;
+            x += l;
+            nm += l;
+        } else if (op == BAM_CINS) {
+            y += l;
+            nm += l;
+        } else if (op == BAM_CSOFT_CLIP) {
+            y += l;
+        } else if (op == BAM_CREF_SKIP) {
+            x += l;
+        }
+    }
+    md_len += sprintf(md + md_len, "%d", run);
+
+    uint8_t* old = bam_aux_get(b, "MD");
+    if (!old || strcmp(bam_aux2Z(old), md) != 0) {
+        if (old) bam_aux_del(b, old);
+        bam_aux_append(b, "MD", 'Z', md_len + 1, (uint8_t*)md);
+    }
+    old = bam_aux_get(b, "NM");
+    if (!old || bam_aux2i(old) != nm) {
+        if (old) bam_aux_del(b, old);
+        bam_aux_append(b, "NM", 'i', 4, (uint8_t*)&nm);
+    }
+    free(md);
+    return true;
+}
+
+void ref_window_free(ref_window_t* ref) {
+    if (!ref) return;
+    if (ref->fai) fai_destroy(ref->fai);
+    rc_close(ref->cache);
+    free(ref->seq);
+    free(ref);
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_CALMD_H
+#define BRUNEL_CALMD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+#include <htslib/faidx.h>
+#include "bb_refcache.h"
+
+// A window of reference sequence that slides forward along each contig as
+// coordinate sorted records go past, so the FASTA is read once, in order.
+// The reference is either a faidx indexed FASTA or a reference cache.
+struct ref_window {
+    faidx_t* fai;
+    refcache_t* cache;
+    int64_t cache_id;   // tid's contig number in cache
+    bam_hdr_t* header;  // output header, for contig names and lengths
+    int tid;            // contig currently held, -1 for none
+    int32_t beg;        // window covers [beg, end) of tid
+    int32_t end;
+    char* seq;
+    size_t size;        // allocated size of seq
+    bool missing;       // tid is absent from the reference
+};
+
+typedef struct ref_window ref_window_t;
+
+ref_window_t* ref_window_init(const char* reference, bam_hdr_t* header);
+bool calmd_record(ref_window_t* ref, bam1_t* b);
+void ref_window_free(ref_window_t* ref);
+
+#endif
@@ -0,0 +1,108 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Read conservation checksums.  The hash is the same one binnie's
+// --checksum_out uses (FNV-1a over RG, NUL, QNAME, NUL, the READ1/READ2 bits
+// and optionally the 4-bit bases as sequenced, then a splitmix64 finaliser),
+// so a pipeline can check that brunel's inputs add up to binnie's bins and
+// that its output holds every read of its inputs exactly once.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brunel_checksum.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Complement of each 4-bit BAM base code
+static const uint8_t nt16_complement[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+
+static inline uint64_t fnv_byte(uint64_t h, uint8_t c) {
+    return (h ^ c) * FNV_PRIME;
+}
+
+static uint64_t fnv_string(uint64_t h, const char* s) {
+    while (*s) h = fnv_byte(h, (uint8_t)*s++);
+    return fnv_byte(h, 0);
+}
+
+// Count b unless it is a secondary or supplementary alignment of a read
+// already counted
+void checksum_record(read_checksum_t* ck, const bam1_t* b, bool with_seq) {
+    if (b->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) return;
+
+    uint8_t* rg = bam_aux_get(b, "RG");
+    uint64_t h = fnv_string(FNV_OFFSET, rg ? bam_aux2Z(rg) : "");
+    h = fnv_string(h, bam_get_qname(b));
+    h = fnv_byte(h, (b->core.flag & (BAM_FREAD1 | BAM_FREAD2)) >> 6);
+    if (with_seq) {
+        const uint8_t* seq = bam_get_seq(b);
+        int32_t len = b->core.l_qseq;
+        if (bam_is_rev(b)) {
+            for (int32_t i = len - 1; i >= 0; i--) h = fnv_byte(h, nt16_complement[bam_seqi(seq, i)]);
+        } else {
+            for (int32_t i = 0; i < len; i++) h = fnv_byte(h, bam_seqi(seq, i));
+        }
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    ck->count++;
+    ck->sum += h;
+    ck->xor ^= h;
+}
+
+static void checksum_line(FILE* fp, const char* label, const read_checksum_t* ck) {
+    fprintf(fp, "%s\t%llu\t%016llx\t%016llx\n", label, (unsigned long long)ck->count,
+            (unsigned long long)ck->sum, (unsigned long long)ck->xor);
+}
+
+// Write one line per input, their combination and the output.  Warns if the
+// output does not hold exactly the reads that were merged.
+bool checksum_write(const char* filename, char** input_name, const read_checksum_t* input, size_t input_count,
+                    const read_checksum_t* output, bool with_seq) {
+    FILE* fp = fopen(filename, "w");
+    if (!fp) {
+        dprintf(STDERR_FILENO, "Could not open checksum file: %s\n", filename);
+        return false;
+    }
+    read_checksum_t inputs = { 0, 0, 0 };
+    fprintf(fp, "#set\tcount\tsum\txor\t(RG+QNAME+segment%s)\n", with_seq ? "+SEQ" : "");
+    for (size_t i = 0; i < input_count; i++) {
+        checksum_line(fp, input_name[i], &input[i]);
+        inputs.count += input[i].count;
+        inputs.sum += input[i].sum;
+        inputs.xor ^= input[i].xor;
+    }
+    checksum_line(fp, "inputs", &inputs);
+    checksum_line(fp, "output", output);
+    bool ok = !ferror(fp);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) dprintf(STDERR_FILENO, "Could not write checksum file: %s\n", filename);
+
+    if (inputs.count != output->count || inputs.sum != output->sum || inputs.xor != output->xor) {
+        dprintf(STDERR_FILENO, "Warning: output reads (%llu) do not match the reads merged from the inputs (%llu)\n",
+                (unsigned long long)output->count, (unsigned long long)inputs.count);
+    }
+    return ok;
+}
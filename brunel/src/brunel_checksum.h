@@ -0,0 +1,38 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_CHECKSUM_H
+#define BRUNEL_CHECKSUM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+// Order independent digest of a set of reads: how many there were and the
+// sum and xor of a hash of each one's identity
+struct read_checksum {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t xor;
+};
+
+typedef struct read_checksum read_checksum_t;
+
+void checksum_record(read_checksum_t* ck, const bam1_t* b, bool with_seq);
+bool checksum_write(const char* filename, char** input_name, const read_checksum_t* input, size_t input_count,
+                    const read_checksum_t* output, bool with_seq);
+
+#endif
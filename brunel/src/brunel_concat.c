@@ -0,0 +1,196 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Fast path for inputs that are already globally ordered and do not overlap
+// (e.g. the shards of a region-scattered upstream step).  Such inputs can be
+// gathered by copying their compressed BGZF blocks straight to the output,
+// in the manner of samtools cat, without decompressing a single record.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <htslib/bgzf.h>
+
+#include "brunel_concat.h"
+
+#define CONCAT_BUF_SIZE 0x10000
+#define CONCAT_INTERVAL (1 << 14)  // span of a BAI linear index interval
+#define BGZF_EMPTY_BLOCK_SIZE 28
+
+// The BGZF end-of-file marker block, which must only appear once at the end of the output
+static const uint8_t bgzf_eof[BGZF_EMPTY_BLOCK_SIZE] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+
+// True if the index has any chunk that could hold a record overlapping
+// [beg, end) of tid.  Only the in-memory index is consulted.
+static bool window_has_chunks(const hts_idx_t* idx, int tid, int32_t beg, int32_t end) {
+    hts_itr_t* iter = sam_itr_queryi(idx, tid, beg, end);
+    bool any = iter && iter->n_off > 0;
+    hts_itr_destroy(iter);
+    return any;
+}
+
+// Highest start position of any record on tid.  Bisecting on the index
+// finds the last linear index interval with chunks that could hold a
+// record, so only the records around the end of the input's stretch of the
+// contig are decoded, wherever on the contig that stretch stops.  Should
+// that interval hold only records overlapping it from further back, the
+// window grows backwards from there.  Returns -1 if none.
+static int32_t last_pos(samFile* fp, const bam_hdr_t* header, const hts_idx_t* idx, int tid, bam1_t* b) {
+    int32_t len = header->target_len[tid];
+    if (len <= 0 || !window_has_chunks(idx, tid, 0, len)) return -1;
+
+    // Largest interval lo such that [lo * CONCAT_INTERVAL, len) has chunks
+    int32_t lo = 0, hi = (len - 1) / CONCAT_INTERVAL;
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo + 1) / 2;
+        if (window_has_chunks(idx, tid, mid * CONCAT_INTERVAL, len)) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    int32_t beg = lo * CONCAT_INTERVAL;
+    int64_t step = CONCAT_INTERVAL;
+    for (;;) {
+        int32_t found = -1;
+        hts_itr_t* iter = sam_itr_queryi(idx, tid, beg, len);
+        if (!iter) return -1;
+        while (sam_itr_next(fp, iter, b) >= 0) {
+            if (b->core.pos > found) found = b->core.pos;
+        }
+        hts_itr_destroy(iter);
+        // A record starting inside the window is always returned, but one
+        // found only by overlapping it need not be the last to start
+        if (found >= beg || beg == 0) return found;
+        beg = beg > step ? beg - step : 0;
+        step *= 2;
+    }
+}
+
+// Work out the first and last record positions of an indexed input.  The
+// first comes from simply reading the first record; the last from the index.
+// Leaves the file position undefined, so the caller must reopen the input.
+bool concat_extent(samFile* fp, bam_hdr_t* header, const hts_idx_t* idx, input_extent_t* extent) {
+    bam1_t* b = bam_init1();
+    int ret = sam_read1(fp, header, b);
+    if (ret < 0) {
+        bam_destroy1(b);
+        extent->empty = true;
+        return ret == -1;
+    }
+    extent->empty = false;
+    extent->first = CONCAT_KEY(b->core.tid, b->core.pos);
+
+    // Copied blocks are never decoded, so count their records from the
+    // index's per-contig statistics
+    extent->records = hts_idx_get_n_no_coor(idx);
+    for (int tid = 0; tid < header->n_targets; tid++) {
+        uint64_t mapped = 0, unmapped = 0;
+        if (hts_idx_get_stat(idx, tid, &mapped, &unmapped) == 0) extent->records += mapped + unmapped;
+    }
+
+    if (hts_idx_get_n_no_coor(idx) > 0) {
+        extent->last = CONCAT_KEY(-1, -1);
+        bam_destroy1(b);
+        return true;
+    }
+    for (int tid = header->n_targets - 1; tid >= 0; tid--) {
+        uint64_t mapped = 0, unmapped = 0;
+        if (hts_idx_get_stat(idx, tid, &mapped, &unmapped) < 0 || mapped + unmapped == 0) continue;
+        int32_t pos = last_pos(fp, header, idx, tid, b);
+        if (pos < 0) continue;
+        extent->last = CONCAT_KEY(tid, pos);
+        bam_destroy1(b);
+        return true;
+    }
+    bam_destroy1(b);
+    // index has no usable statistics; be conservative
+    return false;
+}
+
+// The part of fp's current block that has been decompressed but not yet
+// read, setting *data to its start.  There is no public call for this, so
+// it reads BGZF's uncompressed_block, block_offset and block_length, as
+// samtools cat does.  They have been fields of struct BGZF in bgzf.h with
+// these meanings since htslib 1.0 (checked up to 1.21); this is the only
+// place brunel touches them, so a change there needs fixing only here.
+static int bgzf_unread(BGZF* fp, const char** data) {
+    *data = (const char*)fp->uncompressed_block + fp->block_offset;
+    return fp->block_offset < fp->block_length ? fp->block_length - fp->block_offset : 0;
+}
+
+// Append every record of in (positioned just after its header) to out by
+// copying compressed blocks, dropping the input's EOF marker.
+bool concat_copy(samFile* in, const char* in_name, samFile* out, uint64_t* bytes) {
+    BGZF* bin = in->fp.bgzf;
+    BGZF* bout = out->fp.bgzf;
+    uint8_t* buf = malloc(CONCAT_BUF_SIZE);
+    uint8_t tail[BGZF_EMPTY_BLOCK_SIZE];
+    bool have_tail = false;
+    ssize_t len;
+    const char* unread;
+    int unread_len;
+
+    if (!buf) return false;
+
+    // Records sharing the header's block have already been decompressed, so
+    // recompress just those and start the raw copy on a block boundary.
+    if ((unread_len = bgzf_unread(bin, &unread)) > 0 && bgzf_write(bout, unread, unread_len) != unread_len) {
+        free(buf);
+        return false;
+    }
+    if (bgzf_flush(bout) != 0) {
+        free(buf);
+        return false;
+    }
+
+    // Hold back the last 28 bytes seen so the EOF marker can be dropped
+    while ((len = bgzf_raw_read(bin, buf, CONCAT_BUF_SIZE)) > 0) {
+        if (len < BGZF_EMPTY_BLOCK_SIZE) {
+            if (!have_tail) {
+                dprintf(STDERR_FILENO, "Truncated BGZF stream in %s\n", in_name);
+                free(buf);
+                return false;
+            }
+            bgzf_raw_write(bout, tail, len);
+            memmove(tail, tail + len, BGZF_EMPTY_BLOCK_SIZE - len);
+            memcpy(tail + BGZF_EMPTY_BLOCK_SIZE - len, buf, len);
+        } else {
+            if (have_tail) bgzf_raw_write(bout, tail, BGZF_EMPTY_BLOCK_SIZE);
+            len -= BGZF_EMPTY_BLOCK_SIZE;
+            memcpy(tail, buf + len, BGZF_EMPTY_BLOCK_SIZE);
+            bgzf_raw_write(bout, buf, len);
+            have_tail = true;
+        }
+        *bytes += len;
+    }
+    free(buf);
+    if (len < 0) {
+        dprintf(STDERR_FILENO, "Error reading %s\n", in_name);
+        return false;
+    }
+    if (have_tail && memcmp(tail, bgzf_eof, BGZF_EMPTY_BLOCK_SIZE) != 0) {
+        dprintf(STDERR_FILENO, "Warning: %s does not end with a BGZF EOF block\n", in_name);
+        bgzf_raw_write(bout, tail, BGZF_EMPTY_BLOCK_SIZE);
+        *bytes += BGZF_EMPTY_BLOCK_SIZE;
+    }
+    return true;
+}
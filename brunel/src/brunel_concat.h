@@ -0,0 +1,42 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_CONCAT_H
+#define BRUNEL_CONCAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+// Sort key for a record position: tid compared as unsigned so that
+// unmapped (-1) sorts last, as in selectRead.
+#define CONCAT_KEY(tid, pos) (((uint64_t)(uint32_t)(tid) << 32) | (uint32_t)(pos))
+
+// First and last record positions of one coordinate sorted input
+struct input_extent {
+    size_t input;
+    bool empty;
+    uint64_t first;
+    uint64_t last;
+    uint64_t records;   // record count from the index, for --stats
+};
+
+typedef struct input_extent input_extent_t;
+
+bool concat_extent(samFile* fp, bam_hdr_t* header, const hts_idx_t* idx, input_extent_t* extent);
+bool concat_copy(samFile* in, const char* in_name, samFile* out, uint64_t* bytes);
+
+#endif
@@ -0,0 +1,256 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Coverage track of the merged output, built as records are written.  For a
+// prefix P this writes
+//   P.bedGraph   mean depth of each window, adjacent equal windows joined
+//   P.cov        instead of the bedGraph with --coverage-binary: the magic
+//                "BRCOV\1", the window size and contig count (uint32), then
+//                for each contig its name length (uint32), name, length
+//                (uint32) and window count (uint32) followed by that many
+//                float32 window means, all little endian
+//   P.depth      per contig length, bases covered and mean depth
+// Depth counts aligned (M, = and X) bases of records that are mapped,
+// primary or supplementary, pass QC and are not duplicates, as samtools depth.
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brunel_coverage.h"
+
+#define COVERAGE_MAGIC "BRCOV\1"
+
+static bool write_u32(FILE* fp, uint32_t v) {
+    uint8_t buf[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, (v >> 24) & 0xff };
+    return fwrite(buf, 1, 4, fp) == 4;
+}
+
+coverage_t* coverage_init(bam_hdr_t* header, const char* prefix, int32_t window, bool binary) {
+    coverage_t* cov = calloc(1, sizeof(coverage_t));
+    if (!cov) return NULL;
+    cov->header = header;
+    cov->prefix = strdup(prefix);
+    cov->binary = binary;
+    cov->window = window;
+    cov->tid = -1;
+    cov->ring_size = 1 << 16;
+    cov->ring = calloc(cov->ring_size, sizeof(uint32_t));
+    cov->contig_sum = calloc(header->n_targets + 1, sizeof(uint64_t));
+    cov->contig_covered = calloc(header->n_targets + 1, sizeof(uint64_t));
+    if (!cov->prefix || !cov->ring || !cov->contig_sum || !cov->contig_covered) {
+        coverage_free(cov);
+        return NULL;
+    }
+
+    char* name = NULL;
+    if (asprintf(&name, "%s.%s", prefix, binary ? "cov" : "bedGraph") < 0) {
+        coverage_free(cov);
+        return NULL;
+    }
+    cov->windows = fopen(name, "w");
+    if (!cov->windows) {
+        dprintf(STDERR_FILENO, "Could not open coverage file: %s\n", name);
+        free(name);
+        coverage_free(cov);
+        return NULL;
+    }
+    free(name);
+    if (binary) {
+        fwrite(COVERAGE_MAGIC, 1, sizeof(COVERAGE_MAGIC) - 1, cov->windows);
+        write_u32(cov->windows, window);
+        write_u32(cov->windows, header->n_targets);
+    }
+    return cov;
+}
+
+static void run_flush(coverage_t* cov) {
+    if (!cov->run_open) return;
+    fprintf(cov->windows, "%s\t%lld\t%lld\t%.4g\n", cov->header->target_name[cov->tid],
+            (long long)cov->run_beg, (long long)cov->run_end, cov->run_value);
+    cov->run_open = false;
+}
+
+static void emit_window(coverage_t* cov, int64_t end) {
+    double mean = (double)cov->win_sum / (double)(end - cov->win_start);
+    if (cov->binary) {
+        float f = (float)mean;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        write_u32(cov->windows, bits);
+    } else if (cov->run_open && cov->run_value == mean) {
+        cov->run_end = end;
+    } else {
+        run_flush(cov);
+        cov->run_open = true;
+        cov->run_beg = cov->win_start;
+        cov->run_end = end;
+        cov->run_value = mean;
+    }
+    cov->win_start = end;
+    cov->win_sum = 0;
+}
+
+// Account for [beg, end) of the current contig all at one depth
+static void add_run(coverage_t* cov, int64_t beg, int64_t end, uint32_t depth) {
+    int64_t len = cov->header->target_len[cov->tid];
+    cov->contig_sum[cov->tid] += (uint64_t)depth * (end - beg);
+    if (depth) cov->contig_covered[cov->tid] += end - beg;
+    while (beg < end) {
+        int64_t win_end = cov->win_start + cov->window;
+        if (win_end > len) win_end = len;
+        int64_t stop = end < win_end ? end : win_end;
+        cov->win_sum += (uint64_t)depth * (stop - beg);
+        beg = stop;
+        if (beg == win_end) emit_window(cov, win_end);
+    }
+}
+
+// Finish every position before target, freeing their ring slots
+static void flush_to(coverage_t* cov, int64_t target) {
+    size_t mask = cov->ring_size - 1;
+    int64_t stop = target < cov->active_end ? target : cov->active_end;
+    while (cov->done < stop) {
+        int64_t beg = cov->done;
+        uint32_t depth = cov->ring[beg & mask];
+        while (cov->done < stop && cov->ring[cov->done & mask] == depth) {
+            cov->ring[cov->done & mask] = 0;
+            cov->done++;
+        }
+        add_run(cov, beg, cov->done, depth);
+    }
+    // Nothing reaches past active_end, so the rest is a run of zero depth
+    if (cov->done < target) {
+        add_run(cov, cov->done, target, 0);
+        cov->done = target;
+    }
+}
+
+static void contig_start(coverage_t* cov, int32_t tid) {
+    cov->tid = tid;
+    cov->done = 0;
+    cov->active_end = 0;
+    cov->win_start = 0;
+    cov->win_sum = 0;
+    if (cov->binary) {
+        const char* name = cov->header->target_name[tid];
+        uint32_t len = cov->header->target_len[tid];
+        write_u32(cov->windows, strlen(name));
+        fwrite(name, 1, strlen(name), cov->windows);
+        write_u32(cov->windows, len);
+        write_u32(cov->windows, (len + cov->window - 1) / cov->window);
+    }
+}
+
+static void contig_finish(coverage_t* cov) {
+    flush_to(cov, cov->header->target_len[cov->tid]);
+    run_flush(cov);
+}
+
+// Finish the current contig and any without records up to (not including) tid
+static void advance_to(coverage_t* cov, int32_t tid) {
+    if (cov->tid >= 0) contig_finish(cov);
+    for (int32_t t = cov->tid + 1; t < tid; t++) {
+        contig_start(cov, t);
+        contig_finish(cov);
+    }
+    if (tid < cov->header->n_targets) contig_start(cov, tid);
+}
+
+// Make room in the ring for positions up to end
+static bool ring_reserve(coverage_t* cov, int64_t end) {
+    if ((size_t)(end - cov->done) <= cov->ring_size) return true;
+    size_t size = cov->ring_size;
+    while (size < (size_t)(end - cov->done)) size *= 2;
+    uint32_t* ring = calloc(size, sizeof(uint32_t));
+    if (!ring) return false;
+    for (int64_t p = cov->done; p < cov->active_end; p++) {
+        ring[p & (size - 1)] = cov->ring[p & (cov->ring_size - 1)];
+    }
+    free(cov->ring);
+    cov->ring = ring;
+    cov->ring_size = size;
+    return true;
+}
+
+bool coverage_record(coverage_t* cov, const bam1_t* b) {
+    const bam1_core_t* c = &b->core;
+    if (c->flag & (BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP)) return true;
+    if (c->tid < 0 || c->tid >= cov->header->n_targets) return true;
+    if (c->tid != cov->tid) advance_to(cov, c->tid);
+
+    int64_t end = bam_endpos(b);
+    if (end > cov->header->target_len[c->tid]) end = cov->header->target_len[c->tid];
+    flush_to(cov, c->pos);
+    if (!ring_reserve(cov, end)) return false;
+
+    size_t mask = cov->ring_size - 1;
+    const uint32_t* cigar = bam_get_cigar(b);
+    int64_t x = c->pos;
+    for (uint32_t k = 0; k < c->n_cigar; k++) {
+        int op = bam_cigar_op(cigar[k]);
+        int64_t l = bam_cigar_oplen(cigar[k]);
+        if (op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF) {
+            for (int64_t p = x; p < x + l && p < end; p++) cov->ring[p & mask]++;
+        }
+        if (bam_cigar_type(op) & 2) x += l;
+    }
+    if (end > cov->active_end) cov->active_end = end;
+    return true;
+}
+
+// Finish the remaining contigs and write the per contig summary
+bool coverage_close(coverage_t* cov) {
+    advance_to(cov, cov->header->n_targets);
+    bool ok = !ferror(cov->windows);
+    if (fclose(cov->windows) != 0) ok = false;
+    cov->windows = NULL;
+
+    char* name = NULL;
+    if (asprintf(&name, "%s.depth", cov->prefix) < 0) return false;
+    FILE* fp = fopen(name, "w");
+    if (fp) {
+        fprintf(fp, "#contig\tlength\tcovered_bases\tmean_depth\n");
+        for (int32_t t = 0; t < cov->header->n_targets; t++) {
+            uint32_t len = cov->header->target_len[t];
+            fprintf(fp, "%s\t%u\t%llu\t%.4f\n", cov->header->target_name[t], len,
+                    (unsigned long long)cov->contig_covered[t], len ? (double)cov->contig_sum[t] / len : 0.0);
+        }
+        if (ferror(fp)) ok = false;
+        if (fclose(fp) != 0) ok = false;
+    } else {
+        ok = false;
+    }
+    if (!ok) dprintf(STDERR_FILENO, "Could not write coverage files for %s\n", cov->prefix);
+    free(name);
+    return ok;
+}
+
+void coverage_free(coverage_t* cov) {
+    if (!cov) return;
+    if (cov->windows) fclose(cov->windows);
+    free(cov->prefix);
+    free(cov->ring);
+    free(cov->contig_sum);
+    free(cov->contig_covered);
+    free(cov);
+}
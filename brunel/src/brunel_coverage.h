@@ -0,0 +1,58 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_COVERAGE_H
+#define BRUNEL_COVERAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <htslib/sam.h>
+
+#define COVERAGE_DEFAULT_WINDOW 1000
+
+// Streaming depth of the coordinate sorted output.  Depth is only held for
+// the bases between the last finished position and the end of the furthest
+// reaching alignment, in a ring buffer indexed by position.
+struct coverage {
+    bam_hdr_t* header;          // not owned
+    char* prefix;
+    bool binary;
+    int32_t window;
+    FILE* windows;              // bedGraph or binary window means
+    int32_t tid;                // contig being accumulated, -1 before the first
+    int64_t done;               // depth before this position is final
+    int64_t active_end;         // furthest alignment end seen on tid
+    uint32_t* ring;
+    size_t ring_size;           // always a power of two
+    int64_t win_start;
+    uint64_t win_sum;
+    bool run_open;              // bedGraph line waiting to be extended
+    int64_t run_beg;
+    int64_t run_end;
+    double run_value;
+    uint64_t* contig_sum;       // base depth summed over each contig
+    uint64_t* contig_covered;   // bases with non-zero depth
+};
+
+typedef struct coverage coverage_t;
+
+coverage_t* coverage_init(bam_hdr_t* header, const char* prefix, int32_t window, bool binary);
+bool coverage_record(coverage_t* cov, const bam1_t* b);
+bool coverage_close(coverage_t* cov);
+void coverage_free(coverage_t* cov);
+
+#endif
@@ -0,0 +1,557 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Mark duplicates in a single pass over the coordinate sorted merge output.
+// Reads are keyed by library, contig, unclipped 5' position and strand, and
+// for pairs also by the mate's unclipped 5' end taken from its MC tag, so the
+// mate never has to be seen to make the decision.  Records are held back in a
+// window of bases until no later record can duplicate them, and the mates of
+// reads marked as duplicates are marked as they leave the window.  An unmapped
+// mate placed alongside its mapped read is marked together with that read.
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brunel_dupmark.h"
+
+// Bases below this quality do not count towards a read's score (as Picard)
+#define DUPMARK_MIN_QUAL 15
+
+enum dup_kind {
+    DUP_FRAGMENT = 0,
+    DUP_PAIR = 1
+};
+
+struct dup_key {
+    int kind;
+    int lib;
+    int32_t tid;
+    int32_t pos5;
+    int reverse;
+    int32_t mtid;       // mate end, pairs only
+    int32_t mpos5;
+    int mreverse;
+};
+
+typedef struct dup_key dup_key_t;
+
+struct dup_entry {
+    dup_key_t key;
+    bam1_t* best;       // held record currently kept, NULL once written out
+    int score;          // score of the kept record, -1 if there is none yet
+    bool pair_seen;     // fragment entries: a mapped pair has an end here
+    unsigned refs;      // held records compared in this entry
+    struct dup_entry* next;
+};
+
+typedef struct dup_entry dup_entry_t;
+
+// A template with an end still to be written: in dup_names a marked read
+// whose mate (on mtid) must be marked too, in held_mates a placed unmapped
+// mate held back alongside its mapped read
+struct dup_mate {
+    char* uid;
+    int32_t mtid;
+    bam1_t* b;          // held_mates only
+};
+
+typedef struct dup_mate dup_mate_t;
+
+static size_t entry_hash(const void* data, size_t n_buckets) {
+    const dup_key_t* k = &((const dup_entry_t*)data)->key;
+    size_t h = (size_t)k->kind;
+    h = h * 31 + (size_t)k->lib;
+    h = h * 31 + (size_t)(uint32_t)k->tid;
+    h = h * 1000003 + (size_t)(uint32_t)k->pos5;
+    h = h * 31 + (size_t)k->reverse;
+    h = h * 31 + (size_t)(uint32_t)k->mtid;
+    h = h * 1000003 + (size_t)(uint32_t)k->mpos5;
+    h = h * 31 + (size_t)k->mreverse;
+    return h % n_buckets;
+}
+
+static bool entry_equal(const void* a, const void* b) {
+    const dup_key_t* ka = &((const dup_entry_t*)a)->key;
+    const dup_key_t* kb = &((const dup_entry_t*)b)->key;
+    return ka->kind == kb->kind && ka->lib == kb->lib && ka->tid == kb->tid && ka->pos5 == kb->pos5
+        && ka->reverse == kb->reverse && ka->mtid == kb->mtid && ka->mpos5 == kb->mpos5
+        && ka->mreverse == kb->mreverse;
+}
+
+static size_t mate_hash(const void* data, size_t n_buckets) {
+    return hash_string(((const dup_mate_t*)data)->uid, n_buckets);
+}
+
+static bool mate_equal(const void* a, const void* b) {
+    return strcmp(((const dup_mate_t*)a)->uid, ((const dup_mate_t*)b)->uid) == 0;
+}
+
+static void mate_free(void* data) {
+    dup_mate_t* mate = data;
+    free(mate->uid);
+    free(mate);
+}
+
+// Number each read group by its library (LB), so read groups that share a
+// library are deduplicated together.  Records without a known read group
+// all go in one extra library.
+static bool dupmark_libraries(dupmark_t* dm, bam_hdr_t* header) {
+    char** lib_name = NULL;
+    const char* line = header->text;
+    while (line && *line) {
+        const char* eol = strchr(line, '\n');
+        size_t len = eol ? (size_t)(eol - line) : strlen(line);
+        if (len > 4 && !strncmp(line, "@RG\t", 4)) {
+            char* rg = strndup(line, len);
+            char* id = NULL;
+            char* lb = "";
+            char* sep = rg + 4;
+            char* field;
+            while ((field = strsep(&sep, "\t")) != NULL) {
+                if (!strncmp(field, "ID:", 3)) id = field + 3;
+                else if (!strncmp(field, "LB:", 3)) lb = field + 3;
+            }
+            if (id) {
+                size_t n = dm->rg_count;
+                dm->rg_id = realloc(dm->rg_id, (n + 1) * sizeof(char*));
+                dm->rg_lib = realloc(dm->rg_lib, (n + 1) * sizeof(int));
+                lib_name = realloc(lib_name, (n + 1) * sizeof(char*));
+                if (!dm->rg_id || !dm->rg_lib || !lib_name) {
+                    free(rg);
+                    free(lib_name);
+                    return false;
+                }
+                dm->rg_id[n] = strdup(id);
+                lib_name[n] = strdup(lb);
+                dm->rg_lib[n] = (int)n;
+                for (size_t i = 0; i < n; i++) {
+                    if (!strcmp(lib_name[i], lb)) {
+                        dm->rg_lib[n] = dm->rg_lib[i];
+                        break;
+                    }
+                }
+                dm->rg_count++;
+            }
+            free(rg);
+        }
+        line = eol ? eol + 1 : NULL;
+    }
+    for (size_t i = 0; i < dm->rg_count; i++) free(lib_name[i]);
+    free(lib_name);
+    return true;
+}
+
+dupmark_t* dupmark_init(bam_hdr_t* header, int32_t window) {
+    dupmark_t* dm = calloc(1, sizeof(dupmark_t));
+    if (!dm) return NULL;
+    dm->window = window;
+    dm->last_tid = -1;
+    dm->release_tid = -1;
+    dm->entries = hash_initialize(1024, NULL, entry_hash, entry_equal, free);
+    dm->dup_names = hash_initialize(1024, NULL, mate_hash, mate_equal, mate_free);
+    dm->held_mates = hash_initialize(1024, NULL, mate_hash, mate_equal, mate_free);
+    if (!dm->entries || !dm->dup_names || !dm->held_mates || !dupmark_libraries(dm, header)) {
+        dprintf(STDERR_FILENO, "Could not set up duplicate marking\n");
+        dupmark_free(dm);
+        return NULL;
+    }
+    return dm;
+}
+
+static int dupmark_library(dupmark_t* dm, const bam1_t* b) {
+    uint8_t* rg = bam_aux_get(b, "RG");
+    if (!rg) return (int)dm->rg_count;
+    const char* id = bam_aux2Z(rg);
+    // Records from one read group tend to come in runs
+    if (dm->rg_last < dm->rg_count && !strcmp(dm->rg_id[dm->rg_last], id)) return dm->rg_lib[dm->rg_last];
+    for (size_t i = 0; i < dm->rg_count; i++) {
+        if (!strcmp(dm->rg_id[i], id)) {
+            dm->rg_last = i;
+            return dm->rg_lib[i];
+        }
+    }
+    return (int)dm->rg_count;
+}
+
+// Template name qualified by read group, used to find the mates of marked reads
+static char* dupmark_uid(const bam1_t* b) {
+    uint8_t* rg = bam_aux_get(b, "RG");
+    char* uid = NULL;
+    if (asprintf(&uid, "%s\t%s", rg ? bam_aux2Z(rg) : "", bam_get_qname(b)) < 0) return NULL;
+    return uid;
+}
+
+// 5' end of a read had it not been clipped
+static int32_t unclipped_5prime(const bam1_t* b) {
+    const uint32_t* cigar = bam_get_cigar(b);
+    uint32_t n = b->core.n_cigar;
+    int32_t clip = 0;
+    if (!bam_is_rev(b)) {
+        for (uint32_t k = 0; k < n; k++) {
+            int op = bam_cigar_op(cigar[k]);
+            if (op != BAM_CSOFT_CLIP && op != BAM_CHARD_CLIP) break;
+            clip += bam_cigar_oplen(cigar[k]);
+        }
+        return b->core.pos - clip;
+    }
+    for (uint32_t k = n; k > 0; k--) {
+        int op = bam_cigar_op(cigar[k - 1]);
+        if (op != BAM_CSOFT_CLIP && op != BAM_CHARD_CLIP) break;
+        clip += bam_cigar_oplen(cigar[k - 1]);
+    }
+    return bam_endpos(b) + clip - 1;
+}
+
+// Mate's unclipped 5' end from its CIGAR in the MC tag.  Without MC the best
+// we can do is the mate's clipped position.
+static int32_t mate_unclipped_5prime(const bam1_t* b) {
+    uint8_t* mc = bam_aux_get(b, "MC");
+    if (!mc) return b->core.mpos;
+    const char* s = bam_aux2Z(mc);
+    int32_t ref_len = 0, lead = 0, trail = 0;
+    bool aligned = false;
+    while (*s) {
+        char* end;
+        long len = strtol(s, &end, 10);
+        if (end == s || !*end) break;
+        switch (*end) {
+        case 'S':
+        case 'H':
+            if (aligned) trail += len;
+            else lead += len;
+            break;
+        case 'M':
+        case 'D':
+        case 'N':
+        case '=':
+        case 'X':
+            ref_len += len;
+            // fall through
+        default:
+            aligned = true;
+            trail = 0;
+            break;
+        }
+        s = end + 1;
+    }
+    if (b->core.flag & BAM_FMREVERSE) return b->core.mpos + ref_len + trail - 1;
+    return b->core.mpos - lead;
+}
+
+static int dupmark_score(const bam1_t* b) {
+    const uint8_t* qual = bam_get_qual(b);
+    int score = 0;
+    for (int32_t i = 0; i < b->core.l_qseq; i++) {
+        if (qual[i] >= DUPMARK_MIN_QUAL) score += qual[i];
+    }
+    return score;
+}
+
+// The end of a pair that carries its key: the leftmost, or read 1 if both
+// ends start together.  The other end follows the decision made for it.
+static bool pair_leading(const bam1_core_t* c) {
+    if (c->tid != c->mtid) return c->tid < c->mtid;
+    if (c->pos != c->mpos) return c->pos < c->mpos;
+    return (c->flag & BAM_FREAD1) != 0;
+}
+
+static dup_mate_t* mate_new(char* uid, int32_t mtid, bam1_t* b) {
+    dup_mate_t* mate = malloc(sizeof(dup_mate_t));
+    if (!mate) {
+        free(uid);
+        return NULL;
+    }
+    mate->uid = uid;
+    mate->mtid = mtid;
+    mate->b = b;
+    return mate;
+}
+
+static void dupmark_set(dupmark_t* dm, bam1_t* b) {
+    b->core.flag |= BAM_FDUP;
+    dm->marked++;
+    if (!(b->core.flag & BAM_FPAIRED)) return;
+    char* uid = dupmark_uid(b);
+    if (!uid) return;
+    dup_mate_t probe = { uid, 0, NULL };
+    dup_mate_t* held = (b->core.flag & BAM_FMUNMAP) ? hash_delete(dm->held_mates, &probe) : NULL;
+    if (held) {
+        // The unmapped mate is still held, so mark it now
+        held->b->core.flag |= BAM_FDUP;
+        dm->marked++;
+        mate_free(held);
+        free(uid);
+        return;
+    }
+    dup_mate_t* name = mate_new(uid, b->core.mtid, NULL);
+    if (name && hash_insert(dm->dup_names, name) != name) mate_free(name);
+}
+
+// An unmapped mate placed at its mapped read's position takes that read's
+// flag: marked now if the read already was, or later by dupmark_set while
+// both are held.  Its position makes it leave the window with the read, by
+// when the read's decision is final.
+static void dupmark_hold_mate(dupmark_t* dm, bam1_t* b) {
+    b->core.flag &= ~BAM_FDUP;
+    char* uid = dupmark_uid(b);
+    if (!uid) return;
+    dup_mate_t probe = { uid, 0, NULL };
+    dup_mate_t* name = hash_delete(dm->dup_names, &probe);
+    if (name) {
+        b->core.flag |= BAM_FDUP;
+        dm->marked++;
+        mate_free(name);
+        free(uid);
+        return;
+    }
+    dup_mate_t* held = mate_new(uid, b->core.tid, b);
+    if (held && hash_insert(dm->held_mates, held) != held) mate_free(held);
+}
+
+// Forget marked reads whose mates would have been on contigs before tid (all
+// of them if tid is -1, the unplaced reads), as those mates were never seen
+static void dupmark_sweep(dupmark_t* dm, int32_t tid) {
+    size_t n = 0, capacity = 0;
+    dup_mate_t** stale = NULL;
+    for (dup_mate_t* name = hash_get_first(dm->dup_names); name; name = hash_get_next(dm->dup_names, name)) {
+        if (name->mtid < 0 || (tid >= 0 && name->mtid >= tid)) continue;
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            dup_mate_t** grown = realloc(stale, capacity * sizeof(dup_mate_t*));
+            if (!grown) break;
+            stale = grown;
+        }
+        stale[n++] = name;
+    }
+    for (size_t i = 0; i < n; i++) {
+        hash_delete(dm->dup_names, stale[i]);
+        mate_free(stale[i]);
+    }
+    free(stale);
+}
+
+static dup_entry_t* dupmark_entry(dupmark_t* dm, const dup_key_t* key) {
+    dup_entry_t probe;
+    probe.key = *key;
+    dup_entry_t* entry = hash_lookup(dm->entries, &probe);
+    if (entry) return entry;
+
+    entry = calloc(1, sizeof(dup_entry_t));
+    if (!entry) return NULL;
+    entry->key = *key;
+    entry->score = -1;
+    if (hash_insert(dm->entries, entry) != entry) {
+        free(entry);
+        return NULL;
+    }
+    if (dm->expire_tail) dm->expire_tail->next = entry;
+    else dm->expire_head = entry;
+    dm->expire_tail = entry;
+    return entry;
+}
+
+// Compare b with the record kept so far for entry, marking the loser
+static void dupmark_compete(dupmark_t* dm, dup_entry_t* entry, bam1_t* b) {
+    int score = dupmark_score(b);
+    if (entry->score < 0) {
+        entry->best = b;
+        entry->score = score;
+    } else if (entry->best == NULL || score <= entry->score) {
+        // kept record already written out, or at least as good
+        dupmark_set(dm, b);
+    } else {
+        dupmark_set(dm, entry->best);
+        entry->best = b;
+        entry->score = score;
+    }
+}
+
+static void dupmark_examine(dupmark_t* dm, dup_item_t* item) {
+    bam1_t* b = item->b;
+    bam1_core_t* c = &b->core;
+    item->entry[0] = item->entry[1] = NULL;
+    if ((c->flag & (BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY))
+        == (BAM_FPAIRED | BAM_FUNMAP) && c->tid >= 0) {
+        dupmark_hold_mate(dm, b);
+        return;
+    }
+    if (c->flag & (BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) return;
+
+    c->flag &= ~BAM_FDUP;
+    dm->examined++;
+    dup_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.kind = DUP_FRAGMENT;
+    key.lib = dupmark_library(dm, b);
+    key.tid = c->tid;
+    key.pos5 = unclipped_5prime(b);
+    key.reverse = bam_is_rev(b);
+    key.mtid = -1;
+
+    dup_entry_t* fragment = dupmark_entry(dm, &key);
+    if (!fragment) return;
+    fragment->refs++;
+    item->entry[0] = fragment;
+
+    if (!(c->flag & BAM_FPAIRED) || (c->flag & BAM_FMUNMAP)) {
+        // Single ends lose to any pair with an end in the same place
+        if (fragment->pair_seen) dupmark_set(dm, b);
+        else dupmark_compete(dm, fragment, b);
+        return;
+    }
+
+    if (!fragment->pair_seen) {
+        fragment->pair_seen = true;
+        if (fragment->best) {
+            dupmark_set(dm, fragment->best);
+            fragment->best = NULL;
+        }
+    }
+    if (!pair_leading(c)) return;
+
+    key.kind = DUP_PAIR;
+    key.mtid = c->mtid;
+    key.mpos5 = mate_unclipped_5prime(b);
+    key.mreverse = bam_is_mrev(b);
+    dup_entry_t* pair = dupmark_entry(dm, &key);
+    if (!pair) return;
+    pair->refs++;
+    item->entry[1] = pair;
+    dupmark_compete(dm, pair, b);
+}
+
+// Hold a copy of b back until dupmark_next releases it
+bool dupmark_add(dupmark_t* dm, const bam1_t* b, size_t input) {
+    if (dm->count == dm->capacity) {
+        size_t capacity = dm->capacity ? dm->capacity * 2 : 1024;
+        dup_item_t* grown = malloc(capacity * sizeof(dup_item_t));
+        if (!grown) return false;
+        for (size_t i = 0; i < dm->count; i++) grown[i] = dm->queue[(dm->head + i) % dm->capacity];
+        free(dm->queue);
+        dm->queue = grown;
+        dm->head = 0;
+        dm->capacity = capacity;
+    }
+    dup_item_t* item = &dm->queue[(dm->head + dm->count) % dm->capacity];
+    bam1_t* copy = dm->spare ? dm->spare : bam_init1();
+    dm->spare = NULL;
+    if (!copy || !bam_copy1(copy, b)) {
+        if (copy) bam_destroy1(copy);
+        return false;
+    }
+    item->b = copy;
+    item->input = input;
+    dm->count++;
+    dm->last_tid = b->core.tid;
+    dm->last_pos = b->core.pos;
+    dupmark_examine(dm, item);
+    return true;
+}
+
+// Forget keys far enough behind the newest record that nothing can match them
+static void dupmark_expire(dupmark_t* dm) {
+    while (dm->expire_head) {
+        dup_entry_t* entry = dm->expire_head;
+        if (entry->refs) break;
+        if (entry->key.tid == dm->last_tid && entry->key.pos5 + 2 * dm->window >= dm->last_pos) break;
+        dm->expire_head = entry->next;
+        if (!dm->expire_head) dm->expire_tail = NULL;
+        hash_delete(dm->entries, entry);
+        free(entry);
+    }
+}
+
+// Next record that can be written out, or NULL if the rest must wait for
+// more input.  With flush every held record is released.  The record is
+// only valid until the next call.
+bam1_t* dupmark_next(dupmark_t* dm, bool flush, size_t* input) {
+    if (dm->handed) {
+        // Keep one record for dupmark_add to copy the next one into
+        if (dm->spare) bam_destroy1(dm->handed);
+        else dm->spare = dm->handed;
+        dm->handed = NULL;
+    }
+    if (dm->count == 0) {
+        dupmark_expire(dm);
+        return NULL;
+    }
+    dup_item_t* item = &dm->queue[dm->head];
+    bam1_t* b = item->b;
+    bool ready = flush || b->core.tid < 0 || b->core.tid != dm->last_tid
+        || dm->last_pos - b->core.pos > dm->window;
+    if (!ready) {
+        dupmark_expire(dm);
+        return NULL;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        dup_entry_t* entry = item->entry[i];
+        if (!entry) continue;
+        if (entry->best == b) entry->best = NULL;
+        entry->refs--;
+    }
+    if (b->core.tid != dm->release_tid) {
+        // Every mate on an earlier contig has been written by now
+        dupmark_sweep(dm, b->core.tid);
+        dm->release_tid = b->core.tid;
+    }
+    // The decision for the leading end of this template is final by now
+    if ((b->core.flag & BAM_FPAIRED) && !(b->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY))) {
+        char* uid = dupmark_uid(b);
+        dup_mate_t probe = { uid, 0, NULL };
+        dup_mate_t* held = uid && (b->core.flag & BAM_FUNMAP) ? hash_lookup(dm->held_mates, &probe) : NULL;
+        if (held && held->b == b) {
+            hash_delete(dm->held_mates, held);
+            mate_free(held);
+        } else if (uid && !(b->core.flag & BAM_FDUP)) {
+            dup_mate_t* found = hash_delete(dm->dup_names, &probe);
+            if (found) {
+                b->core.flag |= BAM_FDUP;
+                dm->marked++;
+                mate_free(found);
+            }
+        }
+        free(uid);
+    }
+
+    dm->head = (dm->head + 1) % dm->capacity;
+    dm->count--;
+    dm->handed = b;
+    *input = item->input;
+    return b;
+}
+
+void dupmark_free(dupmark_t* dm) {
+    if (!dm) return;
+    for (size_t i = 0; i < dm->count; i++) bam_destroy1(dm->queue[(dm->head + i) % dm->capacity].b);
+    free(dm->queue);
+    if (dm->handed) bam_destroy1(dm->handed);
+    if (dm->spare) bam_destroy1(dm->spare);
+    if (dm->entries) hash_free(dm->entries);
+    if (dm->dup_names) hash_free(dm->dup_names);
+    if (dm->held_mates) hash_free(dm->held_mates);
+    for (size_t i = 0; i < dm->rg_count; i++) free(dm->rg_id[i]);
+    free(dm->rg_id);
+    free(dm->rg_lib);
+    free(dm);
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_DUPMARK_H
+#define BRUNEL_DUPMARK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+#include "hash.h"
+
+// Default number of bases records are held back for, which must exceed the
+// longest reference span (plus soft clips) of any read
+#define DUPMARK_DEFAULT_WINDOW 1000
+
+struct dup_entry;
+
+// A record held back until no later record can turn out to duplicate it
+struct dup_item {
+    bam1_t* b;
+    size_t input;
+    struct dup_entry* entry[2];   // fragment and pair entries it was compared in
+};
+
+typedef struct dup_item dup_item_t;
+
+struct dupmark {
+    int32_t window;
+    size_t rg_count;
+    char** rg_id;
+    int* rg_lib;                  // library number of each read group
+    size_t rg_last;
+    Hash_table* entries;          // best record seen for each duplicate key
+    Hash_table* dup_names;        // templates whose mates must also be marked
+    Hash_table* held_mates;       // placed unmapped mates held with their reads
+    struct dup_entry* expire_head;
+    struct dup_entry* expire_tail;
+    dup_item_t* queue;            // ring buffer of held records
+    size_t head;
+    size_t count;
+    size_t capacity;
+    bam1_t* handed;               // record handed out by the last dupmark_next
+    bam1_t* spare;                // written record reused by dupmark_add
+    int32_t last_tid;
+    int32_t last_pos;
+    int32_t release_tid;          // contig of the last record handed out
+    uint64_t examined;
+    uint64_t marked;
+};
+
+typedef struct dupmark dupmark_t;
+
+dupmark_t* dupmark_init(bam_hdr_t* header, int32_t window);
+bool dupmark_add(dupmark_t* dm, const bam1_t* b, size_t input);
+bam1_t* dupmark_next(dupmark_t* dm, bool flush, size_t* input);
+void dupmark_free(dupmark_t* dm);
+
+#endif
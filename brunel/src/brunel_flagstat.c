@@ -0,0 +1,204 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Inline QC summaries of the merged output.  For a prefix P, close writes
+//   P.flagstat  in the format of samtools flagstat
+//   P.idxstats  in the format of samtools idxstats
+//   P.qc.json   all of the above plus MAPQ histograms of primary mapped reads
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brunel_flagstat.h"
+
+flagstat_t* flagstat_init(bam_hdr_t* header) {
+    flagstat_t* fs = calloc(1, sizeof(flagstat_t));
+    if (!fs) return NULL;
+    fs->header = header;
+    fs->contig_mapped = calloc(header->n_targets + 1, sizeof(uint64_t));
+    fs->contig_unmapped = calloc(header->n_targets + 1, sizeof(uint64_t));
+    if (!fs->contig_mapped || !fs->contig_unmapped) {
+        flagstat_free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+// Count one output record, following samtools' bam_flagstat rules
+void flagstat_record(flagstat_t* fs, const bam1_t* b) {
+    const bam1_core_t* c = &b->core;
+    flag_counts_t* s = &fs->flags;
+    int w = (c->flag & BAM_FQCFAIL) ? 1 : 0;
+
+    s->total[w]++;
+    if (c->flag & BAM_FSECONDARY) {
+        s->secondary[w]++;
+    } else if (c->flag & BAM_FSUPPLEMENTARY) {
+        s->supplementary[w]++;
+    } else if (c->flag & BAM_FPAIRED) {
+        s->paired[w]++;
+        if ((c->flag & BAM_FPROPER_PAIR) && !(c->flag & BAM_FUNMAP)) s->proper_pair[w]++;
+        if (c->flag & BAM_FREAD1) s->read1[w]++;
+        if (c->flag & BAM_FREAD2) s->read2[w]++;
+        if ((c->flag & BAM_FMUNMAP) && !(c->flag & BAM_FUNMAP)) s->singletons[w]++;
+        if (!(c->flag & BAM_FUNMAP) && !(c->flag & BAM_FMUNMAP)) {
+            s->pair_mapped[w]++;
+            if (c->mtid != c->tid) {
+                s->diff_chr[w]++;
+                if (c->qual >= 5) s->diff_chr_mapq5[w]++;
+            }
+        }
+    }
+    if (!(c->flag & BAM_FUNMAP)) s->mapped[w]++;
+    if (c->flag & BAM_FDUP) s->duplicates[w]++;
+
+    if (!(c->flag & (BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY))) fs->mapq[w][c->qual]++;
+
+    // idxstats counts every record by the contig it is placed on
+    if (c->tid < 0 || c->tid >= fs->header->n_targets) {
+        fs->unplaced++;
+    } else if (c->flag & BAM_FUNMAP) {
+        fs->contig_unmapped[c->tid]++;
+    } else {
+        fs->contig_mapped[c->tid]++;
+    }
+}
+
+static void percent(char* buf, uint64_t n, uint64_t total) {
+    if (total) sprintf(buf, "%.2f%%", 100.0 * n / total);
+    else strcpy(buf, "N/A");
+}
+
+static void write_flagstat(const flagstat_t* fs, FILE* fp) {
+    const flag_counts_t* s = &fs->flags;
+    char p0[16], p1[16];
+    fprintf(fp, "%llu + %llu in total (QC-passed reads + QC-failed reads)\n", (unsigned long long)s->total[0], (unsigned long long)s->total[1]);
+    fprintf(fp, "%llu + %llu secondary\n", (unsigned long long)s->secondary[0], (unsigned long long)s->secondary[1]);
+    fprintf(fp, "%llu + %llu supplementary\n", (unsigned long long)s->supplementary[0], (unsigned long long)s->supplementary[1]);
+    fprintf(fp, "%llu + %llu duplicates\n", (unsigned long long)s->duplicates[0], (unsigned long long)s->duplicates[1]);
+    percent(p0, s->mapped[0], s->total[0]);
+    percent(p1, s->mapped[1], s->total[1]);
+    fprintf(fp, "%llu + %llu mapped (%s : %s)\n", (unsigned long long)s->mapped[0], (unsigned long long)s->mapped[1], p0, p1);
+    fprintf(fp, "%llu + %llu paired in sequencing\n", (unsigned long long)s->paired[0], (unsigned long long)s->paired[1]);
+    fprintf(fp, "%llu + %llu read1\n", (unsigned long long)s->read1[0], (unsigned long long)s->read1[1]);
+    fprintf(fp, "%llu + %llu read2\n", (unsigned long long)s->read2[0], (unsigned long long)s->read2[1]);
+    percent(p0, s->proper_pair[0], s->paired[0]);
+    percent(p1, s->proper_pair[1], s->paired[1]);
+    fprintf(fp, "%llu + %llu properly paired (%s : %s)\n", (unsigned long long)s->proper_pair[0], (unsigned long long)s->proper_pair[1], p0, p1);
+    fprintf(fp, "%llu + %llu with itself and mate mapped\n", (unsigned long long)s->pair_mapped[0], (unsigned long long)s->pair_mapped[1]);
+    percent(p0, s->singletons[0], s->paired[0]);
+    percent(p1, s->singletons[1], s->paired[1]);
+    fprintf(fp, "%llu + %llu singletons (%s : %s)\n", (unsigned long long)s->singletons[0], (unsigned long long)s->singletons[1], p0, p1);
+    fprintf(fp, "%llu + %llu with mate mapped to a different chr\n", (unsigned long long)s->diff_chr[0], (unsigned long long)s->diff_chr[1]);
+    fprintf(fp, "%llu + %llu with mate mapped to a different chr (mapQ>=5)\n", (unsigned long long)s->diff_chr_mapq5[0], (unsigned long long)s->diff_chr_mapq5[1]);
+}
+
+static void write_idxstats(const flagstat_t* fs, FILE* fp) {
+    for (int i = 0; i < fs->header->n_targets; i++) {
+        fprintf(fp, "%s\t%u\t%llu\t%llu\n", fs->header->target_name[i], fs->header->target_len[i],
+                (unsigned long long)fs->contig_mapped[i], (unsigned long long)fs->contig_unmapped[i]);
+    }
+    fprintf(fp, "*\t0\t0\t%llu\n", (unsigned long long)fs->unplaced);
+}
+
+static void json_string(const char* str, FILE* fp) {
+    fputc('"', fp);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(fp, "\\%c", *p);
+        else if (*p < 0x20) fprintf(fp, "\\u%04x", *p);
+        else fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+static void json_pair(const char* name, const uint64_t* n, bool last, FILE* fp) {
+    fprintf(fp, "    \"%s\": [%llu, %llu]%s\n", name, (unsigned long long)n[0], (unsigned long long)n[1], last ? "" : ",");
+}
+
+static void write_json(const flagstat_t* fs, FILE* fp) {
+    const flag_counts_t* s = &fs->flags;
+    fprintf(fp, "{\n  \"flagstat\": {\n");
+    json_pair("total", s->total, false, fp);
+    json_pair("secondary", s->secondary, false, fp);
+    json_pair("supplementary", s->supplementary, false, fp);
+    json_pair("duplicates", s->duplicates, false, fp);
+    json_pair("mapped", s->mapped, false, fp);
+    json_pair("paired in sequencing", s->paired, false, fp);
+    json_pair("read1", s->read1, false, fp);
+    json_pair("read2", s->read2, false, fp);
+    json_pair("properly paired", s->proper_pair, false, fp);
+    json_pair("with itself and mate mapped", s->pair_mapped, false, fp);
+    json_pair("singletons", s->singletons, false, fp);
+    json_pair("with mate mapped to a different chr", s->diff_chr, false, fp);
+    json_pair("with mate mapped to a different chr (mapQ>=5)", s->diff_chr_mapq5, true, fp);
+    fprintf(fp, "  },\n  \"idxstats\": [\n");
+    for (int i = 0; i < fs->header->n_targets; i++) {
+        fprintf(fp, "    {\"contig\": ");
+        json_string(fs->header->target_name[i], fp);
+        fprintf(fp, ", \"length\": %u, \"mapped\": %llu, \"unmapped\": %llu},\n", fs->header->target_len[i],
+                (unsigned long long)fs->contig_mapped[i], (unsigned long long)fs->contig_unmapped[i]);
+    }
+    fprintf(fp, "    {\"contig\": \"*\", \"length\": 0, \"mapped\": 0, \"unmapped\": %llu}\n  ],\n", (unsigned long long)fs->unplaced);
+    // Histograms stop at the highest MAPQ seen so they stay short
+    const char* label[2] = { "qc_passed", "qc_failed" };
+    fprintf(fp, "  \"mapq\": {\n");
+    for (int w = 0; w < 2; w++) {
+        int top = 255;
+        while (top > 0 && fs->mapq[w][top] == 0) top--;
+        fprintf(fp, "    \"%s\": [", label[w]);
+        for (int q = 0; q <= top; q++) fprintf(fp, "%s%llu", q ? ", " : "", (unsigned long long)fs->mapq[w][q]);
+        fprintf(fp, "]%s\n", w ? "" : ",");
+    }
+    fprintf(fp, "  }\n}\n");
+}
+
+static bool write_file(const flagstat_t* fs, const char* prefix, const char* suffix, void (*writer)(const flagstat_t*, FILE*)) {
+    char* name = NULL;
+    if (asprintf(&name, "%s.%s", prefix, suffix) < 0) return false;
+    FILE* fp = fopen(name, "w");
+    if (!fp) {
+        dprintf(STDERR_FILENO, "Could not open QC summary file: %s\n", name);
+        free(name);
+        return false;
+    }
+    writer(fs, fp);
+    bool ok = !ferror(fp);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) dprintf(STDERR_FILENO, "Could not write QC summary file: %s\n", name);
+    free(name);
+    return ok;
+}
+
+// Write the flagstat, idxstats and JSON summaries next to prefix
+bool flagstat_write(const flagstat_t* fs, const char* prefix) {
+    return write_file(fs, prefix, "flagstat", write_flagstat)
+        && write_file(fs, prefix, "idxstats", write_idxstats)
+        && write_file(fs, prefix, "qc.json", write_json);
+}
+
+void flagstat_free(flagstat_t* fs) {
+    if (!fs) return;
+    free(fs->contig_mapped);
+    free(fs->contig_unmapped);
+    free(fs);
+}
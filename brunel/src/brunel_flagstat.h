@@ -0,0 +1,62 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_FLAGSTAT_H
+#define BRUNEL_FLAGSTAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+// samtools flagstat categories, each counted separately for records that
+// pass QC ([0]) and those flagged as failing it ([1])
+struct flag_counts {
+    uint64_t total[2];
+    uint64_t secondary[2];
+    uint64_t supplementary[2];
+    uint64_t duplicates[2];
+    uint64_t mapped[2];
+    uint64_t paired[2];
+    uint64_t read1[2];
+    uint64_t read2[2];
+    uint64_t proper_pair[2];
+    uint64_t pair_mapped[2];
+    uint64_t singletons[2];
+    uint64_t diff_chr[2];
+    uint64_t diff_chr_mapq5[2];
+};
+
+typedef struct flag_counts flag_counts_t;
+
+// Flag, idxstats and MAPQ summaries accumulated over the records written,
+// saving separate samtools flagstat and idxstats passes over the output
+struct flagstat {
+    bam_hdr_t* header;          // not owned
+    flag_counts_t flags;
+    uint64_t* contig_mapped;    // per tid, as samtools idxstats
+    uint64_t* contig_unmapped;  // per tid, placed unmapped reads
+    uint64_t unplaced;          // unmapped reads with no position
+    uint64_t mapq[2][256];      // primary mapped records by MAPQ, per QC status
+};
+
+typedef struct flagstat flagstat_t;
+
+flagstat_t* flagstat_init(bam_hdr_t* header);
+void flagstat_record(flagstat_t* fs, const bam1_t* b);
+bool flagstat_write(const flagstat_t* fs, const char* prefix);
+void flagstat_free(flagstat_t* fs);
+
+#endif
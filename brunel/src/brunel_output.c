@@ -0,0 +1,368 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <htslib/bgzf.h>
+
+#include "brunel_output.h"
+
+// Derive the name of one part of a scattered output: out.bam -> out.<label>.bam
+static char* part_name(const char* base, const char* label) {
+    size_t len = strlen(base);
+    if (len > 4 && !strcmp(base + len - 4, ".bam")) len -= 4;
+    char* name = NULL;
+    if (asprintf(&name, "%.*s.%s.bam", (int)len, base, label) < 0) return NULL;
+    return name;
+}
+
+static output_set_t* output_set_init(enum output_mode mode, const char* name, bam_hdr_t* header, bool index, const output_io_t* io) {
+    output_set_t* set = calloc(1, sizeof(output_set_t));
+    if (!set) return NULL;
+    set->mode = mode;
+    set->index = index;
+    if (io) set->io = *io;
+    set->base_name = strdup(name);
+    set->header = header;
+    if (!set->base_name) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+// Open output file n of the set under name, write its header and start its index
+static bool output_open_file(output_set_t* set, size_t n, char* name, bam_hdr_t* header) {
+    output_file_t* out = &set->out[n];
+    out->name = name;
+    out->header = header;
+    if (name == NULL) {
+        dprintf(STDERR_FILENO, "Out of memory\n");
+        return false;
+    }
+    if (set->io.async_depth > 0) {
+        // htslib writes to the async writer's pipe; the index is still saved under name
+        out->async = async_out_open(name, set->io.async_depth, set->io.direct);
+        if (out->async == NULL) return false;
+    }
+    out->file = sam_open(out->async ? async_out_path(out->async) : name, "wb", 0);
+    if (out->file == NULL) {
+        dprintf(STDERR_FILENO, "Could not open output file: %s\n", name);
+        return false;
+    }
+    if (sam_hdr_write(out->file, header) != 0) {
+        dprintf(STDERR_FILENO, "Could not write output file header: %s\n", name);
+        return false;
+    }
+    if (set->threads > 0) hts_set_threads(out->file, set->threads);
+    if (set->index) {
+        // htslib adds each record to the index as it is written, threads or
+        // not; the index is saved as name.bai even when writing to a pipe
+        char* index_name = NULL;
+        out->indexed = asprintf(&index_name, "%s.bai", name) >= 0 && sam_idx_init(out->file, header, 0, index_name) == 0;
+        free(index_name);
+        if (!out->indexed) {
+            dprintf(STDERR_FILENO, "Could not start index for output file: %s\n", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool output_close_file(output_set_t* set, output_file_t* out) {
+    bool ok = true;
+    if (out->file != NULL) {
+        if (out->indexed && sam_idx_save(out->file) < 0) {
+            dprintf(STDERR_FILENO, "Could not write index for output file: %s\n", out->name);
+            ok = false;
+        }
+        if (sam_close(out->file) < 0) ok = false;
+        out->file = NULL;
+        if (out->async && !async_out_close(out->async)) ok = false;
+    } else {
+        async_out_close(out->async);
+    }
+    out->async = NULL;
+    out->indexed = false;
+    if (out->header && out->header != set->header) bam_hdr_destroy(out->header);
+    out->header = NULL;
+    return ok;
+}
+
+output_set_t* output_open_single(const char* name, bam_hdr_t* header, bool index, const output_io_t* io) {
+    output_set_t* set = output_set_init(OUTPUT_SINGLE, name, header, index, io);
+    if (!set) return NULL;
+    set->count = 1;
+    set->out = calloc(1, sizeof(output_file_t));
+    if (!set->out || !output_open_file(set, 0, strdup(name), header)) {
+        output_close(set);
+        return NULL;
+    }
+    return set;
+}
+
+// Each line of groups_file lists the contigs (separated by whitespace or
+// commas) to write to one output.  Contigs not listed, and unmapped reads,
+// go to a final "other" output.
+output_set_t* output_open_contigs(const char* name, bam_hdr_t* header, const char* groups_file, bool index, const output_io_t* io) {
+    FILE* fp = fopen(groups_file, "r");
+    if (!fp) {
+        dprintf(STDERR_FILENO, "Could not open contig groups file: %s\n", groups_file);
+        return NULL;
+    }
+    output_set_t* set = output_set_init(OUTPUT_CONTIGS, name, header, index, io);
+    if (set) set->tid_out = malloc(header->n_targets * sizeof(int));
+    if (!set || !set->tid_out) {
+        dprintf(STDERR_FILENO, "Out of memory\n");
+        fclose(fp);
+        output_close(set);
+        return NULL;
+    }
+    for (int i = 0; i < header->n_targets; i++) set->tid_out[i] = -1;
+
+    char* line = NULL;
+    size_t line_size = 0;
+    size_t groups = 0;
+    bool ok = true;
+    while (ok && getline(&line, &line_size, fp) > 0) {
+        bool any = false;
+        char* sep = line;
+        char* contig;
+        while ((contig = strsep(&sep, " \t,\r\n")) != NULL) {
+            if (*contig == '\0') continue;
+            int tid = bam_name2id(header, contig);
+            if (tid < 0) {
+                dprintf(STDERR_FILENO, "Contig in %s not in output header: [%s]\n", groups_file, contig);
+                ok = false;
+                break;
+            }
+            if (set->tid_out[tid] != -1) {
+                dprintf(STDERR_FILENO, "Contig listed in more than one group: [%s]\n", contig);
+                ok = false;
+                break;
+            }
+            set->tid_out[tid] = groups;
+            any = true;
+        }
+        if (any) groups++;
+    }
+    free(line);
+    fclose(fp);
+
+    set->count = groups + 1;
+    set->out = calloc(set->count, sizeof(output_file_t));
+    if (!set->out) ok = false;
+    for (int i = 0; i < header->n_targets; i++) {
+        if (set->tid_out[i] == -1) set->tid_out[i] = groups;
+    }
+    for (size_t g = 0; ok && g < set->count; g++) {
+        char label[32];
+        if (g < groups) snprintf(label, sizeof(label), "%zu", g);
+        else strcpy(label, "other");
+        ok = output_open_file(set, g, part_name(name, label), header);
+    }
+    if (!ok) {
+        output_close(set);
+        return NULL;
+    }
+    return set;
+}
+
+output_set_t* output_open_bytes(const char* name, bam_hdr_t* header, uint64_t max_bytes, bool index, const output_io_t* io) {
+    output_set_t* set = output_set_init(OUTPUT_BYTES, name, header, index, io);
+    if (!set) return NULL;
+    set->max_bytes = max_bytes;
+    set->count = 1;
+    set->out = calloc(1, sizeof(output_file_t));
+    if (!set->out || !output_open_file(set, 0, part_name(name, "0"), header)) {
+        output_close(set);
+        return NULL;
+    }
+    return set;
+}
+
+// Copy of header whose text keeps only the @RG line for read group id
+static bam_hdr_t* header_for_rg(const bam_hdr_t* header, const char* id) {
+    bam_hdr_t* h = bam_hdr_dup(header);
+    char* text = malloc(header->l_text + 1);
+    size_t len = 0;
+    size_t id_len = strlen(id);
+    const char* line = header->text;
+    const char* text_end = header->text + header->l_text;
+    while (line < text_end) {
+        const char* eol = memchr(line, '\n', text_end - line);
+        size_t line_len = eol ? (size_t)(eol - line) + 1 : (size_t)(text_end - line);
+        bool keep = true;
+        if (!strncmp(line, "@RG", 3)) {
+            const char* tag = strstr(line, "\tID:");
+            keep = tag && tag < line + line_len && !strncmp(tag + 4, id, id_len)
+                && (tag[4 + id_len] == '\t' || tag[4 + id_len] == '\n' || tag + 4 + id_len == text_end);
+        }
+        if (keep) {
+            memcpy(text + len, line, line_len);
+            len += line_len;
+        }
+        line += line_len;
+    }
+    text[len] = '\0';
+    free(h->text);
+    h->text = text;
+    h->l_text = len;
+    return h;
+}
+
+// Name of the output for read group g.  Characters that could take the name
+// out of the output's directory, or that do not print, become '_'; the
+// group number is added if that makes the name clash with an earlier one.
+static char* rg_part_name(output_set_t* set, size_t g, const char* id) {
+    char* label = strdup(id);
+    if (!label) return NULL;
+    for (char* c = label; *c; c++) {
+        if (*c == '/' || !isgraph((unsigned char)*c)) *c = '_';
+    }
+    char* name = part_name(set->base_name, label);
+    for (size_t i = 0; name && i < g; i++) {
+        if (strcmp(name, set->out[i].name)) continue;
+        char* numbered = NULL;
+        if (asprintf(&numbered, "%s-%zu", label, g) < 0) numbered = NULL;
+        free(name);
+        name = numbered ? part_name(set->base_name, numbered) : NULL;
+        free(numbered);
+        break;
+    }
+    free(label);
+    return name;
+}
+
+// One output per @RG line in header, plus a final one for reads whose RG
+// is missing or not declared in the header
+output_set_t* output_open_rg(const char* name, bam_hdr_t* header, bool index, const output_io_t* io) {
+    output_set_t* set = output_set_init(OUTPUT_RG, name, header, index, io);
+    if (!set) return NULL;
+    size_t groups = 0;
+    const char* line = header->text;
+    while (line && *line) {
+        if (!strncmp(line, "@RG", 3)) {
+            const char* eol = strchr(line, '\n');
+            const char* tag = strstr(line, "\tID:");
+            if (tag && (!eol || tag < eol)) {
+                size_t id_len = strcspn(tag + 4, "\t\n");
+                set->rg_id = realloc(set->rg_id, (groups + 1) * sizeof(char*));
+                set->rg_id[groups++] = strndup(tag + 4, id_len);
+            }
+        }
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+
+    set->count = groups + 1;
+    set->out = calloc(set->count, sizeof(output_file_t));
+    bool ok = set->out != NULL;
+    for (size_t g = 0; ok && g < groups; g++) {
+        ok = output_open_file(set, g, rg_part_name(set, g, set->rg_id[g]), header_for_rg(header, set->rg_id[g]));
+    }
+    if (ok) ok = output_open_file(set, groups, rg_part_name(set, groups, "unknown_rg"), header);
+    if (!ok) {
+        output_close(set);
+        return NULL;
+    }
+    return set;
+}
+
+// Pick the output for b according to the set's mode
+static size_t output_select(output_set_t* set, const bam1_t* b) {
+    switch (set->mode) {
+        case OUTPUT_CONTIGS:
+            return b->core.tid >= 0 ? (size_t)set->tid_out[b->core.tid] : set->count - 1;
+        case OUTPUT_RG: {
+            uint8_t* tag = bam_aux_get(b, "RG");
+            if (!tag) return set->count - 1;
+            const char* rg = bam_aux2Z(tag);
+            // reads from the same read group tend to come in runs
+            if (set->rg_last < set->count - 1 && !strcmp(rg, set->rg_id[set->rg_last])) return set->rg_last;
+            for (size_t g = 0; g < set->count - 1; g++) {
+                if (!strcmp(rg, set->rg_id[g])) {
+                    set->rg_last = g;
+                    return g;
+                }
+            }
+            return set->count - 1;
+        }
+        case OUTPUT_BYTES:
+        case OUTPUT_SINGLE:
+        default:
+            return set->count - 1;
+    }
+}
+
+// Compress outputs with threads, from now on and for outputs opened later
+void output_set_threads(output_set_t* set, int threads) {
+    set->threads = threads;
+    if (threads <= 0) return;
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->out[i].file) hts_set_threads(set->out[i].file, threads);
+    }
+}
+
+bool output_write(output_set_t* set, const bam1_t* b) {
+    if (set->mode == OUTPUT_BYTES) {
+        output_file_t* cur = &set->out[set->count - 1];
+        // block address of the BGZF virtual offset is the compressed size so far
+        if ((uint64_t)(bgzf_tell(cur->file->fp.bgzf) >> 16) >= set->max_bytes) {
+            char label[32];
+            if (!output_close_file(set, cur)) return false;
+            set->out = realloc(set->out, (set->count + 1) * sizeof(output_file_t));
+            memset(&set->out[set->count], 0, sizeof(output_file_t));
+            snprintf(label, sizeof(label), "%zu", set->count);
+            if (!output_open_file(set, set->count++, part_name(set->base_name, label), set->header)) return false;
+        }
+    }
+
+    output_file_t* out = &set->out[output_select(set, b)];
+    if (sam_write1(out->file, out->header, b) < 0) {
+        if (set->index) dprintf(STDERR_FILENO, "Could not write or index %s (it must be coordinate sorted) at %s\n", out->name, bam_get_qname(b));
+        else dprintf(STDERR_FILENO, "Could not write to output file: %s\n", out->name);
+        return false;
+    }
+    return true;
+}
+
+bool output_close(output_set_t* set) {
+    bool ok = true;
+    if (!set) return true;
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->out && !output_close_file(set, &set->out[i])) ok = false;
+        if (set->out) free(set->out[i].name);
+    }
+    if (set->rg_id) {
+        for (size_t g = 0; g + 1 < set->count; g++) free(set->rg_id[g]);
+        free(set->rg_id);
+    }
+    free(set->out);
+    free(set->tid_out);
+    free(set->base_name);
+    free(set);
+    return ok;
+}
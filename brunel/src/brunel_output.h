@@ -0,0 +1,78 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_OUTPUT_H
+#define BRUNEL_OUTPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+#include "bb_asyncout.h"
+
+// How the merged stream is divided between output files
+enum output_mode {
+    OUTPUT_SINGLE,  // everything to one file
+    OUTPUT_CONTIGS, // one file per group of contigs, plus one for everything else
+    OUTPUT_BYTES,   // start a new file once the current one reaches a size
+    OUTPUT_RG       // one file per read group, plus one for reads without a known RG
+};
+
+// How output files are written to disk
+struct output_io {
+    int async_depth;    // blocks in flight through async_out, 0 to write from htslib directly
+    bool direct;        // bypass the page cache (async output only)
+};
+
+typedef struct output_io output_io_t;
+
+struct output_file {
+    char* name;
+    samFile* file;
+    async_out_t* async; // writer draining file, if async
+    bam_hdr_t* header;
+    bool indexed;       // index started, and saved by output_close
+};
+
+typedef struct output_file output_file_t;
+
+struct output_set {
+    enum output_mode mode;
+    bool index;
+    char* base_name;
+    bam_hdr_t* header;  // header shared by all outputs, not owned
+    size_t count;
+    output_file_t* out;
+    int* tid_out;       // OUTPUT_CONTIGS: output for each tid
+    char** rg_id;       // OUTPUT_RG: read group written to each output but the last
+    size_t rg_last;     // OUTPUT_RG: output chosen for the previous record
+    uint64_t max_bytes; // OUTPUT_BYTES: compressed size at which to move on
+    int threads;        // BGZF compression threads for each output
+    output_io_t io;
+};
+
+typedef struct output_set output_set_t;
+
+// io may be NULL for plain writes
+output_set_t* output_open_single(const char* name, bam_hdr_t* header, bool index, const output_io_t* io);
+output_set_t* output_open_contigs(const char* name, bam_hdr_t* header, const char* groups_file, bool index, const output_io_t* io);
+output_set_t* output_open_bytes(const char* name, bam_hdr_t* header, uint64_t max_bytes, bool index, const output_io_t* io);
+output_set_t* output_open_rg(const char* name, bam_hdr_t* header, bool index, const output_io_t* io);
+void output_set_threads(output_set_t* set, int threads);
+bool output_write(output_set_t* set, const bam1_t* b);
+bool output_close(output_set_t* set);
+
+#endif
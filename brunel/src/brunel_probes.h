@@ -0,0 +1,38 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_PROBES_H
+#define BRUNEL_PROBES_H
+
+// Static tracepoints (USDT) for perf, bpftrace or SystemTap, under the
+// provider "brunel", e.g.
+//   bpftrace -e 'usdt:./brunel:brunel:record_selected { @[arg0] = count(); }'
+// Each is a single nop until a tracer attaches, so arguments should be
+// values already to hand.  Without sys/sdt.h they compile to nothing.
+//
+//   record_selected(input, tid, pos)          next record chosen by the merge
+//   input_refill(input, block_address)        an input moved on to a new BGZF block
+//   output_block_written(fd, offset, length)  from bb_asyncout.c, an asynchronous output block reached the file
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define BRUNEL_PROBE2(name, a, b) DTRACE_PROBE2(brunel, name, a, b)
+#define BRUNEL_PROBE3(name, a, b, c) DTRACE_PROBE3(brunel, name, a, b, c)
+#else
+#define BRUNEL_PROBE2(name, a, b) do { } while (0)
+#define BRUNEL_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
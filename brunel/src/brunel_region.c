@@ -0,0 +1,148 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "brunel_region.h"
+
+region_list_t* region_list_init(void) {
+    return calloc(1, sizeof(region_list_t));
+}
+
+static bool region_list_push(region_list_t* list, int tid, int beg, int end) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        region_t* grown = realloc(list->region, capacity * sizeof(region_t));
+        if (!grown) return false;
+        list->region = grown;
+        list->capacity = capacity;
+    }
+    list->region[list->count].tid = tid;
+    list->region[list->count].beg = beg;
+    list->region[list->count].end = end;
+    list->count++;
+    return true;
+}
+
+// Parse a samtools style region (chr, chr:beg or chr:beg-end, 1-based inclusive)
+// or "*" for the unmapped reads, looking contig names up in header.
+bool region_list_add_string(region_list_t* list, bam_hdr_t* header, const char* str) {
+    if (!strcmp(str, "*")) {
+        return region_list_push(list, -1, 0, INT_MAX);
+    }
+
+    int beg, end;
+    const char* name_end = hts_parse_reg(str, &beg, &end);
+    if (!name_end) {
+        dprintf(STDERR_FILENO, "Could not parse region: [%s]\n", str);
+        return false;
+    }
+    char* name = strndup(str, name_end - str);
+    int tid = bam_name2id(header, name);
+    if (tid < 0) {
+        dprintf(STDERR_FILENO, "Region contig not in output header: [%s]\n", name);
+        free(name);
+        return false;
+    }
+    free(name);
+
+    if (end > (int)header->target_len[tid]) end = header->target_len[tid];
+    return region_list_push(list, tid, beg, end);
+}
+
+// Read regions from a BED file (contig, 0-based start, end) or a file of
+// samtools style region strings, one per line.
+bool region_list_add_file(region_list_t* list, bam_hdr_t* header, const char* filename) {
+    FILE* fp = fopen(filename, "r");
+    if (!fp) {
+        dprintf(STDERR_FILENO, "Could not open regions file: %s\n", filename);
+        return false;
+    }
+
+    char* line = NULL;
+    size_t line_size = 0;
+    bool ok = true;
+    while (ok && getline(&line, &line_size, fp) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#' || !strncmp(line, "track", 5) || !strncmp(line, "browser", 7)) continue;
+
+        char* sep = line;
+        char* name = strsep(&sep, "\t");
+        if (sep == NULL) {
+            ok = region_list_add_string(list, header, name);
+            continue;
+        }
+        int beg, end;
+        if (sscanf(sep, "%d\t%d", &beg, &end) != 2 || beg < 0 || end < beg) {
+            dprintf(STDERR_FILENO, "Malformed BED line in %s: [%s]\n", filename, line);
+            ok = false;
+            break;
+        }
+        int tid = bam_name2id(header, name);
+        if (tid < 0) {
+            dprintf(STDERR_FILENO, "Region contig not in output header: [%s]\n", name);
+            ok = false;
+            break;
+        }
+        ok = region_list_push(list, tid, beg, end);
+    }
+    free(line);
+    fclose(fp);
+    return ok;
+}
+
+static int region_cmp(const void* a, const void* b) {
+    const region_t* ra = a;
+    const region_t* rb = b;
+    // Same trick as selectRead: tid -1 (unmapped) sorts last
+    if ((uint32_t)ra->tid != (uint32_t)rb->tid) return (uint32_t)ra->tid < (uint32_t)rb->tid ? -1 : 1;
+    if (ra->beg != rb->beg) return ra->beg < rb->beg ? -1 : 1;
+    return 0;
+}
+
+// Sort regions into output order and join any that overlap or abut so each
+// record is visited by at most one index query per contig stretch.
+void region_list_normalise(region_list_t* list) {
+    if (list->count == 0) return;
+    qsort(list->region, list->count, sizeof(region_t), region_cmp);
+
+    size_t out = 0;
+    for (size_t i = 1; i < list->count; i++) {
+        region_t* last = &list->region[out];
+        region_t* cur = &list->region[i];
+        if (cur->tid == last->tid && cur->beg <= last->end) {
+            if (cur->end > last->end) last->end = cur->end;
+        } else {
+            list->region[++out] = *cur;
+        }
+    }
+    list->count = out + 1;
+}
+
+void region_list_free(region_list_t* list) {
+    if (!list) return;
+    free(list->region);
+    free(list);
+}
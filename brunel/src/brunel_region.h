@@ -0,0 +1,48 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_REGION_H
+#define BRUNEL_REGION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <htslib/sam.h>
+
+// A region in the output header's coordinate space, 0-based half open.
+// tid == -1 selects the unplaced unmapped reads at the end of the inputs ("*").
+struct region {
+    int tid;
+    int beg;
+    int end;
+};
+
+typedef struct region region_t;
+
+struct region_list {
+    size_t count;
+    size_t capacity;
+    region_t* region;
+};
+
+typedef struct region_list region_list_t;
+
+region_list_t* region_list_init(void);
+bool region_list_add_string(region_list_t* list, bam_hdr_t* header, const char* str);
+bool region_list_add_file(region_list_t* list, bam_hdr_t* header, const char* filename);
+void region_list_normalise(region_list_t* list);
+void region_list_free(region_list_t* list);
+
+#endif
@@ -0,0 +1,94 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "brunel_stats.h"
+
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+merge_stats_t* stats_init(size_t input_count) {
+    merge_stats_t* stats = calloc(1, sizeof(merge_stats_t));
+    if (!stats) return NULL;
+
+    stats->input_count = input_count;
+    stats->input_records = calloc(input_count, sizeof(uint64_t));
+    stats->input_read_time = calloc(input_count, sizeof(double));
+    if (!stats->input_records || !stats->input_read_time) {
+        stats_free(stats);
+        return NULL;
+    }
+    stats->start_time = stats_now();
+    stats->last_output_time = stats->start_time;
+    return stats;
+}
+
+// Account for one record from input written between before and after
+void stats_output(merge_stats_t* stats, size_t input, double before, double after) {
+    double gap = after - stats->last_output_time;
+    stats->records_out++;
+    stats->write_time += after - before;
+    if (gap > stats->max_output_gap) {
+        stats->max_output_gap = gap;
+        stats->max_output_gap_record = stats->records_out;
+        stats->max_output_gap_input = input;
+    }
+    stats->last_output_time = after;
+}
+
+void stats_report(const merge_stats_t* stats, char** input_name, FILE* out) {
+    double wall = stats->end_time - stats->start_time;
+    double read_total = 0.0;
+    uint64_t records_in = 0;
+    size_t slowest = 0;
+
+    fprintf(out, "# brunel merge statistics\n");
+    fprintf(out, "input\trecords\tread_seconds\trecords_per_second\tname\n");
+    for (size_t i = 0; i < stats->input_count; i++) {
+        double t = stats->input_read_time[i];
+        fprintf(out, "%zu\t%llu\t%.3f\t%.0f\t%s\n", i, (unsigned long long)stats->input_records[i], t,
+                t > 0.0 ? stats->input_records[i] / t : 0.0, input_name[i]);
+        read_total += t;
+        records_in += stats->input_records[i];
+        if (t > stats->input_read_time[slowest]) slowest = i;
+    }
+    fprintf(out, "records_in\t%llu\n", (unsigned long long)records_in);
+    fprintf(out, "records_out\t%llu\n", (unsigned long long)stats->records_out);
+    fprintf(out, "concatenated_bytes\t%llu\n", (unsigned long long)stats->concat_bytes);
+    fprintf(out, "duplicates_examined\t%llu\n", (unsigned long long)stats->dup_examined);
+    fprintf(out, "duplicates_marked\t%llu\n", (unsigned long long)stats->dup_marked);
+    fprintf(out, "wall_seconds\t%.3f\n", wall);
+    fprintf(out, "input_seconds\t%.3f\n", read_total);
+    fprintf(out, "merge_seconds\t%.3f\n", stats->merge_time);
+    fprintf(out, "output_seconds\t%.3f\n", stats->write_time + stats->close_time);
+    fprintf(out, "slowest_input\t%zu\t%s\n", slowest, stats->input_count ? input_name[slowest] : "");
+    fprintf(out, "max_output_gap_seconds\t%.6f\trecord %llu from input %zu\n", stats->max_output_gap,
+            (unsigned long long)stats->max_output_gap_record, stats->max_output_gap_input);
+}
+
+void stats_free(merge_stats_t* stats) {
+    if (!stats) return;
+    free(stats->input_records);
+    free(stats->input_read_time);
+    free(stats);
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of Brunel which is part of BridgeBuilder.
+//
+// Brunel is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BRUNEL_STATS_H
+#define BRUNEL_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Merge instrumentation, only collected when --stats is given.
+// All times are wall clock seconds from a monotonic clock.
+struct merge_stats {
+    size_t input_count;
+    uint64_t* input_records;    // records consumed from each input
+    double* input_read_time;    // time blocked in sam_read1 for each input
+    uint64_t records_out;       // records emitted to the output
+    double merge_time;          // time spent selecting the next record
+    double write_time;          // time spent in sam_write1 (includes BGZF compression)
+    double close_time;          // time spent flushing and closing the output
+    uint64_t concat_bytes;      // compressed bytes copied without decompression
+    uint64_t dup_examined;      // primary mapped records considered for duplicate marking
+    uint64_t dup_marked;        // records flagged as duplicates
+    double start_time;
+    double end_time;
+    double last_output_time;
+    double max_output_gap;      // largest gap between two successive outputs
+    uint64_t max_output_gap_record; // record number emitted after that gap
+    size_t max_output_gap_input;    // input that supplied the record after that gap
+};
+
+typedef struct merge_stats merge_stats_t;
+
+double stats_now(void);
+merge_stats_t* stats_init(size_t input_count);
+void stats_output(merge_stats_t* stats, size_t input, double before, double after);
+void stats_report(const merge_stats_t* stats, char** input_name, FILE* out);
+void stats_free(merge_stats_t* stats);
+
+#endif
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <htslib/sam.h>
+#include <htslib/bgzf.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,8 +31,42 @@
 #include <limits.h>
 #include <assert.h>
 #include <unistd.h>
+#include <getopt.h>
+
+#include "brunel_calmd.h"
+#include "brunel_checksum.h"
+#include "brunel_concat.h"
+#include "brunel_coverage.h"
+#include "brunel_dupmark.h"
+#include "brunel_flagstat.h"
+#include "brunel_output.h"
+#include "brunel_probes.h"
+#include "brunel_region.h"
+#include "brunel_stats.h"
 
 struct parsed_opts {
+    bool stats;
+    size_t region_count;
+    char** region;
+    char* regions_file;
+    bool region_starts;
+    bool no_concat;
+    char* split_contigs;
+    uint64_t split_bytes;
+    bool split_rg;
+    bool write_index;
+    char* reference;
+    bool mark_duplicates;
+    int32_t dup_window;
+    int threads;
+    int io_uring;
+    bool direct_io;
+    char* qc_prefix;
+    char* coverage_prefix;
+    int32_t coverage_window;
+    bool coverage_binary;
+    char* checksum_file;
+    bool checksum_seq;
     char* output_header_name;
     size_t input_count;
     char** input_name;
@@ -43,11 +78,27 @@ typedef struct parsed_opts parsed_opts_t;
 
 struct state {
     size_t input_count;
+    char** input_name;
     samFile** input_file;
     bam_hdr_t** input_header;
     int32_t** input_trans;
-    samFile* output_file;
+    output_set_t* output;
     bam_hdr_t* output_header;
+    merge_stats_t* stats;
+    region_list_t* regions;
+    bool region_starts;
+    hts_idx_t** input_index;
+    hts_itr_t** input_iter;
+    bool concat;
+    ref_window_t* reference;
+    dupmark_t* dupmark;
+    flagstat_t* flagstat;
+    char* qc_prefix;
+    coverage_t* coverage;
+    char* checksum_file;
+    bool checksum_seq;
+    read_checksum_t* input_checksum;
+    read_checksum_t output_checksum;
 };
 
 typedef struct state state_t;
@@ -56,29 +107,216 @@ void cleanup_state(state_t* status);
 void cleanup_opts(parsed_opts_t* opts);
 
 
+void usage(void) {
+    dprintf(STDERR_FILENO, "Arguments should be: brunel [options] <newheader.sam> <input1.bam[:trans_tbl.txt]> <input2.bam[:trans_tbl.txt]> [<inputX.bam[:trans_tbl.txt]> ...] <output.bam>\r\n");
+    dprintf(STDERR_FILENO, "Options:\r\n");
+    dprintf(STDERR_FILENO, "  --stats                Report per-input record counts and time spent on input, merge and output to stderr\r\n");
+    dprintf(STDERR_FILENO, "  --region REG           Only merge records overlapping REG (chr, chr:beg-end or * for unmapped); may be repeated. Inputs must be indexed\r\n");
+    dprintf(STDERR_FILENO, "  --regions-file FILE    Only merge records overlapping the regions in FILE (BED or one region per line)\r\n");
+    dprintf(STDERR_FILENO, "  --region-starts        Only merge records that start within a region, so disjoint region jobs concatenate to the full merge\r\n");
+    dprintf(STDERR_FILENO, "  --no-concat            Always merge record by record, even when indexed inputs do not overlap\r\n");
+    dprintf(STDERR_FILENO, "  --split-contigs FILE   Write one output per line of FILE (a list of contigs), plus output.other.bam for the rest\r\n");
+    dprintf(STDERR_FILENO, "  --split-bytes SIZE     Start a new output (output.0.bam, output.1.bam, ...) each time one reaches SIZE bytes (k/M/G suffixes allowed)\r\n");
+    dprintf(STDERR_FILENO, "  --split-rg             Write one output per read group, plus output.unknown_rg.bam\r\n");
+    dprintf(STDERR_FILENO, "  --write-index          Build a BAI index for each output as it is written (implied by the --split options)\r\n");
+    dprintf(STDERR_FILENO, "  --reference FILE       Recalculate MD and NM tags against FILE (a faidx indexed FASTA or a brindley reference cache) as records are merged\r\n");
+    dprintf(STDERR_FILENO, "  --mark-duplicates      Mark duplicate reads and pairs (by library, unclipped 5' ends and strand; pairs need MC tags) as records are merged\r\n");
+    dprintf(STDERR_FILENO, "  --dup-window BASES     Bases records are held back for while marking duplicates, at least the longest read span [%d]\r\n", DUPMARK_DEFAULT_WINDOW);
+    dprintf(STDERR_FILENO, "  --qc PREFIX            Write samtools flagstat and idxstats summaries of the output, and a JSON file adding MAPQ histograms, to PREFIX.flagstat, PREFIX.idxstats and PREFIX.qc.json\r\n");
+    dprintf(STDERR_FILENO, "  --coverage PREFIX      Write windowed mean depth of the output to PREFIX.bedGraph and per contig mean depth to PREFIX.depth\r\n");
+    dprintf(STDERR_FILENO, "  --coverage-window N    Bases per coverage window [%d]\r\n", COVERAGE_DEFAULT_WINDOW);
+    dprintf(STDERR_FILENO, "  --coverage-binary      Write window means to the compact binary PREFIX.cov instead of a bedGraph\r\n");
+    dprintf(STDERR_FILENO, "  --checksum FILE        Write order independent checksums (count, sum and xor of RG+QNAME+segment hashes) of each input and the output to FILE\r\n");
+    dprintf(STDERR_FILENO, "  --checksum-seq         Include read sequences in the checksums\r\n");
+    dprintf(STDERR_FILENO, "  --threads N            Compress each output with N extra threads [0]\r\n");
+    dprintf(STDERR_FILENO, "  --io-uring N           Write each output from a separate thread through io_uring, with up to N 1MiB blocks in flight [0]\r\n");
+    dprintf(STDERR_FILENO, "  --direct-io            With --io-uring, bypass the page cache (O_DIRECT) where the file system allows\r\n");
+}
+
 parsed_opts_t* parse_args(int argc, char** argv) {
+    static const struct option lopts[] = {
+        {"stats", no_argument, NULL, 's'},
+        {"region", required_argument, NULL, 'r'},
+        {"regions-file", required_argument, NULL, 'R'},
+        {"region-starts", no_argument, NULL, 'S'},
+        {"no-concat", no_argument, NULL, 'C'},
+        {"split-contigs", required_argument, NULL, 'G'},
+        {"split-bytes", required_argument, NULL, 'B'},
+        {"split-rg", no_argument, NULL, 'g'},
+        {"write-index", no_argument, NULL, 'I'},
+        {"reference", required_argument, NULL, 'T'},
+        {"mark-duplicates", no_argument, NULL, 'D'},
+        {"dup-window", required_argument, NULL, 'W'},
+        {"qc", required_argument, NULL, 'Q'},
+        {"coverage", required_argument, NULL, 'V'},
+        {"coverage-window", required_argument, NULL, 'w'},
+        {"coverage-binary", no_argument, NULL, 'b'},
+        {"checksum", required_argument, NULL, 'K'},
+        {"checksum-seq", no_argument, NULL, 'k'},
+        {"threads", required_argument, NULL, '@'},
+        {"io-uring", required_argument, NULL, 'A'},
+        {"direct-io", no_argument, NULL, 'O'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    parsed_opts_t* retval = calloc(1, sizeof(parsed_opts_t));
+    if (! retval ) return NULL;
+    retval->dup_window = DUPMARK_DEFAULT_WINDOW;
+    retval->coverage_window = COVERAGE_DEFAULT_WINDOW;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", lopts, NULL)) != -1) {
+        switch (c) {
+            case 's':
+                retval->stats = true;
+                break;
+            case 'r':
+                retval->region = realloc(retval->region, (retval->region_count + 1) * sizeof(char*));
+                retval->region[retval->region_count++] = strdup(optarg);
+                break;
+            case 'R':
+                retval->regions_file = strdup(optarg);
+                break;
+            case 'S':
+                retval->region_starts = true;
+                break;
+            case 'C':
+                retval->no_concat = true;
+                break;
+            case 'G':
+                retval->split_contigs = strdup(optarg);
+                break;
+            case 'B': {
+                char* unit;
+                retval->split_bytes = strtoull(optarg, &unit, 10);
+                switch (*unit) {
+                    case 'g': case 'G': retval->split_bytes <<= 10; // fall through
+                    case 'm': case 'M': retval->split_bytes <<= 10; // fall through
+                    case 'k': case 'K': retval->split_bytes <<= 10; break;
+                }
+                if (retval->split_bytes == 0) {
+                    dprintf(STDERR_FILENO, "Invalid --split-bytes size: %s\r\n", optarg);
+                    free(retval);
+                    return NULL;
+                }
+                break;
+            }
+            case 'g':
+                retval->split_rg = true;
+                break;
+            case 'I':
+                retval->write_index = true;
+                break;
+            case 'T':
+                retval->reference = strdup(optarg);
+                break;
+            case 'D':
+                retval->mark_duplicates = true;
+                break;
+            case 'W': {
+                char* end;
+                long window = strtol(optarg, &end, 10);
+                if (*end != '\0' || window <= 0 || window > INT_MAX / 4) {
+                    dprintf(STDERR_FILENO, "Invalid --dup-window: %s\r\n", optarg);
+                    free(retval);
+                    return NULL;
+                }
+                retval->dup_window = (int32_t)window;
+                break;
+            }
+            case 'Q':
+                retval->qc_prefix = strdup(optarg);
+                break;
+            case 'V':
+                retval->coverage_prefix = strdup(optarg);
+                break;
+            case 'w': {
+                char* end;
+                long window = strtol(optarg, &end, 10);
+                if (*end != '\0' || window <= 0 || window > INT_MAX) {
+                    dprintf(STDERR_FILENO, "Invalid --coverage-window: %s\r\n", optarg);
+                    free(retval);
+                    return NULL;
+                }
+                retval->coverage_window = (int32_t)window;
+                break;
+            }
+            case 'b':
+                retval->coverage_binary = true;
+                break;
+            case 'K':
+                retval->checksum_file = strdup(optarg);
+                break;
+            case 'k':
+                retval->checksum_seq = true;
+                break;
+            case '@': {
+                char* end;
+                long threads = strtol(optarg, &end, 10);
+                if (*end != '\0' || threads < 0 || threads > 1024) {
+                    dprintf(STDERR_FILENO, "Invalid --threads: %s\r\n", optarg);
+                    free(retval);
+                    return NULL;
+                }
+                retval->threads = (int)threads;
+                break;
+            }
+            case 'A': {
+                char* end;
+                long depth = strtol(optarg, &end, 10);
+                if (*end != '\0' || depth < 0 || depth > 256) {
+                    dprintf(STDERR_FILENO, "Invalid --io-uring: %s\r\n", optarg);
+                    free(retval);
+                    return NULL;
+                }
+                retval->io_uring = (int)depth;
+                break;
+            }
+            case 'O':
+                retval->direct_io = true;
+                break;
+            case 'h':
+            default:
+                usage();
+                free(retval);
+                return NULL;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if ((retval->split_contigs != NULL) + (retval->split_bytes != 0) + retval->split_rg > 1) {
+        dprintf(STDERR_FILENO, "Only one of --split-contigs, --split-bytes and --split-rg may be given\r\n");
+        free(retval);
+        return NULL;
+    }
+    if (retval->direct_io && !retval->io_uring) {
+        dprintf(STDERR_FILENO, "--direct-io needs --io-uring\r\n");
+        free(retval);
+        return NULL;
+    }
+
     if (argc < 3) {
-        dprintf(STDERR_FILENO, "Arguments should be: brunel <newheader.sam> <input1.bam[:trans_tbl.txt]> <input2.bam[:trans_tbl.txt]> [<inputX.bam[:trans_tbl.txt]> ...] <output.bam>\r\n");
+        usage();
+        free(retval);
         return NULL;
     }
-    
-    parsed_opts_t* retval = malloc(sizeof(parsed_opts_t));
-    if (! retval ) return NULL;
-    
-    retval->output_header_name = strdup(argv[1]);
 
-    retval->input_count = argc-3;
+    retval->output_header_name = strdup(argv[0]);
+
+    retval->input_count = argc-2;
     retval->input_name = (char**)calloc(retval->input_count,sizeof(char*));
     retval->input_trans_name = (char**)calloc(retval->input_count,sizeof(char*));
     size_t i = 0;
     for (; i < retval->input_count; i++) {
-        char* temp = strdup(argv[i+2]);
+        char* temp = strdup(argv[i+1]);
         char* sep = temp;
         retval->input_name[i] = strsep(&sep, ":");
         retval->input_trans_name[i] = sep;
     }
 
-    retval->output_name = strdup(argv[i+2]);
+    retval->output_name = strdup(argv[i+1]);
 
     return retval;
 }
@@ -90,6 +328,8 @@ int* build_translation_file(const char* trans_name, bam_hdr_t* file_header, bam_
     int replace_entries = replace_header->n_targets;
     
     int *trans = malloc(sizeof(int)*file_entries);
+    // contigs missing from the table have no counterpart in the output
+    for (int i = 0; i < file_entries; i++) trans[i] = -1;
     
     char* linepointer = NULL;
     size_t read = 0;
@@ -160,8 +400,26 @@ int* build_translation( bam_hdr_t* file_header, bam_hdr_t* replace_header ) {
     }
 }
 
+// Is there a .bai or .csi index alongside the named BAM?
+bool has_index(const char* name) {
+    size_t len = strlen(name);
+    char* idx_name = malloc(len + 5);
+    bool found = false;
+    const char* ext[] = { ".bai", ".csi" };
+    for (size_t e = 0; !found && e < 2; e++) {
+        sprintf(idx_name, "%s%s", name, ext[e]);
+        found = access(idx_name, R_OK) == 0;
+        if (!found && len > 4 && !strcmp(name + len - 4, ".bam")) {
+            sprintf(idx_name, "%.*s%s", (int)(len - 4), name, ext[e]);
+            found = access(idx_name, R_OK) == 0;
+        }
+    }
+    free(idx_name);
+    return found;
+}
+
 state_t* init(parsed_opts_t* opts) {
-    state_t* retval = malloc(sizeof(state_t));
+    state_t* retval = calloc(1, sizeof(state_t));
     if (!retval) {
         dprintf(STDERR_FILENO, "Out of memory\n");
         return NULL;
@@ -180,15 +438,25 @@ state_t* init(parsed_opts_t* opts) {
       dprintf(STDERR_FILENO, "Header has no SQ targets, pointless to proceed!\n");
       return NULL;
     }
-    retval->output_file = sam_open(opts->output_name, "wb", 0);
-    
-    if (retval->output_file == NULL) {
-        printf("Could not open output file: %s\r\n", opts->output_name);
-        cleanup_state(retval);
+    // Scattered outputs are always indexed so each part can be used on its own
+    bool index = opts->write_index || opts->split_contigs || opts->split_bytes || opts->split_rg;
+    output_io_t io = { opts->io_uring, opts->direct_io };
+    if (opts->split_contigs) {
+        retval->output = output_open_contigs(opts->output_name, retval->output_header, opts->split_contigs, index, &io);
+    } else if (opts->split_bytes) {
+        retval->output = output_open_bytes(opts->output_name, retval->output_header, opts->split_bytes, index, &io);
+    } else if (opts->split_rg) {
+        retval->output = output_open_rg(opts->output_name, retval->output_header, index, &io);
+    } else {
+        retval->output = output_open_single(opts->output_name, retval->output_header, index, &io);
+    }
+    if (retval->output == NULL) {
         return NULL;
     }
+    output_set_threads(retval->output, opts->threads);
 
     retval->input_count = opts->input_count;
+    retval->input_name = opts->input_name;
     
     // Open files
     retval->input_trans = (int**)calloc(opts->input_count, sizeof(int*));
@@ -216,6 +484,82 @@ state_t* init(parsed_opts_t* opts) {
         }
     }
 
+    if (opts->region_count > 0 || opts->regions_file) {
+        retval->regions = region_list_init();
+        retval->region_starts = opts->region_starts;
+        for (size_t i = 0; i < opts->region_count; i++) {
+            if (!region_list_add_string(retval->regions, retval->output_header, opts->region[i])) return NULL;
+        }
+        if (opts->regions_file && !region_list_add_file(retval->regions, retval->output_header, opts->regions_file)) return NULL;
+        region_list_normalise(retval->regions);
+
+        retval->input_index = (hts_idx_t**)calloc(opts->input_count, sizeof(hts_idx_t*));
+        retval->input_iter = (hts_itr_t**)calloc(opts->input_count, sizeof(hts_itr_t*));
+        for (size_t i = 0; i < opts->input_count; i++) {
+            retval->input_index[i] = sam_index_load(retval->input_file[i], opts->input_name[i]);
+            if (retval->input_index[i] == NULL) {
+                dprintf(STDERR_FILENO, "Could not load index for input file: %s\r\n", opts->input_name[i]);
+                return NULL;
+            }
+        }
+    }
+
+    if (opts->reference) {
+        retval->reference = ref_window_init(opts->reference, retval->output_header);
+        if (!retval->reference) return NULL;
+    }
+    if (opts->mark_duplicates) {
+        retval->dupmark = dupmark_init(retval->output_header, opts->dup_window);
+        if (!retval->dupmark) return NULL;
+    }
+    if (opts->qc_prefix) {
+        retval->flagstat = flagstat_init(retval->output_header);
+        if (!retval->flagstat) {
+            dprintf(STDERR_FILENO, "Out of memory\n");
+            return NULL;
+        }
+        retval->qc_prefix = opts->qc_prefix;
+    }
+    if (opts->coverage_prefix) {
+        retval->coverage = coverage_init(retval->output_header, opts->coverage_prefix, opts->coverage_window, opts->coverage_binary);
+        if (!retval->coverage) return NULL;
+    }
+    if (opts->checksum_file) {
+        retval->input_checksum = calloc(opts->input_count, sizeof(read_checksum_t));
+        if (!retval->input_checksum) {
+            dprintf(STDERR_FILENO, "Out of memory\n");
+            return NULL;
+        }
+        retval->checksum_file = opts->checksum_file;
+        retval->checksum_seq = opts->checksum_seq;
+    }
+
+    // Inputs that need no tid translation and carry an index may turn out
+    // to be disjoint shards which can be gathered without decompression.
+    // Copied blocks bypass the writer and any per-record processing, so only
+    // a single unindexed, unthreaded output with nothing to recalculate qualifies
+    retval->concat = !opts->no_concat && !retval->regions && opts->input_count > 1
+        && retval->output->mode == OUTPUT_SINGLE && !index && !opts->threads && !retval->reference && !retval->dupmark
+        && !retval->flagstat && !retval->coverage && !retval->input_checksum;
+    for (size_t i = 0; retval->concat && i < opts->input_count; i++) {
+        retval->concat = retval->input_trans[i] == NULL && retval->input_file[i]->is_bin && has_index(opts->input_name[i]);
+    }
+    if (retval->concat) {
+        retval->input_index = (hts_idx_t**)calloc(opts->input_count, sizeof(hts_idx_t*));
+        for (size_t i = 0; retval->concat && i < opts->input_count; i++) {
+            retval->input_index[i] = sam_index_load(retval->input_file[i], opts->input_name[i]);
+            retval->concat = retval->input_index[i] != NULL;
+        }
+    }
+
+    if (opts->stats) {
+        retval->stats = stats_init(opts->input_count);
+        if (!retval->stats) {
+            dprintf(STDERR_FILENO, "Out of memory\n");
+            return NULL;
+        }
+    }
+
     return retval;
 }
 
@@ -258,55 +602,149 @@ size_t selectRead( bam1_t **file_read, size_t input_count )
     return min;
 }
 
-bool merge(state_t* opts) {
-    if (sam_hdr_write(opts->output_file, opts->output_header) != 0) {
-        dprintf(STDERR_FILENO, "Could not write output file header\n");
+// Read the next record from input i into b, translating its tids into the
+// output header's namespace.  Returns false once the input is exhausted.
+bool read_next(state_t* opts, size_t i, bam1_t* b) {
+    double before = 0.0;
+    if (opts->stats) before = stats_now();
+    BGZF* bgzf = opts->input_file[i]->is_bin && !opts->input_file[i]->is_cram ? opts->input_file[i]->fp.bgzf : NULL;
+    int64_t block = bgzf ? bgzf->block_address : -1;
+    int ret;
+    if (opts->input_iter) {
+        ret = sam_itr_next(opts->input_file[i], opts->input_iter[i], b);
+    } else {
+        ret = sam_read1(opts->input_file[i], opts->input_header[i], b);
+    }
+    if (bgzf && bgzf->block_address != block) BRUNEL_PROBE2(input_refill, i, bgzf->block_address);
+    if (opts->stats) {
+        opts->stats->input_read_time[i] += stats_now() - before;
+        if (ret >= 0) opts->stats->input_records[i]++;
+    }
+    if (ret < 0) return false;
+
+    if (opts->input_trans[i]) {
+        // Translate the tid and mate tid but only if they're not null values
+        if (b->core.tid != -1) {
+            b->core.tid = opts->input_trans[i][b->core.tid];
+        }
+        if (b->core.mtid != -1) {
+            b->core.mtid = opts->input_trans[i][b->core.mtid];
+        }
+    }
+    return true;
+}
+
+// Look up which tid in input i's own header translates to output tid.
+// Returns -1 if the input has no such contig.
+int input_tid(state_t* opts, size_t i, int tid) {
+    if (!opts->input_trans[i]) return tid < opts->input_header[i]->n_targets ? tid : -1;
+    for (int j = 0; j < opts->input_header[i]->n_targets; j++) {
+        if (opts->input_trans[i][j] == tid) return j;
+    }
+    return -1;
+}
+
+// Point every input's iterator at region r.  Inputs without the contig get
+// an iterator that is immediately exhausted.
+void seek_region(state_t* opts, const region_t* r) {
+    for (size_t i = 0; i < opts->input_count; i++) {
+        if (opts->input_iter[i]) hts_itr_destroy(opts->input_iter[i]);
+        if (r->tid == -1) {
+            opts->input_iter[i] = sam_itr_queryi(opts->input_index[i], HTS_IDX_NOCOOR, 0, 0);
+        } else {
+            int tid = input_tid(opts, i, r->tid);
+            opts->input_iter[i] = sam_itr_queryi(opts->input_index[i], tid < 0 ? HTS_IDX_NONE : tid, r->beg, r->end);
+        }
+    }
+}
+
+// Write a finished record from input to the output(s)
+bool write_record(state_t* opts, size_t input, bam1_t* b, double before) {
+    if (!output_write(opts->output, b)) return false;
+    if (opts->flagstat) flagstat_record(opts->flagstat, b);
+    if (opts->input_checksum) checksum_record(&opts->output_checksum, b, opts->checksum_seq);
+    if (opts->coverage && !coverage_record(opts->coverage, b)) {
+        dprintf(STDERR_FILENO, "Out of memory\n");
         return false;
     }
-    
+    if (opts->stats) stats_output(opts->stats, input, before, stats_now());
+    return true;
+}
+
+// Write out whatever duplicate marking has finished with, or everything it
+// still holds if flush is set
+bool release_records(state_t* opts, bool flush) {
+    size_t input;
+    bam1_t* b;
+    while ((b = dupmark_next(opts->dupmark, flush, &input)) != NULL) {
+        if (!write_record(opts, input, b, opts->stats ? stats_now() : 0.0)) return false;
+    }
+    return true;
+}
+
+// Pass a selected record from input on to the output(s)
+bool emit_record(state_t* opts, size_t input, bam1_t* b, double selected) {
+    if (opts->input_checksum) checksum_record(&opts->input_checksum[input], b, opts->checksum_seq);
+    if (opts->reference && !calmd_record(opts->reference, b)) return false;
+    if (opts->dupmark) {
+        if (!dupmark_add(opts->dupmark, b, input)) {
+            dprintf(STDERR_FILENO, "Out of memory\n");
+            return false;
+        }
+        return release_records(opts, false);
+    }
+    return write_record(opts, input, b, selected);
+}
+
+// Merge whatever the inputs currently yield (whole files, or one region when
+// iterators are set), optionally from only the inputs marked in include.
+// prev is the preceding region on the same contig, if any, so records that
+// straddle both are only written once.
+bool merge_pass(state_t* opts, const bool* include, const region_t* region, const region_t* prev) {
     bam1_t** file_read = calloc(opts->input_count, sizeof(bam1_t*));
     size_t files_to_merge = opts->input_count;
     // initialise the first read for each input file
     for (size_t i = 0; i < opts->input_count; i++) {
+        if (include && !include[i]) {
+            files_to_merge--;
+            continue;
+        }
         file_read[i] = bam_init1();  
         // Read the first record
-        if (sam_read1(opts->input_file[i], opts->input_header[i], file_read[i]) < 0) {
+        if (!read_next(opts, i, file_read[i])) {
             // Nothing more to read?  Ignore this file
             bam_destroy1(file_read[i]);
             file_read[i] = NULL;
             files_to_merge--;
-        } else {
-            if (opts->input_trans[i]) {
-                // Translate the tid and mate tid but only if they're not null values
-                if (file_read[i]->core.tid != -1) {
-                    file_read[i]->core.tid = opts->input_trans[i][file_read[i]->core.tid];
-                }
-                if (file_read[i]->core.mtid != -1) {
-                    file_read[i]->core.mtid = opts->input_trans[i][file_read[i]->core.mtid];
-                }
-            }
         }
     }
 
-    while (files_to_merge > 0) {
+    bool ok = true;
+    while (ok && files_to_merge > 0) {
+        double before = 0.0, selected = 0.0;
+        if (opts->stats) before = stats_now();
         size_t i = selectRead(file_read, opts->input_count);
+        BRUNEL_PROBE3(record_selected, i, file_read[i]->core.tid, file_read[i]->core.pos);
+        if (opts->stats) {
+            selected = stats_now();
+            opts->stats->merge_time += selected - before;
+        }
+        bool wanted = true;
+        if (region && region->tid != -1) {
+            int32_t pos = file_read[i]->core.pos;
+            if (opts->region_starts) {
+                wanted = pos >= region->beg;
+            } else if (prev) {
+                wanted = pos >= prev->end;
+            }
+        }
         // Write the read out and replace it with the next one to process
-        sam_write1(opts->output_file, opts->output_header, file_read[i]);
-        if (sam_read1(opts->input_file[i], opts->input_header[i], file_read[i]) < 0) {
+        if (wanted) ok = emit_record(opts, i, file_read[i], selected);
+        if (!read_next(opts, i, file_read[i])) {
             // Nothing more to read?  Ignore this file in future
             bam_destroy1(file_read[i]);
             file_read[i] = NULL;
             files_to_merge--;
-        } else {
-            if (opts->input_trans[i]) {
-                // Translate the tid and mate tid but only if they're not null values
-                if (file_read[i]->core.tid != -1) {
-                    file_read[i]->core.tid = opts->input_trans[i][file_read[i]->core.tid];
-                }
-                if (file_read[i]->core.mtid != -1) {
-                    file_read[i]->core.mtid = opts->input_trans[i][file_read[i]->core.mtid];
-                }
-            }
         }
     }
 
@@ -314,24 +752,153 @@ bool merge(state_t* opts) {
     for (size_t i = 0; i < opts->input_count; i++) {
         if (file_read[i]) { bam_destroy1(file_read[i]); }
     }
+    free(file_read);
+
+    return ok;
+}
 
+// Reopen input i so that it is positioned just after its header again
+bool reopen_input(state_t* opts, size_t i) {
+    sam_close(opts->input_file[i]);
+    opts->input_file[i] = sam_open(opts->input_name[i], "rb", 0);
+    if (opts->input_file[i] == NULL) {
+        dprintf(STDERR_FILENO, "Could not reopen input file: %s\r\n", opts->input_name[i]);
+        return false;
+    }
+    bam_hdr_destroy(sam_hdr_read(opts->input_file[i]));
     return true;
 }
 
+static int extent_cmp(const void* a, const void* b) {
+    const input_extent_t* ea = a;
+    const input_extent_t* eb = b;
+    if (ea->first != eb->first) return ea->first < eb->first ? -1 : 1;
+    return ea->input < eb->input ? -1 : 1;
+}
+
+// Gather inputs that cover disjoint, ordered stretches of the genome by
+// copying their BGZF blocks.  Inputs whose extents overlap are grouped and
+// merged record by record as usual, so only the boundaries cost CPU.
+bool merge_concat(state_t* opts) {
+    input_extent_t* extent = calloc(opts->input_count, sizeof(input_extent_t));
+    size_t n = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < opts->input_count; i++) {
+        extent[n].input = i;
+        ok = concat_extent(opts->input_file[i], opts->input_header[i], opts->input_index[i], &extent[n]);
+        if (ok && !extent[n].empty) n++;
+        ok = reopen_input(opts, i) && ok;
+    }
+    if (!ok) {
+        // Fall back to an ordinary merge if any extent could not be worked out
+        free(extent);
+        for (size_t i = 0; i < opts->input_count; i++) {
+            if (!reopen_input(opts, i)) return false;
+        }
+        return merge_pass(opts, NULL, NULL, NULL);
+    }
+    qsort(extent, n, sizeof(input_extent_t), extent_cmp);
+
+    bool* include = calloc(opts->input_count, sizeof(bool));
+    for (size_t g = 0; ok && g < n; ) {
+        size_t h = g + 1;
+        uint64_t end = extent[g].last;
+        while (h < n && extent[h].first < end) {
+            if (extent[h].last > end) end = extent[h].last;
+            h++;
+        }
+        if (h == g + 1) {
+            uint64_t bytes = 0;
+            ok = concat_copy(opts->input_file[extent[g].input], opts->input_name[extent[g].input], opts->output->out[0].file, &bytes);
+            if (opts->stats) {
+                opts->stats->concat_bytes += bytes;
+                opts->stats->input_records[extent[g].input] += extent[g].records;
+                opts->stats->records_out += extent[g].records;
+            }
+        } else {
+            memset(include, 0, opts->input_count * sizeof(bool));
+            for (size_t k = g; k < h; k++) include[extent[k].input] = true;
+            ok = merge_pass(opts, include, NULL, NULL);
+        }
+        g = h;
+    }
+    free(include);
+    free(extent);
+    return ok;
+}
+
+bool merge_regions(state_t* opts) {
+    for (size_t r = 0; r < opts->regions->count; r++) {
+        const region_t* region = &opts->regions->region[r];
+        const region_t* prev = NULL;
+        if (r > 0 && opts->regions->region[r-1].tid == region->tid) prev = &opts->regions->region[r-1];
+        seek_region(opts, region);
+        if (!merge_pass(opts, NULL, region, prev)) return false;
+    }
+    return true;
+}
+
+bool merge(state_t* opts) {
+    bool ok;
+    if (opts->concat) ok = merge_concat(opts);
+    else if (!opts->regions) ok = merge_pass(opts, NULL, NULL, NULL);
+    else ok = merge_regions(opts);
+
+    if (ok && opts->dupmark) {
+        ok = release_records(opts, true);
+        if (opts->stats) {
+            opts->stats->dup_examined = opts->dupmark->examined;
+            opts->stats->dup_marked = opts->dupmark->marked;
+        }
+    }
+    if (ok && opts->flagstat) ok = flagstat_write(opts->flagstat, opts->qc_prefix);
+    if (ok && opts->coverage) ok = coverage_close(opts->coverage);
+    if (ok && opts->input_checksum) {
+        ok = checksum_write(opts->checksum_file, opts->input_name, opts->input_checksum, opts->input_count,
+                            &opts->output_checksum, opts->checksum_seq);
+    }
+    return ok;
+}
+
 void cleanup_state(state_t* status) {
-    sam_close(status->output_file);
+    output_close(status->output);
     for (size_t i = 0; i < status->input_count; i++) {
         sam_close(status->input_file[i]);
     }
     free(status->input_file);
+    if (status->input_index) {
+        for (size_t i = 0; i < status->input_count; i++) {
+            if (status->input_iter && status->input_iter[i]) hts_itr_destroy(status->input_iter[i]);
+            if (status->input_index[i]) hts_idx_destroy(status->input_index[i]);
+        }
+        free(status->input_iter);
+        free(status->input_index);
+    }
+    region_list_free(status->regions);
+    ref_window_free(status->reference);
+    dupmark_free(status->dupmark);
+    flagstat_free(status->flagstat);
+    coverage_free(status->coverage);
+    free(status->input_checksum);
+    stats_free(status->stats);
 }
 
 void cleanup_opts(parsed_opts_t* opts) {
     free(opts->output_name);
+    free(opts->split_contigs);
+    free(opts->reference);
+    free(opts->qc_prefix);
+    free(opts->coverage_prefix);
+    free(opts->checksum_file);
     for (size_t i = 0; i < opts->input_count; i++) {
         free(opts->input_name[i]);
     }
     free(opts->input_name);
+    for (size_t i = 0; i < opts->region_count; i++) {
+        free(opts->region[i]);
+    }
+    free(opts->region);
+    free(opts->regions_file);
 }
 
 int main(int argc, char** argv) {
@@ -343,7 +910,17 @@ int main(int argc, char** argv) {
     
     if (!merge(status)) return -1;
     
+    // Closing the output flushes the last BGZF blocks, so time it and report afterwards
+    merge_stats_t* stats = status->stats;
+    status->stats = NULL;
+    double close_start = stats ? stats_now() : 0.0;
     cleanup_state(status);
+    if (stats) {
+        stats->end_time = stats_now();
+        stats->close_time = stats->end_time - close_start;
+        stats_report(stats, opts->input_name, stderr);
+        stats_free(stats);
+    }
     cleanup_opts(opts);
       
     return 0;
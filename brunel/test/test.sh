@@ -1 +1,212 @@
-../src/brunel test_header.sam test_1.bam:trans.txt test_2.bam test_3.bam out.bam
+#!/bin/sh
+# Run from brunel/test after building; needs samtools to make and read BAMs.
+SAMTOOLS=${SAMTOOLS:-samtools}
+BRUNEL=../src/brunel
+status=0
+
+# compare the records of a BAM (in a region, if given, which needs its
+# index) with those of an expected SAM
+check() {
+    if "$SAMTOOLS" view "$1" $4 | diff - "$2.records" > /dev/null; then
+        echo "ok: $3"
+    else
+        echo "FAIL: $3"
+        status=1
+    fi
+}
+
+for sam in *.sam; do
+    grep -v '^@' "$sam" > "$sam.records"
+done
+
+$BRUNEL test_header.sam test_1.bam:trans.txt test_2.bam test_3.bam out.bam
+check out.bam correct.sam "merge"
+$BRUNEL --stats test_header.sam test_1.bam:trans.txt test_2.bam test_3.bam out_stats.bam
+check out_stats.bam correct.sam "merge with --stats"
+
+# disjoint indexed shards are copied block by block; the result must hold the
+# same records as a record by record merge
+for shard in concat_a concat_b; do
+    "$SAMTOOLS" view -b -o $shard.bam $shard.sam && "$SAMTOOLS" index $shard.bam
+done
+$BRUNEL --stats concat_a.sam concat_b.bam concat_a.bam concat.bam 2> concat.stats
+$BRUNEL --no-concat concat_a.sam concat_b.bam concat_a.bam noconcat.bam
+"$SAMTOOLS" view noconcat.bam > noconcat.bam.records
+check concat.bam noconcat.bam "concatenation matches --no-concat"
+if grep -q '^concatenated_bytes	[1-9]' concat.stats; then
+    echo "ok: shards concatenated"
+else
+    echo "FAIL: shards concatenated"
+    status=1
+fi
+# copied shards still count towards the records in and out
+records=$(($(cat concat_a.sam.records concat_b.sam.records | wc -l)))
+if grep -q "^records_in	$records\$" concat.stats && grep -q "^records_out	$records\$" concat.stats; then
+    echo "ok: concatenated records counted"
+else
+    echo "FAIL: concatenated records counted"
+    status=1
+fi
+
+# MD and NM are recalculated against a small FASTA: stale tags are replaced,
+# correct ones and unmapped records are left as they were, and so are those
+# on c2, which the FASTA holds less of than the header says (with one warning)
+"$SAMTOOLS" view -b -o calmd.bam calmd.sam
+$BRUNEL --reference calmd_ref.fa calmd.sam calmd.bam calmd_out.bam 2> calmd.err
+check calmd_out.bam calmd_correct.sam "MD/NM recalculation"
+if [ "$(grep -c 'contig c2 is shorter' calmd.err)" = 1 ]; then
+    echo "ok: short contig warned about once"
+else
+    echo "FAIL: short contig warned about once"
+    status=1
+fi
+
+# duplicates of a pair, of single ends and of single ends lying where a pair
+# starts; the mate of a marked pair is marked when it is released, even when
+# it comes first, and a placed unmapped mate takes its mapped read's flag
+"$SAMTOOLS" view -b -o dupmark.bam dupmark.sam
+$BRUNEL --mark-duplicates dupmark.sam dupmark.bam dupmark_out.bam
+check dupmark_out.bam dupmark_correct.sam "duplicate marking"
+
+# scattered outputs, each indexed as it is written; a read group ID with a
+# '/' must not take its output into another directory
+"$SAMTOOLS" view -b -o split.bam split.sam
+awk '$3 == "c1"' split.sam.records > split_c1.records
+awk '$3 == "c2"' split.sam.records > split_c2.records
+awk '$3 == "c3"' split.sam.records > split_c3.records
+awk '$3 == "c2" || $3 == "*"' split.sam.records > split_other.records
+grep '	RG:Z:rgA$' split.sam.records > split_rgA.records
+grep '	RG:Z:lane/2$' split.sam.records > split_lane2.records
+grep -v '	RG:Z:' split.sam.records > split_norg.records
+$BRUNEL --split-contigs split_groups.txt split.sam split.bam split_contigs.bam
+check split_contigs.0.bam split_c1 "--split-contigs first group"
+check split_contigs.0.bam split_c1 "--split-contigs first group index" c1
+check split_contigs.1.bam split_c3 "--split-contigs second group index" c3
+check split_contigs.other.bam split_other "--split-contigs other"
+$BRUNEL --split-rg split.sam split.bam split_rg.bam
+check split_rg.rgA.bam split_rgA "--split-rg"
+check split_rg.lane_2.bam split_lane2 "--split-rg with '/' in an ID"
+check split_rg.unknown_rg.bam split_norg "--split-rg unknown"
+# every record is past the size limit, so each goes to a part of its own
+$BRUNEL --split-bytes 1 split.sam split.bam split_bytes.bam
+part=0
+: > split_bytes.records
+while [ -f split_bytes.$part.bam ]; do
+    "$SAMTOOLS" view split_bytes.$part.bam >> split_bytes.records
+    part=$((part + 1))
+done
+if [ $part -gt 2 ] && diff split_bytes.records split.sam.records > /dev/null; then
+    echo "ok: --split-bytes"
+else
+    echo "FAIL: --split-bytes"
+    status=1
+fi
+$BRUNEL --write-index --threads 2 split.sam split.bam split_indexed.bam
+check split_indexed.bam split_c2 "--write-index with --threads" c2
+
+# regions that overlap or abut are joined, so each record is written once and
+# the output is what one region covering them all selects; with
+# --region-starts, disjoint jobs concatenate to the whole contig
+"$SAMTOOLS" index out.bam
+"$SAMTOOLS" view out.bam 2:5-20 > region_joined.records
+"$SAMTOOLS" view out.bam 2 > region_contig.records
+$BRUNEL --region 2:10-20 --region 2:5-12 test_header.sam out.bam region_overlap.bam
+check region_overlap.bam region_joined "overlapping regions"
+printf '2\t4\t12\n2\t12\t20\n' > region_abut.bed
+$BRUNEL --regions-file region_abut.bed test_header.sam out.bam region_abut.bam
+check region_abut.bam region_joined "abutting regions"
+"$SAMTOOLS" view out.bam 2 | awk '$4 >= 11' > region_starts_late.records
+$BRUNEL --region-starts --region 2:11-40 test_header.sam out.bam region_starts_late.bam
+check region_starts_late.bam region_starts_late "--region-starts leaves out records starting before the region"
+$BRUNEL --region-starts --region 2:1-10 test_header.sam out.bam region_starts_early.bam
+"$SAMTOOLS" view region_starts_early.bam > region_starts.records
+"$SAMTOOLS" view region_starts_late.bam >> region_starts.records
+if diff region_starts.records region_contig.records > /dev/null; then
+    echo "ok: --region-starts jobs concatenate to the whole contig"
+else
+    echo "FAIL: --region-starts jobs concatenate to the whole contig"
+    status=1
+fi
+
+# QC summaries written during the merge agree with samtools' own over the
+# output, on records with pairs, duplicates and placed unmapped mates; the
+# JSON MAPQ histogram counts every mapped record once
+$BRUNEL --mark-duplicates --qc dupmark_qc dupmark.sam dupmark.bam dupmark_qc.bam
+"$SAMTOOLS" index dupmark_qc.bam
+"$SAMTOOLS" flagstat dupmark_qc.bam > dupmark_qc.samtools.flagstat
+"$SAMTOOLS" idxstats dupmark_qc.bam > dupmark_qc.samtools.idxstats
+if [ -s dupmark_qc.flagstat ] && ! grep -v -x -F -f dupmark_qc.samtools.flagstat dupmark_qc.flagstat > /dev/null; then
+    echo "ok: --qc flagstat"
+else
+    echo "FAIL: --qc flagstat"
+    status=1
+fi
+if diff dupmark_qc.samtools.idxstats dupmark_qc.idxstats > /dev/null; then
+    echo "ok: --qc idxstats"
+else
+    echo "FAIL: --qc idxstats"
+    status=1
+fi
+records=$(($(wc -l < dupmark.sam.records)))
+mapped=$(($(awk '$6 != "*"' dupmark.sam.records | wc -l)))
+histogram=$(sed -n 's/.*"qc_passed": \[\(.*\)\].*/\1/p' dupmark_qc.qc.json | tr ',' '\n' | awk '{ n += $1 } END { print n + 0 }')
+if grep -q "\"total\": \[$records, 0\]" dupmark_qc.qc.json && [ "$histogram" = $mapped ]; then
+    echo "ok: --qc JSON"
+else
+    echo "FAIL: --qc JSON"
+    status=1
+fi
+
+# coverage of the output: deletions, duplicates and unmapped records add no
+# depth, a read past the end of its contig is cut short, an empty contig is
+# one zero run, and equal windows run together
+"$SAMTOOLS" view -b -o coverage.bam coverage.sam
+$BRUNEL --coverage coverage_1 --coverage-window 1 coverage.sam coverage.bam coverage_1.bam
+$BRUNEL --coverage coverage_5 --coverage-window 5 coverage.sam coverage.bam coverage_5.bam
+$BRUNEL --coverage coverage_bin --coverage-window 5 --coverage-binary coverage.sam coverage.bam coverage_bin.bam
+if diff coverage_1.bedGraph coverage_correct.bedGraph > /dev/null && diff coverage_1.depth coverage_correct.depth > /dev/null; then
+    echo "ok: --coverage per base"
+else
+    echo "FAIL: --coverage per base"
+    status=1
+fi
+if diff coverage_5.bedGraph coverage_window_correct.bedGraph > /dev/null; then
+    echo "ok: --coverage-window"
+else
+    echo "FAIL: --coverage-window"
+    status=1
+fi
+# magic, window and contig count, then per contig its name, length, window
+# count and a float per window: 4 + 2 + 1 windows over c1, c2 and c3
+if [ "$(($(wc -c < coverage_bin.cov)))" = 84 ] && [ ! -e coverage_bin.bedGraph ]; then
+    echo "ok: --coverage-binary"
+else
+    echo "FAIL: --coverage-binary"
+    status=1
+fi
+
+# read checksums: the output holds exactly the reads of the inputs, with and
+# without their sequences
+sets() {
+    awk '$1 == "inputs" || $1 == "output" { print $2 "\t" $3 "\t" $4 }' "$1"
+}
+records=$(($(wc -l < correct.sam.records)))
+$BRUNEL --checksum checksum.txt test_header.sam test_1.bam:trans.txt test_2.bam test_3.bam checksum.bam
+$BRUNEL --checksum checksum_seq.txt --checksum-seq test_header.sam test_1.bam:trans.txt test_2.bam test_3.bam checksum_seq.bam
+for file in checksum.txt checksum_seq.txt; do
+    if [ "$(sets $file | uniq)" = "$(sets $file | head -1)" ] && [ "$(sets $file | head -1 | cut -f1)" = $records ]; then
+        echo "ok: output reads match the inputs in $file"
+    else
+        echo "FAIL: output reads match the inputs in $file"
+        status=1
+    fi
+done
+if grep -q '^#set.*+SEQ' checksum_seq.txt && ! diff checksum.txt checksum_seq.txt > /dev/null; then
+    echo "ok: --checksum-seq"
+else
+    echo "FAIL: --checksum-seq"
+    status=1
+fi
+
+rm -f *.records
+exit $status
@@ -0,0 +1,395 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of BridgeBuilder.
+//
+// BridgeBuilder is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+
+// Asynchronous output through a pipe and a writer thread submitting to
+// io_uring, so a process writing large BAMs to fast storage does not stall
+// in write(2) while the kernel catches up with writeback.  io_uring is used
+// through its system calls directly, so liburing is not needed.  Building
+// with BB_ASYNCOUT_NO_URING leaves it out, so the pwrite path can be tested.
+
+// Linux fixes
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && !defined(BB_ASYNCOUT_NO_URING)
+#define ASYNC_OUT_URING 1
+#endif
+#endif
+
+#include "bb_asyncout.h"
+
+// The tracepoint
+//   output_block_written(fd, offset, length)  a block reached the file
+// is under the provider of the program this is built into, which its
+// src/Makefile.am gives as BB_PROBE_PROVIDER
+#if defined(HAVE_SYS_SDT_H) && defined(BB_PROBE_PROVIDER)
+#include <sys/sdt.h>
+#define BB_PROBE3(name, a, b, c) DTRACE_PROBE3(BB_PROBE_PROVIDER, name, a, b, c)
+#else
+#define BB_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+// Buffer and O_DIRECT alignment
+#define ASYNC_OUT_ALIGN 4096
+
+struct async_block {
+    char* data;
+    size_t len;       // bytes to write, padded to ASYNC_OUT_ALIGN for a direct tail
+    size_t done;      // bytes written so far
+    uint64_t offset;  // file offset of data[0]
+    bool busy;
+    struct iovec iov;
+};
+
+#ifdef ASYNC_OUT_URING
+struct uring {
+    int fd;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+#endif
+
+struct async_out {
+    char* filename;
+    char path[32];      // /dev/fd/N of the pipe's write end
+    int pipe_read;
+    int pipe_write;
+    int fd;
+    bool direct;
+    int depth;
+    struct async_block* block;
+    int in_flight;
+    uint64_t size;      // bytes taken from the pipe so far
+    int error;          // first errno from reading the pipe or writing the file
+    bool use_uring;
+#ifdef ASYNC_OUT_URING
+    struct uring ring;
+#endif
+    pthread_t thread;
+};
+
+static void set_error(async_out_t* out, int error) {
+    if (!out->error) out->error = error;
+}
+
+#ifdef ASYNC_OUT_URING
+static bool uring_init(struct uring* ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) return false;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single ? ring->sq_ring
+        : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        if (!single && ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return false;
+    }
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void uring_free(struct uring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Queue the unwritten part of block i as a single write
+static void uring_submit(async_out_t* out, int i) {
+    struct uring* ring = &out->ring;
+    struct async_block* b = &out->block[i];
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    b->iov.iov_base = b->data + b->done;
+    b->iov.iov_len = b->len - b->done;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = out->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&b->iov;
+    sqe->len = 1;
+    sqe->off = b->offset + b->done;
+    sqe->user_data = i;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        // Not submitted, so take it back off the ring
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        set_error(out, errno);
+        b->busy = false;
+        return;
+    }
+    out->in_flight++;
+}
+
+// Handle completed writes, waiting for at least one
+static void uring_reap(async_out_t* out) {
+    struct uring* ring = &out->ring;
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        // The writes already submitted still belong to the kernel, which
+        // posts their completions to the mapped ring without being asked,
+        // so keep their blocks busy and look again after a pause
+        set_error(out, errno);
+        struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, NULL);
+    }
+
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        struct async_block* b = &out->block[cqe->user_data];
+        int res = cqe->res;
+        head++;
+        out->in_flight--;
+        if (res <= 0) {
+            set_error(out, res < 0 ? -res : EIO);
+            b->busy = false;
+        } else if ((b->done += res) < b->len && !out->error) {
+            uring_submit(out, cqe->user_data);  // short write: queue the rest
+        } else {
+            if (b->done == b->len) BB_PROBE3(output_block_written, out->fd, b->offset, b->len);
+            b->busy = false;
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+// Write block i, through io_uring if there is one
+static void write_block(async_out_t* out, int i) {
+    struct async_block* b = &out->block[i];
+    b->done = 0;
+    b->busy = true;
+#ifdef ASYNC_OUT_URING
+    if (out->use_uring) {
+        uring_submit(out, i);
+        return;
+    }
+#endif
+    while (b->done < b->len) {
+        ssize_t n = pwrite(out->fd, b->data + b->done, b->len - b->done, b->offset + b->done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            set_error(out, n < 0 ? errno : EIO);
+            break;
+        }
+        b->done += n;
+    }
+    if (b->done == b->len) BB_PROBE3(output_block_written, out->fd, b->offset, b->len);
+    b->busy = false;
+}
+
+// A block not being written, waiting for one if need be
+static int free_block(async_out_t* out) {
+    for (;;) {
+        for (int i = 0; i < out->depth; i++) {
+            if (!out->block[i].busy) return i;
+        }
+#ifdef ASYNC_OUT_URING
+        uring_reap(out);
+#endif
+    }
+}
+
+// Fill blocks from the pipe until it is closed, and write each one out.
+// After an error the pipe is still drained, so the writer never blocks.
+static void* writer(void* arg) {
+    async_out_t* out = arg;
+    bool eof = false;
+    while (!eof) {
+        int i = free_block(out);
+        struct async_block* b = &out->block[i];
+        b->len = 0;
+        while (b->len < ASYNC_OUT_BLOCK_SIZE) {
+            ssize_t n = read(out->pipe_read, b->data + b->len, ASYNC_OUT_BLOCK_SIZE - b->len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (n < 0) set_error(out, errno);
+                eof = true;
+                break;
+            }
+            b->len += n;
+        }
+        if (b->len == 0 || out->error) continue;
+        b->offset = out->size;
+        out->size += b->len;
+        if (out->direct && b->len % ASYNC_OUT_ALIGN != 0) {
+            // O_DIRECT writes whole aligned blocks; the padding is truncated at the end
+            size_t padded = (b->len + ASYNC_OUT_ALIGN - 1) / ASYNC_OUT_ALIGN * ASYNC_OUT_ALIGN;
+            memset(b->data + b->len, 0, padded - b->len);
+            b->len = padded;
+        }
+        write_block(out, i);
+    }
+#ifdef ASYNC_OUT_URING
+    while (out->in_flight > 0) uring_reap(out);
+#endif
+    if (out->direct && !out->error && ftruncate(out->fd, out->size) != 0) set_error(out, errno);
+    return NULL;
+}
+
+async_out_t* async_out_open(const char* filename, int depth, bool direct) {
+    async_out_t* out = calloc(1, sizeof(async_out_t));
+    if (!out) return NULL;
+    out->filename = strdup(filename);
+    out->depth = depth > 0 ? depth : 1;
+    out->pipe_read = out->pipe_write = out->fd = -1;
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (direct) {
+        out->fd = open(filename, flags | O_DIRECT, 0666);
+        if (out->fd < 0 && errno == EINVAL) {
+            dprintf(STDERR_FILENO, "Warning: %s does not support direct I/O, writing through the page cache\n", filename);
+        } else {
+            out->direct = true;
+        }
+    }
+#endif
+    if (!out->direct) out->fd = open(filename, flags, 0666);
+    if (out->fd < 0) {
+        dprintf(STDERR_FILENO, "Could not open output file: %s\n", filename);
+        free(out->filename);
+        free(out);
+        return NULL;
+    }
+
+    out->block = calloc(out->depth, sizeof(struct async_block));
+    bool ok = out->block != NULL;
+    for (int i = 0; ok && i < out->depth; i++) {
+        ok = posix_memalign((void**)&out->block[i].data, ASYNC_OUT_ALIGN, ASYNC_OUT_BLOCK_SIZE) == 0;
+    }
+    int fds[2];
+    if (ok && pipe(fds) == 0) {
+        out->pipe_read = fds[0];
+        out->pipe_write = fds[1];
+#ifdef F_SETPIPE_SZ
+        // A bigger pipe lets htslib run further ahead; the system limit may refuse it
+        fcntl(out->pipe_write, F_SETPIPE_SZ, ASYNC_OUT_BLOCK_SIZE);
+#endif
+        snprintf(out->path, sizeof(out->path), "/dev/fd/%d", out->pipe_write);
+    } else {
+        ok = false;
+    }
+#ifdef ASYNC_OUT_URING
+    out->use_uring = ok && uring_init(&out->ring, out->depth);
+#endif
+    if (ok && pthread_create(&out->thread, NULL, writer, out) != 0) ok = false;
+    if (!ok) {
+        dprintf(STDERR_FILENO, "Could not start writing %s\n", filename);
+        if (out->pipe_read >= 0) close(out->pipe_read);
+        if (out->pipe_write >= 0) close(out->pipe_write);
+#ifdef ASYNC_OUT_URING
+        if (out->use_uring) uring_free(&out->ring);
+#endif
+        for (int i = 0; out->block && i < out->depth; i++) free(out->block[i].data);
+        free(out->block);
+        close(out->fd);
+        free(out->filename);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+const char* async_out_path(const async_out_t* out) {
+    return out->path;
+}
+
+bool async_out_uring(const async_out_t* out) {
+    return out->use_uring;
+}
+
+bool async_out_direct(const async_out_t* out) {
+    return out->direct;
+}
+
+bool async_out_close(async_out_t* out) {
+    if (!out) return true;
+    close(out->pipe_write);
+    pthread_join(out->thread, NULL);
+    close(out->pipe_read);
+#ifdef ASYNC_OUT_URING
+    if (out->use_uring) uring_free(&out->ring);
+#endif
+    if (close(out->fd) != 0) set_error(out, errno);
+    bool ok = out->error == 0;
+    if (!ok) dprintf(STDERR_FILENO, "Could not write output file %s: %s\n", out->filename, strerror(out->error));
+    for (int i = 0; i < out->depth; i++) free(out->block[i].data);
+    free(out->block);
+    free(out->filename);
+    free(out);
+    return ok;
+}
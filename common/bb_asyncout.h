@@ -0,0 +1,49 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of BridgeBuilder.
+//
+// BridgeBuilder is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+
+#ifndef BB_ASYNCOUT_H
+#define BB_ASYNCOUT_H
+
+#include <stdbool.h>
+
+// Asynchronous file output, used by binnie and brunel.  htslib writes the
+// compressed stream into a pipe, and a writer thread drains the pipe into
+// fixed size blocks that it submits to the file through io_uring with at
+// most a set number in flight, so the threads producing records only wait
+// when the pipe and every block are full.  Without io_uring (not built with
+// linux/io_uring.h, or refused by the kernel) the writer thread writes the
+// blocks itself with pwrite(2).
+typedef struct async_out async_out_t;
+
+// Size of each block written, a multiple of any O_DIRECT alignment
+#define ASYNC_OUT_BLOCK_SIZE (1 << 20)
+
+// Open filename for writing with up to depth blocks in flight, bypassing
+// the page cache if direct.  Give async_out_path to sam_open in its place.
+async_out_t* async_out_open(const char* filename, int depth, bool direct);
+const char* async_out_path(const async_out_t* out);
+
+// Whether out writes through io_uring, and whether it bypasses the page
+// cache (the file system may refuse direct I/O)
+bool async_out_uring(const async_out_t* out);
+bool async_out_direct(const async_out_t* out);
+
+// Call once the htsFile written to async_out_path is closed: waits for
+// every block to reach the file.  Returns false if any write failed.
+bool async_out_close(async_out_t* out);
+
+#endif
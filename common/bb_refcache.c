@@ -0,0 +1,210 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of BridgeBuilder.
+//
+// BridgeBuilder is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+// Reader for reference caches, built into both brindley and brunel.  The
+// file is validated once when it is opened, so lookups need no checks.
+
+#include "config.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bb_refcache.h"
+
+struct refcache {
+    const uint8_t* base;
+    size_t size;
+    const rc_header_t* header;
+    const rc_contig_t* contigs;
+    const uint32_t* order;
+};
+
+// The four bases packed in each possible byte, base i in bits 2 * i
+static char byte_bases[256][4];
+
+static void init_tables(void) {
+    static const char bases[] = "ACGT";
+    for (int i = 0; i < 256; i++) {
+        for (int j = 0; j < 4; j++) byte_bases[i][j] = bases[(i >> (2 * j)) & 3];
+    }
+}
+
+bool rc_is_cache(const char* filename) {
+    char magic[RC_MAGIC_LENGTH];
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) return false;
+    bool is_cache = fread(magic, 1, RC_MAGIC_LENGTH, fp) == RC_MAGIC_LENGTH
+        && memcmp(magic, RC_MAGIC, RC_MAGIC_LENGTH) == 0;
+    fclose(fp);
+    return is_cache;
+}
+
+static bool in_bounds(const refcache_t* rc, uint64_t offset, uint64_t len) {
+    return offset <= rc->size && len <= rc->size - offset;
+}
+
+// Runs must be non-empty, in order, apart and within the contig, as
+// rc_fetch writes each one into the caller's buffer unchecked
+static bool runs_valid(const refcache_t* rc, uint64_t offset, uint32_t count, uint64_t length) {
+    const rc_run_t* runs = (const rc_run_t*)(rc->base + offset);
+    uint64_t prev_end = 0;
+    for (uint32_t r = 0; r < count; r++) {
+        if (runs[r].start >= runs[r].end || runs[r].end > length || (r > 0 && runs[r].start < prev_end)) return false;
+        prev_end = runs[r].end;
+    }
+    return true;
+}
+
+// Check every offset in the file lies within it and every run within its
+// contig, so lookups need not, and point at the contig table and name order
+static bool rc_valid(refcache_t* rc) {
+    const rc_header_t* h = rc->header;
+    if (memcmp(h->magic, RC_MAGIC, RC_MAGIC_LENGTH) != 0 || h->byte_order != RC_BYTE_ORDER
+        || h->file_size != rc->size
+        || !in_bounds(rc, h->contigs_offset, (uint64_t)h->n_contigs * sizeof(rc_contig_t))
+        || !in_bounds(rc, h->order_offset, (uint64_t)h->n_contigs * sizeof(uint32_t))
+        || h->contigs_offset % 8 != 0 || h->order_offset % 8 != 0) {
+        return false;
+    }
+    rc->contigs = (const rc_contig_t*)(rc->base + h->contigs_offset);
+    rc->order = (const uint32_t*)(rc->base + h->order_offset);
+    for (uint32_t i = 0; i < h->n_contigs; i++) {
+        const rc_contig_t* c = &rc->contigs[i];
+        if (c->length >= UINT32_MAX || rc->order[i] >= h->n_contigs
+            || c->name_offset >= rc->size
+            || !memchr(rc->base + c->name_offset, '\0', rc->size - c->name_offset)
+            || !in_bounds(rc, c->seq_offset, (c->length + 3) / 4)
+            || !in_bounds(rc, c->n_offset, (uint64_t)c->n_count * sizeof(rc_run_t))
+            || !in_bounds(rc, c->mask_offset, (uint64_t)c->mask_count * sizeof(rc_run_t))
+            || c->n_offset % 8 != 0 || c->mask_offset % 8 != 0
+            || !runs_valid(rc, c->n_offset, c->n_count, c->length)
+            || !runs_valid(rc, c->mask_offset, c->mask_count, c->length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+refcache_t* rc_open(const char* filename) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(rc_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    refcache_t* rc = calloc(1, sizeof(refcache_t));
+    if (!rc) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    rc->base = base;
+    rc->size = st.st_size;
+    rc->header = base;
+    if (!rc_valid(rc)) {
+        rc_close(rc);
+        return NULL;
+    }
+    init_tables();
+    return rc;
+}
+
+uint32_t rc_ncontigs(const refcache_t* rc) {
+    return rc->header->n_contigs;
+}
+
+const char* rc_name(const refcache_t* rc, uint32_t i) {
+    return (const char*)rc->base + rc->contigs[i].name_offset;
+}
+
+uint64_t rc_length(const refcache_t* rc, uint32_t i) {
+    return rc->contigs[i].length;
+}
+
+const uint8_t* rc_md5(const refcache_t* rc, uint32_t i) {
+    return rc->contigs[i].md5;
+}
+
+// Binary search of the name order
+int64_t rc_find(const refcache_t* rc, const char* name) {
+    uint32_t lo = 0, hi = rc->header->n_contigs;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(rc_name(rc, rc->order[mid]), name);
+        if (cmp == 0) return rc->order[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+// First run ending after beg
+static uint32_t first_run(const rc_run_t* runs, uint32_t count, uint64_t beg) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (runs[mid].end <= beg) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Unpacks whole bytes at a time through byte_bases, then overwrites the N
+// runs and, if asked, lower-cases the soft-masked ones
+uint64_t rc_fetch(const refcache_t* rc, uint32_t i, uint64_t beg, uint64_t end, bool soft_mask, char* buf) {
+    const rc_contig_t* c = &rc->contigs[i];
+    const uint8_t* seq = rc->base + c->seq_offset;
+    if (end > c->length) end = c->length;
+    if (beg >= end) return 0;
+
+    uint64_t pos = beg;
+    char* out = buf;
+    for (; pos < end && pos % 4 != 0; pos++) *out++ = byte_bases[seq[pos / 4]][pos % 4];
+    for (; pos + 4 <= end; pos += 4, out += 4) memcpy(out, byte_bases[seq[pos / 4]], 4);
+    for (; pos < end; pos++) *out++ = byte_bases[seq[pos / 4]][pos % 4];
+
+    const rc_run_t* n_runs = (const rc_run_t*)(rc->base + c->n_offset);
+    for (uint32_t r = first_run(n_runs, c->n_count, beg); r < c->n_count && n_runs[r].start < end; r++) {
+        uint64_t from = n_runs[r].start > beg ? n_runs[r].start : beg;
+        uint64_t to = n_runs[r].end < end ? n_runs[r].end : end;
+        memset(buf + (from - beg), 'N', to - from);
+    }
+    if (soft_mask) {
+        const rc_run_t* mask_runs = (const rc_run_t*)(rc->base + c->mask_offset);
+        for (uint32_t r = first_run(mask_runs, c->mask_count, beg); r < c->mask_count && mask_runs[r].start < end; r++) {
+            uint64_t from = mask_runs[r].start > beg ? mask_runs[r].start : beg;
+            uint64_t to = mask_runs[r].end < end ? mask_runs[r].end : end;
+            for (pos = from; pos < to; pos++) buf[pos - beg] = tolower((unsigned char)buf[pos - beg]);
+        }
+    }
+    return end - beg;
+}
+
+void rc_close(refcache_t* rc) {
+    if (!rc) return;
+    munmap((void*)rc->base, rc->size);
+    free(rc);
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2013 Genome Research Limited.
+//
+// This file is part of BridgeBuilder.
+//
+// BridgeBuilder is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see L<http://www.gnu.org/licenses/>.
+
+#ifndef BB_REFCACHE_H
+#define BB_REFCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A reference cache holds a FASTA's contigs 2-bit packed, with their N and
+// soft-masked (lower case) runs, names and MD5s, laid out so the file can be
+// mapped and read in place, so processes share it through the page cache.
+// It is written by "brindley refcache" and read by brindley and brunel
+// through this reader.  Every section starts on an 8-byte boundary and all
+// integers are in the writer's byte order, which rc_open checks against
+// RC_BYTE_ORDER.
+//
+//   rc_header_t
+//   per contig: packed bases, N runs, soft-mask runs
+//   contig names, NUL terminated
+//   rc_contig_t[n_contigs], in FASTA order
+//   uint32_t[n_contigs], contig numbers in name order
+//
+// Base i of a contig is in bits 2 * (i % 4) of byte i / 4, as A=0 C=1 G=2
+// T=3.  Bases other than ACGT are stored as N.  Runs are half-open, within
+// the contig and in order.  The MD5 is the SAM M5 one, of the upper-cased
+// sequence as given.
+
+#define RC_MAGIC "BBREF\001\000\000"
+#define RC_MAGIC_LENGTH 8
+#define RC_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[RC_MAGIC_LENGTH];
+    uint32_t byte_order;
+    uint32_t n_contigs;
+    uint64_t contigs_offset;
+    uint64_t order_offset;
+    uint64_t file_size;
+} rc_header_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} rc_run_t;
+
+typedef struct {
+    uint64_t name_offset;
+    uint64_t length;
+    uint64_t seq_offset;
+    uint64_t n_offset;
+    uint64_t mask_offset;
+    uint32_t n_count;
+    uint32_t mask_count;
+    uint8_t md5[16];
+} rc_contig_t;
+
+typedef struct refcache refcache_t;
+
+// True if filename starts with RC_MAGIC
+bool rc_is_cache(const char* filename);
+// Map a cache, or NULL if it cannot be opened or is not a valid cache
+refcache_t* rc_open(const char* filename);
+uint32_t rc_ncontigs(const refcache_t* rc);
+const char* rc_name(const refcache_t* rc, uint32_t i);
+uint64_t rc_length(const refcache_t* rc, uint32_t i);
+const uint8_t* rc_md5(const refcache_t* rc, uint32_t i);
+// Contig number of name, or -1
+int64_t rc_find(const refcache_t* rc, const char* name);
+// Write bases [beg, end) of contig i to buf (not terminated), upper case
+// unless soft_mask; returns the count written, clipped to the contig
+uint64_t rc_fetch(const refcache_t* rc, uint32_t i, uint64_t beg, uint64_t end, bool soft_mask, char* buf);
+void rc_close(refcache_t* rc);
+
+#endif